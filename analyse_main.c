@@ -0,0 +1,175 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "analysis.h"
+#include "archive.h"
+#include "board.h"
+#include "pgn.h"
+#include "search.h"
+#include "search_cache.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Writes each game of in to standard output with every move evaluated and
+// the inaccuracies, mistakes and blunders marked. Timings go to stderr.
+int analyse_file(FILE *in, const search_limits_t *limits, int threads,
+                 size_t hash_megabytes, stats_t *stats) {
+  pgn_reader_t *reader = create_pgn_reader(in);
+  thread_pool_t *pool = create_thread_pool(threads);
+  search_table_t *table = create_search_table(hash_megabytes);
+  move_analysis_t *moves = NULL;
+  size_t capacity = 0;
+  archive_game_t game;
+  int status;
+  long number = 0;
+  double total = 0;
+
+  if (reader == NULL || pool == NULL || table == NULL) {
+    fprintf(stderr, "analyse: out of memory\n");
+    return 1;
+  }
+
+  while ((status = read_pgn_game(reader, &game)) != 0) {
+    number++;
+
+    if (status < 0) {
+      fprintf(stderr, "analyse: skipping game %ld\n", number);
+      continue;
+    }
+
+    if (game.ply_count > capacity) {
+      capacity = game.ply_count;
+      moves = realloc(moves, capacity * sizeof(move_analysis_t));
+    }
+
+    unsigned long long nodes;
+    double start = now_seconds();
+
+    if (!analyse_game(&game, pool, table, limits, stats, moves, &nodes) ||
+        !write_analysed_game(stdout, &game, moves)) {
+      fprintf(stderr, "analyse: could not analyse game %ld\n", number);
+      continue;
+    }
+
+    double seconds = now_seconds() - start;
+    total += seconds;
+    fprintf(stderr, "game %ld: %zu plies in %.2f s, %.0f nodes/s\n", number,
+            game.ply_count, seconds, nodes / seconds);
+  }
+
+  fprintf(stderr, "%ld games in %.2f s on %d threads\n", number, total,
+          thread_pool_size(pool));
+  free(moves);
+  free_search_table(table);
+  free_thread_pool(pool);
+  free_pgn_reader(reader);
+  return 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--ms N | --nodes N | --depth D] [--threads N]\n"
+          "          [--hash MB] [--cache FILE [--cache-size MB] "
+          "[--cache-depth D]]\n"
+          "          [--telemetry FILE] [--stats] [FILE.pgn]\n"
+          "Reads games from FILE or standard input.\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  search_limits_t limits = {0};
+  int threads = 0;
+  size_t hash_megabytes = 64;
+  const char *path = NULL;
+  const char *cache_path = NULL;
+  size_t cache_megabytes = 64;
+  bool show_stats = false;
+  stats_t stats = {0};
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) {
+      limits.milliseconds = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+      limits.nodes = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+      limits.depth = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+      hash_megabytes = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      cache_path = argv[++i];
+    } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+      cache_megabytes = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--cache-depth") == 0 && i + 1 < argc) {
+      limits.cache_depth = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+      if (limits.telemetry != NULL) {
+        close_telemetry(limits.telemetry);
+      }
+
+      if ((limits.telemetry = open_telemetry(argv[++i])) == NULL) {
+        fprintf(stderr, "analyse: could not open %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else if (argv[i][0] != '-' && path == NULL) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (limits.milliseconds == 0 && limits.nodes == 0 && limits.depth == 0) {
+    limits.milliseconds = 200;
+  }
+
+  if (cache_path != NULL &&
+      (limits.cache = open_search_cache(cache_path, cache_megabytes)) ==
+          NULL) {
+    fprintf(stderr, "analyse: could not open cache %s\n", cache_path);
+    return 1;
+  }
+
+  FILE *in = path != NULL ? fopen(path, "r") : stdin;
+
+  if (in == NULL) {
+    fprintf(stderr, "analyse: could not open %s\n", path);
+    return 1;
+  }
+
+  int status = analyse_file(in, &limits, threads, hash_megabytes,
+                            show_stats ? &stats : NULL);
+
+  if (show_stats) {
+    stats_print(stderr, &stats);
+  }
+
+  if (in != stdin) {
+    fclose(in);
+  }
+
+  if (limits.cache != NULL) {
+    close_search_cache(limits.cache);
+  }
+
+  if (limits.telemetry != NULL) {
+    close_telemetry(limits.telemetry);
+  }
+
+  return status;
+}
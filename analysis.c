@@ -0,0 +1,197 @@
+#include "analysis.h"
+#include "archive.h"
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "pgn.h"
+#include "search.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every position of the game, searched from the last to the first so that
+// the table fills with the endings that earlier searches run into. scores are
+// from the side to move.
+typedef struct AnalysisJob {
+  const search_limits_t *limits;
+  search_table_t *table;
+  board_t *positions;
+  unsigned long long *hashes;
+  board_t *boards;
+  search_result_t *results;
+  bool *searched;
+  atomic_long next;
+} analysis_job_t;
+
+void analyse_positions(thread_pool_t *pool, int index, void *arg) {
+  (void)pool;
+  analysis_job_t *job = arg;
+  board_t *board = &job->boards[index];
+  long ply;
+
+  while ((ply = atomic_fetch_sub(&job->next, 1)) >= 0) {
+    search_limits_t limits = *job->limits;
+    limits.history = job->hashes;
+    limits.history_length = ply;
+    copy_board(board, &job->positions[ply]);
+    job->searched[ply] =
+        search(board, &limits, job->table, &job->results[ply]);
+  }
+}
+
+int cap_score(int score) {
+  return score > ANALYSIS_SCORE_CAP    ? ANALYSIS_SCORE_CAP
+         : score < -ANALYSIS_SCORE_CAP ? -ANALYSIS_SCORE_CAP
+                                       : score;
+}
+
+// Searches every position of game with the pool's workers sharing table, and
+// fills moves[ply] for each move played. The boards count into stats, which
+// may be NULL. Returns false if the game cannot be replayed or memory runs
+// out.
+bool analyse_game(const archive_game_t *game, thread_pool_t *pool,
+                  search_table_t *table, const search_limits_t *limits,
+                  stats_t *stats, move_analysis_t *moves,
+                  unsigned long long *nodes) {
+  size_t count = game->ply_count + 1;
+  int threads = thread_pool_size(pool);
+  analysis_job_t job = {.limits = limits, .table = table};
+  job.positions = malloc(count * sizeof(board_t));
+  job.hashes = malloc(count * sizeof(unsigned long long));
+  job.boards = malloc(threads * sizeof(board_t));
+  job.results = malloc(count * sizeof(search_result_t));
+  job.searched = malloc(count * sizeof(bool));
+  bool ok = job.positions != NULL && job.hashes != NULL &&
+            job.boards != NULL && job.results != NULL && job.searched != NULL;
+  piece_color_t color;
+  *nodes = 0;
+
+  if (ok) {
+    board_t *board = &job.positions[0];
+    memset(board, 0, sizeof(board_t));
+    board->stats = stats;
+    ok = archive_start(board, game, &color);
+  }
+
+  for (size_t ply = 0; ok && ply < game->ply_count; ++ply) {
+    undo_t undo;
+    move_list_t legal;
+    move_t move = archive_move(game, ply);
+    board_t *board = &job.positions[ply + 1];
+    copy_board(board, &job.positions[ply]);
+    job.hashes[ply] = board->hash;
+    generate_legal_moves(board, board->side_to_move, &legal);
+    ok = false;
+
+    for (int i = 0; i < legal.length && !ok; ++i) {
+      ok = encode_move(legal.moves[i]) == encode_move(move);
+    }
+
+    if (ok) {
+      make_move(board, move, &undo);
+    }
+  }
+
+  if (ok) {
+    job.hashes[game->ply_count] = job.positions[game->ply_count].hash;
+    atomic_init(&job.next, (long)count - 1);
+
+    for (int i = 0; i < threads; ++i) {
+      thread_pool_submit(pool, i, analyse_positions, &job);
+    }
+
+    thread_pool_wait(pool);
+
+    for (size_t ply = 0; ply < count; ++ply) {
+      *nodes += job.searched[ply] ? job.results[ply].nodes : 0;
+    }
+  }
+
+  for (size_t ply = 0; ok && ply < game->ply_count; ++ply) {
+    board_t *board = &job.positions[ply];
+    int sign = board->side_to_move == WHITE ? 1 : -1;
+    search_result_t *before = &job.results[ply];
+    search_result_t *after = &job.results[ply + 1];
+    // A final position without moves is mate or stalemate.
+    int after_score = job.searched[ply + 1] ? after->score
+                      : job.positions[ply + 1].checkers != 0 ? -MATE_SCORE
+                                                             : 0;
+    move_analysis_t *analysis = &moves[ply];
+
+    analysis->best_move = before->best_move;
+    analysis->best_score = sign * before->score;
+    analysis->score = -sign * after_score;
+    analysis->depth = before->depth;
+    analysis->loss = cap_score(before->score) - cap_score(-after_score);
+
+    if (analysis->loss < 0 ||
+        encode_move(before->best_move) == encode_move(archive_move(game, ply))) {
+      analysis->loss = 0;
+    }
+  }
+
+  free(job.positions);
+  free(job.hashes);
+  free(job.boards);
+  free(job.results);
+  free(job.searched);
+  return ok;
+}
+
+// Marks a move by what it lost and describes it: the score after it and, for
+// a marked move, the move the search preferred. board is the position
+// before the move.
+void annotate_move(board_t *board, const move_analysis_t *analysis,
+                   move_t played, pgn_annotation_t *annotation) {
+  char score[16], best_score[16], best[10];
+  const char *mark = analysis->loss >= BLUNDER_LOSS      ? "??"
+                     : analysis->loss >= MISTAKE_LOSS    ? "?"
+                     : analysis->loss >= INACCURACY_LOSS ? "?!"
+                                                         : "";
+
+  snprintf(annotation->suffix, sizeof(annotation->suffix), "%s", mark);
+  format_score(analysis->score, score, sizeof(score));
+
+  // The SAN of a mating move already says so.
+  if (abs(analysis->score) == MATE_SCORE) {
+    score[0] = '\0';
+  }
+
+  if (mark[0] == '\0' ||
+      encode_move(played) == encode_move(analysis->best_move)) {
+    snprintf(annotation->comment, sizeof(annotation->comment), "%s", score);
+    return;
+  }
+
+  move_to_san(board, analysis->best_move, best);
+  format_score(analysis->best_score, best_score, sizeof(best_score));
+  snprintf(annotation->comment, sizeof(annotation->comment),
+           "%s; best %s %s", score, best, best_score);
+}
+
+// Writes game as PGN with each move marked and commented from moves.
+bool write_analysed_game(FILE *file, const archive_game_t *game,
+                         const move_analysis_t *moves) {
+  board_t *board = create_board();
+  pgn_annotation_t *annotations =
+      calloc(game->ply_count + 1, sizeof(pgn_annotation_t));
+  piece_color_t color;
+  bool ok = board != NULL && annotations != NULL &&
+            archive_start(board, game, &color);
+
+  for (size_t ply = 0; ok && ply < game->ply_count; ++ply) {
+    undo_t undo;
+    move_t move = archive_move(game, ply);
+    annotate_move(board, &moves[ply], move, &annotations[ply]);
+    make_move(board, move, &undo);
+  }
+
+  ok = ok && write_annotated_pgn_game(file, board, game, annotations);
+  free(annotations);
+  free_board(board);
+  return ok;
+}
@@ -0,0 +1,36 @@
+#include "archive.h"
+#include "pgn.h"
+#include "search.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <stdio.h>
+
+#pragma once
+
+// Centipawns a move must give up, from the mover's side, to be marked ?!, ?
+// or ??. Scores are capped at ANALYSIS_SCORE_CAP first, so that choosing a
+// slower win is not a blunder.
+#define INACCURACY_LOSS 50
+#define MISTAKE_LOSS 100
+#define BLUNDER_LOSS 300
+#define ANALYSIS_SCORE_CAP 1000
+
+// What the search made of the position before a move and the move played.
+// Scores are from white's side; loss is what the mover gave up in
+// centipawns.
+typedef struct MoveAnalysis {
+  move_t best_move;
+  int best_score;
+  int score;
+  int loss;
+  int depth;
+} move_analysis_t;
+
+bool analyse_game(const archive_game_t *game, thread_pool_t *pool,
+                  search_table_t *table, const search_limits_t *limits,
+                  stats_t *stats, move_analysis_t *moves,
+                  unsigned long long *nodes);
+void annotate_move(board_t *board, const move_analysis_t *analysis,
+                   move_t played, pgn_annotation_t *annotation);
+bool write_analysed_game(FILE *file, const archive_game_t *game,
+                         const move_analysis_t *moves);
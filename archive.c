@@ -0,0 +1,410 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "archive.h"
+#include "board.h"
+#include "move_piece.h"
+#include "types.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Archive layout, all integers little-endian:
+//
+//   file:   "TCGA" u32 version, then one record per game
+//   record: u16 ply_count, u8 result, u8 flags, u16 tags_length,
+//           u16 fen_length, tags, fen, ply_count u16 moves
+//
+// The index (path + ".idx") is "TCGI" u32 version followed by the u64 offset
+// of each record. It is only an accelerator: when it is missing or does not
+// match the archive the offsets are rebuilt by walking the records.
+#define ARCHIVE_MAGIC "TCGA"
+#define INDEX_MAGIC "TCGI"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 8
+#define RECORD_HEADER_SIZE 8
+#define ARCHIVE_BUFFER_SIZE (1 << 20)
+
+#define FLAG_FEN 1
+
+void put_u16(unsigned char *out, unsigned int value) {
+  out[0] = value;
+  out[1] = value >> 8;
+}
+
+unsigned int get_u16(const unsigned char *in) { return in[0] | in[1] << 8; }
+
+void put_u64(unsigned char *out, unsigned long long value) {
+  for (int i = 0; i < 8; ++i) {
+    out[i] = value >> (8 * i);
+  }
+}
+
+unsigned long long get_u64(const unsigned char *in) {
+  unsigned long long value = 0;
+
+  for (int i = 7; i >= 0; --i) {
+    value = value << 8 | in[i];
+  }
+
+  return value;
+}
+
+void file_header(unsigned char *header, const char *magic) {
+  memcpy(header, magic, 4);
+  header[4] = ARCHIVE_VERSION;
+  header[5] = header[6] = header[7] = 0;
+}
+
+// Opens path for appending, writing the file header if it is new and checking
+// it otherwise. Returns the file positioned at its end.
+FILE *open_appendable(const char *path, const char *magic, long *size) {
+  FILE *file = fopen(path, "a+b");
+
+  if (file == NULL) {
+    return NULL;
+  }
+
+  unsigned char expected[ARCHIVE_HEADER_SIZE];
+  file_header(expected, magic);
+
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+
+  if (*size == 0) {
+    if (fwrite(expected, 1, ARCHIVE_HEADER_SIZE, file) != ARCHIVE_HEADER_SIZE) {
+      fclose(file);
+      return NULL;
+    }
+
+    *size = ARCHIVE_HEADER_SIZE;
+    return file;
+  }
+
+  unsigned char header[ARCHIVE_HEADER_SIZE];
+  rewind(file);
+
+  if (fread(header, 1, ARCHIVE_HEADER_SIZE, file) != ARCHIVE_HEADER_SIZE ||
+      memcmp(header, expected, ARCHIVE_HEADER_SIZE) != 0) {
+    fclose(file);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  return file;
+}
+
+archive_writer_t *open_archive_writer(const char *path) {
+  archive_writer_t *writer = calloc(1, sizeof(archive_writer_t));
+  char *index_path = malloc(strlen(path) + 5);
+
+  if (writer == NULL || index_path == NULL) {
+    free(writer);
+    free(index_path);
+    return NULL;
+  }
+
+  sprintf(index_path, "%s.idx", path);
+
+  long data_size, index_size;
+  writer->data = open_appendable(path, ARCHIVE_MAGIC, &data_size);
+  writer->index = open_appendable(index_path, INDEX_MAGIC, &index_size);
+  free(index_path);
+
+  if (writer->data == NULL || writer->index == NULL) {
+    if (writer->data != NULL) {
+      fclose(writer->data);
+    }
+
+    if (writer->index != NULL) {
+      fclose(writer->index);
+    }
+
+    free(writer);
+    return NULL;
+  }
+
+  setvbuf(writer->data, NULL, _IOFBF, ARCHIVE_BUFFER_SIZE);
+  writer->offset = data_size;
+  writer->game_count = (index_size - ARCHIVE_HEADER_SIZE) / 8;
+  return writer;
+}
+
+bool archive_append(archive_writer_t *writer, const archive_game_t *game) {
+  if (game->ply_count > 0xffff || game->tags_length > 0xffff ||
+      game->fen_length > 0xffff) {
+    return false;
+  }
+
+  unsigned char header[RECORD_HEADER_SIZE];
+  put_u16(header, game->ply_count);
+  header[2] = game->result;
+  header[3] = game->fen_length > 0 ? FLAG_FEN : 0;
+  put_u16(header + 4, game->tags_length);
+  put_u16(header + 6, game->fen_length);
+
+  unsigned char offset[8];
+  put_u64(offset, writer->offset);
+
+  if (fwrite(header, 1, RECORD_HEADER_SIZE, writer->data) !=
+          RECORD_HEADER_SIZE ||
+      fwrite(game->tags, 1, game->tags_length, writer->data) !=
+          game->tags_length ||
+      fwrite(game->fen, 1, game->fen_length, writer->data) !=
+          game->fen_length ||
+      fwrite(game->moves, 2, game->ply_count, writer->data) !=
+          game->ply_count ||
+      fwrite(offset, 1, 8, writer->index) != 8) {
+    return false;
+  }
+
+  writer->offset += RECORD_HEADER_SIZE + game->tags_length + game->fen_length +
+                    2 * game->ply_count;
+  writer->game_count++;
+  return true;
+}
+
+bool close_archive_writer(archive_writer_t *writer) {
+  bool ok = fclose(writer->data) == 0;
+  ok = fclose(writer->index) == 0 && ok;
+  free(writer);
+  return ok;
+}
+
+// Size of the record at offset, or 0 if it runs past the end of the archive.
+size_t record_size(const archive_t *archive, unsigned long long offset) {
+  if (offset < ARCHIVE_HEADER_SIZE ||
+      offset + RECORD_HEADER_SIZE > archive->size) {
+    return 0;
+  }
+
+  const unsigned char *record = archive->data + offset;
+  size_t size = RECORD_HEADER_SIZE + get_u16(record + 4) +
+                get_u16(record + 6) + 2 * (size_t)get_u16(record);
+
+  return offset + size <= archive->size ? size : 0;
+}
+
+bool load_index(archive_t *archive, const char *path) {
+  char *index_path = malloc(strlen(path) + 5);
+
+  if (index_path == NULL) {
+    return false;
+  }
+
+  sprintf(index_path, "%s.idx", path);
+  FILE *file = fopen(index_path, "rb");
+  free(index_path);
+
+  if (file == NULL) {
+    return false;
+  }
+
+  unsigned char header[ARCHIVE_HEADER_SIZE], expected[ARCHIVE_HEADER_SIZE];
+  file_header(expected, INDEX_MAGIC);
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+
+  if (size < ARCHIVE_HEADER_SIZE || (size - ARCHIVE_HEADER_SIZE) % 8 != 0 ||
+      fread(header, 1, ARCHIVE_HEADER_SIZE, file) != ARCHIVE_HEADER_SIZE ||
+      memcmp(header, expected, ARCHIVE_HEADER_SIZE) != 0) {
+    fclose(file);
+    return false;
+  }
+
+  size_t count = (size - ARCHIVE_HEADER_SIZE) / 8;
+  unsigned char *raw = malloc(count * 8 + 1);
+  archive->offsets = malloc(count * sizeof(unsigned long long) + 1);
+
+  if (raw == NULL || archive->offsets == NULL ||
+      fread(raw, 8, count, file) != count) {
+    free(raw);
+    free(archive->offsets);
+    archive->offsets = NULL;
+    fclose(file);
+    return false;
+  }
+
+  fclose(file);
+
+  for (size_t i = 0; i < count; ++i) {
+    archive->offsets[i] = get_u64(raw + 8 * i);
+  }
+
+  free(raw);
+
+  // An index left behind by an interrupted write no longer ends where the
+  // archive does. Checking the ends keeps opening O(1); every record is still
+  // bounds-checked when it is read.
+  unsigned long long end =
+      count == 0 ? ARCHIVE_HEADER_SIZE
+                 : archive->offsets[count - 1] +
+                       record_size(archive, archive->offsets[count - 1]);
+
+  if ((count > 0 && archive->offsets[0] != ARCHIVE_HEADER_SIZE) ||
+      end != archive->size) {
+    free(archive->offsets);
+    archive->offsets = NULL;
+    return false;
+  }
+
+  archive->game_count = count;
+  return true;
+}
+
+bool scan_records(archive_t *archive) {
+  size_t capacity = 1024;
+  archive->offsets = malloc(capacity * sizeof(unsigned long long));
+  archive->game_count = 0;
+
+  unsigned long long offset = ARCHIVE_HEADER_SIZE;
+
+  while (archive->offsets != NULL && offset < archive->size) {
+    size_t size = record_size(archive, offset);
+
+    if (size == 0) {
+      return false;
+    }
+
+    if (archive->game_count == capacity) {
+      capacity *= 2;
+      unsigned long long *offsets =
+          realloc(archive->offsets, capacity * sizeof(unsigned long long));
+
+      if (offsets == NULL) {
+        return false;
+      }
+
+      archive->offsets = offsets;
+    }
+
+    archive->offsets[archive->game_count++] = offset;
+    offset += size;
+  }
+
+  return archive->offsets != NULL;
+}
+
+archive_t *open_archive(const char *path) {
+  archive_t *archive = calloc(1, sizeof(archive_t));
+
+  if (archive == NULL) {
+    return NULL;
+  }
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < ARCHIVE_HEADER_SIZE) {
+    if (fd >= 0) {
+      close(fd);
+    }
+
+    free(archive);
+    return NULL;
+  }
+
+  archive->size = st.st_size;
+  void *data = mmap(NULL, archive->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  unsigned char expected[ARCHIVE_HEADER_SIZE];
+  file_header(expected, ARCHIVE_MAGIC);
+
+  if (data == MAP_FAILED ||
+      memcmp(data, expected, ARCHIVE_HEADER_SIZE) != 0) {
+    if (data != MAP_FAILED) {
+      munmap(data, archive->size);
+    }
+
+    free(archive);
+    return NULL;
+  }
+
+  archive->data = data;
+  posix_madvise(data, archive->size, POSIX_MADV_SEQUENTIAL);
+
+  if (!load_index(archive, path) && !scan_records(archive)) {
+    close_archive(archive);
+    return NULL;
+  }
+
+  return archive;
+}
+
+void close_archive(archive_t *archive) {
+  munmap((void *)archive->data, archive->size);
+  free(archive->offsets);
+  free(archive);
+}
+
+bool archive_game(const archive_t *archive, size_t index,
+                  archive_game_t *game) {
+  if (index >= archive->game_count ||
+      record_size(archive, archive->offsets[index]) == 0) {
+    return false;
+  }
+
+  const unsigned char *record = archive->data + archive->offsets[index];
+
+  game->ply_count = get_u16(record);
+  game->result = record[2];
+  game->tags_length = get_u16(record + 4);
+  game->fen_length = get_u16(record + 6);
+  game->tags = (const char *)record + RECORD_HEADER_SIZE;
+  game->fen = game->tags + game->tags_length;
+  game->moves = (const unsigned char *)game->fen + game->fen_length;
+
+  return true;
+}
+
+// Returns the value of the named tag, or NULL if the game does not have it.
+const char *archive_tag(const archive_game_t *game, const char *name) {
+  const char *tag = game->tags;
+  const char *end = game->tags + game->tags_length;
+
+  while (tag < end) {
+    const char *value = tag + strnlen(tag, end - tag) + 1;
+
+    if (value >= end) {
+      break;
+    }
+
+    if (strcmp(tag, name) == 0) {
+      return value;
+    }
+
+    tag = value + strnlen(value, end - value) + 1;
+  }
+
+  return NULL;
+}
+
+move_t archive_move(const archive_game_t *game, size_t ply) {
+  return decode_move(get_u16(game->moves + 2 * ply));
+}
+
+// Sets up the board for the start of game.
+bool archive_start(board_t *board, const archive_game_t *game,
+                   piece_color_t *color_to_move) {
+  char fen[128];
+
+  if (game->fen_length == 0) {
+    return load_fen(board, START_FEN, color_to_move) != NULL;
+  }
+
+  if (game->fen_length >= sizeof(fen)) {
+    return false;
+  }
+
+  memcpy(fen, game->fen, game->fen_length);
+  fen[game->fen_length] = '\0';
+
+  return load_fen(board, fen, color_to_move) != NULL;
+}
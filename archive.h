@@ -0,0 +1,44 @@
+#include "types.h"
+#include <stdio.h>
+
+#pragma once
+
+// A game as stored in an archive. tags holds NUL-terminated name and value
+// strings back to back; fen is empty for games from the standard start
+// position; moves holds ply_count little-endian moves from encode_move.
+typedef struct ArchiveGame {
+  const char *tags;
+  size_t tags_length;
+  const char *fen;
+  size_t fen_length;
+  game_result_t result;
+  const unsigned char *moves;
+  size_t ply_count;
+} archive_game_t;
+
+typedef struct ArchiveWriter {
+  FILE *data;
+  FILE *index;
+  unsigned long long offset;
+  unsigned long long game_count;
+} archive_writer_t;
+
+typedef struct Archive {
+  const unsigned char *data;
+  size_t size;
+  unsigned long long *offsets;
+  size_t game_count;
+} archive_t;
+
+archive_writer_t *open_archive_writer(const char *path);
+bool archive_append(archive_writer_t *writer, const archive_game_t *game);
+bool close_archive_writer(archive_writer_t *writer);
+
+archive_t *open_archive(const char *path);
+void close_archive(archive_t *archive);
+bool archive_game(const archive_t *archive, size_t index,
+                  archive_game_t *game);
+const char *archive_tag(const archive_game_t *game, const char *name);
+move_t archive_move(const archive_game_t *game, size_t ply);
+bool archive_start(board_t *board, const archive_game_t *game,
+                   piece_color_t *color_to_move);
@@ -0,0 +1,284 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "archive.h"
+#include "board.h"
+#include "move_piece.h"
+#include "pgn.h"
+#include "stats.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+long long file_size(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+int import_pgn(const char *pgn_path, const char *archive_path,
+               stats_t *stats) {
+  FILE *file = strcmp(pgn_path, "-") == 0 ? stdin : fopen(pgn_path, "r");
+
+  if (file == NULL) {
+    perror(pgn_path);
+    return 1;
+  }
+
+  pgn_reader_t *reader = create_pgn_reader(file);
+  archive_writer_t *writer = open_archive_writer(archive_path);
+
+  if (reader == NULL || writer == NULL) {
+    fprintf(stderr, "archive: could not open %s\n", archive_path);
+    return 1;
+  }
+
+  reader->board->stats = stats;
+  archive_game_t game;
+  size_t imported = 0, skipped = 0, plies = 0;
+  double start = now_seconds();
+  int res;
+  bool ok = true;
+
+  while ((res = read_pgn_game(reader, &game)) != 0) {
+    if (res < 0) {
+      skipped++;
+      continue;
+    }
+
+    if (!archive_append(writer, &game)) {
+      ok = false;
+      break;
+    }
+
+    imported++;
+    plies += game.ply_count;
+  }
+
+  ok = close_archive_writer(writer) && ok;
+  free_pgn_reader(reader);
+
+  if (file != stdin) {
+    fclose(file);
+  }
+
+  printf("imported %zu games (%zu plies), skipped %zu, %.3fs\n", imported,
+         plies, skipped, now_seconds() - start);
+
+  if (!ok) {
+    fprintf(stderr, "archive: error writing %s\n", archive_path);
+    return 1;
+  }
+
+  return 0;
+}
+
+// Writes every game, or only the one at index when it is not negative.
+int export_pgn(const char *archive_path, long index, stats_t *stats) {
+  archive_t *archive = open_archive(archive_path);
+  board_t *board = create_board();
+
+  if (archive == NULL || board == NULL) {
+    fprintf(stderr, "archive: could not open %s\n", archive_path);
+    return 1;
+  }
+
+  board->stats = stats;
+
+  if (index >= 0 && (size_t)index >= archive->game_count) {
+    fprintf(stderr, "archive: no such game %ld (%s has %zu)\n", index,
+            archive_path, archive->game_count);
+    free_board(board);
+    close_archive(archive);
+    return 1;
+  }
+
+  size_t first = index < 0 ? 0 : (size_t)index;
+  size_t last = index < 0 ? archive->game_count : first + 1;
+  int res = 0;
+
+  for (size_t i = first; i < last; ++i) {
+    archive_game_t game;
+
+    if (!archive_game(archive, i, &game) ||
+        !write_pgn_game(stdout, board, &game)) {
+      fprintf(stderr, "archive: game %zu is corrupt\n", i);
+      res = 1;
+    }
+  }
+
+  free_board(board);
+  close_archive(archive);
+  return res;
+}
+
+int archive_info(const char *archive_path) {
+  archive_t *archive = open_archive(archive_path);
+
+  if (archive == NULL) {
+    fprintf(stderr, "archive: could not open %s\n", archive_path);
+    return 1;
+  }
+
+  size_t plies = 0;
+  size_t results[4] = {0};
+
+  for (size_t i = 0; i < archive->game_count; ++i) {
+    archive_game_t game;
+
+    if (archive_game(archive, i, &game)) {
+      plies += game.ply_count;
+      results[game.result < 4 ? game.result : RESULT_UNKNOWN]++;
+    }
+  }
+
+  printf("games: %zu\n", archive->game_count);
+  printf("plies: %zu\n", plies);
+  printf("results: %zu white, %zu black, %zu drawn, %zu unknown\n",
+         results[WHITE_WINS], results[BLACK_WINS], results[DRAWN],
+         results[RESULT_UNKNOWN]);
+  printf("size: %zu bytes (%.2f bytes/ply)\n", archive->size,
+         plies > 0 ? (double)archive->size / plies : 0.0);
+
+  char index_path[4096];
+  snprintf(index_path, sizeof(index_path), "%s.idx", archive_path);
+  long long index_size = file_size(index_path);
+
+  if (index_size >= 0) {
+    printf("index: %lld bytes\n", index_size);
+  } else {
+    printf("index: missing\n");
+  }
+
+  close_archive(archive);
+  return 0;
+}
+
+// Replays every game on a board, as a measure of how quickly an archive can
+// be consumed.
+int replay_archive(const char *archive_path, stats_t *stats) {
+  archive_t *archive = open_archive(archive_path);
+  board_t *board = create_board();
+
+  if (archive == NULL || board == NULL) {
+    fprintf(stderr, "archive: could not open %s\n", archive_path);
+    return 1;
+  }
+
+  board->stats = stats;
+
+  size_t plies = 0;
+  unsigned long long checksum = 0;
+  double start = now_seconds();
+
+  for (size_t i = 0; i < archive->game_count; ++i) {
+    archive_game_t game;
+    piece_color_t color;
+
+    if (!archive_game(archive, i, &game) ||
+        !archive_start(board, &game, &color)) {
+      continue;
+    }
+
+    bool corrupt = false;
+
+    for (size_t ply = 0; ply < game.ply_count; ++ply) {
+      move_t move = archive_move(&game, ply);
+
+      if (!legal_archive_move(board, move)) {
+        fprintf(stderr, "archive: game %zu is corrupt at ply %zu\n", i, ply);
+        corrupt = true;
+        break;
+      }
+
+      undo_t undo;
+      make_move(board, move, &undo);
+      plies++;
+    }
+
+    if (!corrupt) {
+      checksum ^= board->hash;
+    }
+  }
+
+  double seconds = now_seconds() - start;
+
+  printf("replayed %zu games, %zu plies in %.3fs (%.0f plies/s), final "
+         "positions %016llx\n",
+         archive->game_count, plies, seconds, plies / seconds, checksum);
+
+  free_board(board);
+  close_archive(archive);
+  return 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--stats] import PGN ARCHIVE\n"
+          "       %s [--stats] export ARCHIVE [GAME]\n"
+          "       %s info ARCHIVE\n"
+          "       %s [--stats] replay ARCHIVE\n",
+          program, program, program, program);
+}
+
+// Runs the command given by argv with the rules engine counting into stats.
+int run_command(int argc, char **argv, stats_t *stats) {
+  if (argc == 4 && strcmp(argv[1], "import") == 0) {
+    return import_pgn(argv[2], argv[3], stats);
+  }
+
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "export") == 0) {
+    char *end = NULL;
+    long index = argc == 4 ? strtol(argv[3], &end, 10) : -1;
+
+    if (argc == 4 && (end == argv[3] || *end != '\0' || index < 0)) {
+      fprintf(stderr, "archive: invalid game number: %s\n", argv[3]);
+      return 1;
+    }
+
+    return export_pgn(argv[2], index, stats);
+  }
+
+  if (argc == 3 && strcmp(argv[1], "info") == 0) {
+    return archive_info(argv[2]);
+  }
+
+  if (argc == 3 && strcmp(argv[1], "replay") == 0) {
+    return replay_archive(argv[2], stats);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  stats_t stats = {0};
+  bool show_stats = false;
+  int kept = 1;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+
+  argc = kept;
+  int status = run_command(argc, argv, show_stats ? &stats : NULL);
+
+  // Exported games go to standard output, so the statistics go to stderr.
+  if (show_stats) {
+    stats_print(stderr, &stats);
+  }
+
+  return status;
+}
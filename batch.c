@@ -0,0 +1,491 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "search.h"
+#include "stats.h"
+#include "types.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BATCH_LINE_SIZE 4096
+#define BATCH_CHUNK_SIZE 65536
+#define BATCH_CHUNK_LINES 1024
+#define BATCH_RESULT_SIZE 80
+#define BATCH_PV_MOVES 10
+#define BATCH_PV_SIZE 128
+#define BATCH_HASH_MEGABYTES 16
+
+typedef enum ChunkState {
+  CHUNK_FREE,
+  CHUNK_FILLING,
+  CHUNK_READ,
+  CHUNK_WORKING,
+  CHUNK_DONE,
+} chunk_state_t;
+
+// Lines travel from the reader to the workers and on to the writer in chunks,
+// so that synchronisation is paid per chunk rather than per line and no
+// memory is allocated once the service is running.
+typedef struct BatchChunk {
+  char input[BATCH_CHUNK_SIZE];
+  size_t input_length;
+  char *output;
+  size_t output_length;
+  size_t sequence;
+  chunk_state_t state;
+} batch_chunk_t;
+
+// When limits is set every position is also searched. A search takes far
+// longer than a status, so chunks then hold one line each to spread the
+// searches over the workers.
+typedef struct BatchService {
+  batch_chunk_t *chunks;
+  int chunk_count;
+  size_t chunk_lines;
+  size_t result_size;
+  const search_limits_t *limits;
+  stats_t *stats;
+  size_t chunks_read;
+  bool eof;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} batch_service_t;
+
+batch_chunk_t *acquire_free_chunk(batch_service_t *service) {
+  pthread_mutex_lock(&service->lock);
+
+  while (true) {
+    for (int i = 0; i < service->chunk_count; ++i) {
+      if (service->chunks[i].state == CHUNK_FREE) {
+        service->chunks[i].state = CHUNK_FILLING;
+        pthread_mutex_unlock(&service->lock);
+        return &service->chunks[i];
+      }
+    }
+
+    pthread_cond_wait(&service->changed, &service->lock);
+  }
+}
+
+void submit_chunk(batch_service_t *service, batch_chunk_t *chunk) {
+  pthread_mutex_lock(&service->lock);
+  chunk->sequence = service->chunks_read++;
+  chunk->state = CHUNK_READ;
+  pthread_cond_broadcast(&service->changed);
+  pthread_mutex_unlock(&service->lock);
+}
+
+// Copies complete lines from pending into chunks, returning how many bytes of
+// pending were consumed.
+size_t dispatch_lines(batch_service_t *service, char *pending,
+                      size_t length) {
+  size_t consumed = 0;
+
+  while (consumed < length) {
+    char *newline = memchr(pending + consumed, '\n', length - consumed);
+
+    if (newline == NULL) {
+      break;
+    }
+
+    batch_chunk_t *chunk = acquire_free_chunk(service);
+    size_t lines = 0;
+    size_t start = consumed;
+
+    while (newline != NULL && lines < service->chunk_lines &&
+           (size_t)(newline + 1 - pending) - start <= BATCH_CHUNK_SIZE) {
+      consumed = newline + 1 - pending;
+      lines++;
+      newline = memchr(pending + consumed, '\n', length - consumed);
+    }
+
+    memcpy(chunk->input, pending + start, consumed - start);
+    chunk->input_length = consumed - start;
+    submit_chunk(service, chunk);
+  }
+
+  return consumed;
+}
+
+void *batch_reader(void *arg) {
+  batch_service_t *service = arg;
+  char *pending = malloc(BATCH_CHUNK_SIZE);
+  size_t length = 0;
+  bool discarding = false;
+
+  while (pending != NULL) {
+    ssize_t res =
+        read(STDIN_FILENO, pending + length, BATCH_CHUNK_SIZE - length);
+
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (res <= 0) {
+      if (length > 0 && !discarding) {
+        pending[length++] = '\n';
+        dispatch_lines(service, pending, length);
+      }
+      break;
+    }
+
+    size_t start = length;
+    length += res;
+
+    // The tail of a line that was too long is dropped; its replacement line
+    // has already been queued.
+    if (discarding) {
+      char *newline = memchr(pending + start, '\n', length - start);
+
+      if (newline == NULL) {
+        length = start;
+        continue;
+      }
+
+      size_t rest = length - (newline + 1 - pending);
+      memmove(pending + start, newline + 1, rest);
+      length = start + rest;
+      discarding = false;
+    }
+
+    size_t consumed = dispatch_lines(service, pending, length);
+    memmove(pending, pending + consumed, length - consumed);
+    length -= consumed;
+
+    if (length >= BATCH_LINE_SIZE) {
+      // Replace the oversized line by one that is rejected as malformed so
+      // output stays aligned with input.
+      memcpy(pending, "-\n", 2);
+      dispatch_lines(service, pending, 2);
+      length = 0;
+      discarding = true;
+    }
+  }
+
+  free(pending);
+
+  pthread_mutex_lock(&service->lock);
+  service->eof = true;
+  pthread_cond_broadcast(&service->changed);
+  pthread_mutex_unlock(&service->lock);
+
+  return NULL;
+}
+
+// Writes the lines of a multi-PV search of board as
+//   depth=D pv1=SCORE,SAN,SAN,... pv2=...
+// with scores from the side to move and at most BATCH_PV_MOVES moves each.
+size_t search_status(board_t *board, search_table_t *table,
+                     const search_limits_t *limits, char *result,
+                     size_t size) {
+  search_result_t *search_result = malloc(sizeof(search_result_t));
+
+  if (search_result == NULL || !search(board, limits, table, search_result)) {
+    free(search_result);
+    return 0;
+  }
+
+  size_t length = snprintf(result, size, " depth=%d", search_result->depth);
+
+  for (int i = 0; i < search_result->line_count; ++i) {
+    const search_line_t *line = &search_result->lines[i];
+    int count = line->pv_length < BATCH_PV_MOVES ? line->pv_length
+                                                  : BATCH_PV_MOVES;
+    undo_t undo[BATCH_PV_MOVES];
+    char score[16];
+
+    format_score(line->score, score, sizeof(score));
+    length += snprintf(result + length, size - length, " pv%d=%s", i + 1,
+                       score);
+
+    for (int j = 0; j < count; ++j) {
+      char san[10];
+      move_to_san(board, line->pv[j], san);
+      make_move(board, line->pv[j], &undo[j]);
+      length += snprintf(result + length, size - length, ",%s", san);
+    }
+
+    for (int j = count - 1; j >= 0; --j) {
+      unmake_move(board, line->pv[j], &undo[j]);
+    }
+  }
+
+  free(search_result);
+  return length;
+}
+
+// Writes the status of the position given by line to result, which holds
+// size bytes.
+size_t position_status(board_t *board, move_list_t *moves,
+                       search_table_t *table, const search_limits_t *limits,
+                       char *line, char *result, size_t size) {
+  piece_color_t color_to_move;
+  const char *rest = load_fen(board, line, &color_to_move);
+
+  while (rest != NULL && *rest != '\0') {
+    if (*rest == ' ' || *rest == '\t') {
+      rest++;
+      continue;
+    }
+
+    char san[16];
+    size_t length = strcspn(rest, " \t");
+
+    if (length >= sizeof(san)) {
+      rest = NULL;
+      break;
+    }
+
+    memcpy(san, rest, length);
+    san[length] = '\0';
+    rest += length;
+
+    if (!move_from_san(board, san, color_to_move)) {
+      rest = NULL;
+      break;
+    }
+
+    color_to_move = color_to_move == WHITE ? BLACK : WHITE;
+  }
+
+  if (rest == NULL) {
+    memcpy(result, "legal=0\n", 8);
+    return 8;
+  }
+
+  bool in_check = board->checkers != 0;
+  generate_legal_moves(board, color_to_move, moves);
+
+  size_t length = snprintf(result, BATCH_RESULT_SIZE,
+                           "legal=1 check=%d checkmate=%d stalemate=%d "
+                           "insufficient=%d moves=%d",
+                           in_check, in_check && moves->length == 0,
+                           !in_check && moves->length == 0,
+                           insufficient_material(board), moves->length);
+
+  if (limits != NULL) {
+    length += search_status(board, table, limits, result + length,
+                            size - length - 1);
+  }
+
+  result[length++] = '\n';
+  return length;
+}
+
+void process_chunk(batch_service_t *service, board_t *board,
+                   move_list_t *moves, search_table_t *table,
+                   batch_chunk_t *chunk) {
+  char *line = chunk->input;
+  char *end = chunk->input + chunk->input_length;
+
+  chunk->output_length = 0;
+
+  while (line < end) {
+    char *newline = memchr(line, '\n', end - line);
+    *newline = '\0';
+
+    if (newline > line && newline[-1] == '\r') {
+      newline[-1] = '\0';
+    }
+
+    chunk->output_length +=
+        position_status(board, moves, table, service->limits, line,
+                        chunk->output + chunk->output_length,
+                        service->result_size);
+    line = newline + 1;
+  }
+}
+
+void *batch_worker(void *arg) {
+  batch_service_t *service = arg;
+  board_t *board = create_board();
+  move_list_t *moves = malloc(sizeof(move_list_t));
+
+  if (board != NULL) {
+    board->stats = service->stats;
+  }
+
+  search_table_t *table = service->limits != NULL
+                              ? create_search_table(BATCH_HASH_MEGABYTES)
+                              : NULL;
+  bool ready = board != NULL && moves != NULL &&
+               (service->limits == NULL || table != NULL);
+
+  pthread_mutex_lock(&service->lock);
+
+  while (true) {
+    batch_chunk_t *chunk = NULL;
+
+    for (int i = 0; i < service->chunk_count; ++i) {
+      batch_chunk_t *candidate = &service->chunks[i];
+
+      if (candidate->state == CHUNK_READ &&
+          (chunk == NULL || candidate->sequence < chunk->sequence)) {
+        chunk = candidate;
+      }
+    }
+
+    if (chunk == NULL) {
+      if (service->eof) {
+        break;
+      }
+
+      pthread_cond_wait(&service->changed, &service->lock);
+      continue;
+    }
+
+    chunk->state = CHUNK_WORKING;
+    pthread_mutex_unlock(&service->lock);
+
+    if (ready) {
+      process_chunk(service, board, moves, table, chunk);
+    } else {
+      chunk->output_length = 0;
+    }
+
+    pthread_mutex_lock(&service->lock);
+    chunk->state = CHUNK_DONE;
+    pthread_cond_broadcast(&service->changed);
+  }
+
+  pthread_mutex_unlock(&service->lock);
+
+  free(moves);
+
+  if (table != NULL) {
+    free_search_table(table);
+  }
+
+  if (board != NULL) {
+    free_board(board);
+  }
+
+  return NULL;
+}
+
+// Writes finished chunks in the order they were read.
+void batch_writer(batch_service_t *service) {
+  size_t next = 0;
+
+  pthread_mutex_lock(&service->lock);
+
+  while (true) {
+    batch_chunk_t *chunk = NULL;
+
+    for (int i = 0; i < service->chunk_count; ++i) {
+      if (service->chunks[i].state == CHUNK_DONE &&
+          service->chunks[i].sequence == next) {
+        chunk = &service->chunks[i];
+      }
+    }
+
+    if (chunk == NULL) {
+      if (service->eof && next == service->chunks_read) {
+        break;
+      }
+
+      pthread_cond_wait(&service->changed, &service->lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&service->lock);
+
+    size_t written = 0;
+
+    while (written < chunk->output_length) {
+      ssize_t res = write(STDOUT_FILENO, chunk->output + written,
+                          chunk->output_length - written);
+
+      if (res < 0 && errno != EINTR) {
+        break;
+      }
+
+      if (res > 0) {
+        written += res;
+      }
+    }
+
+    pthread_mutex_lock(&service->lock);
+    chunk->state = CHUNK_FREE;
+    next++;
+    pthread_cond_broadcast(&service->changed);
+  }
+
+  pthread_mutex_unlock(&service->lock);
+}
+
+void free_chunks(batch_service_t *service) {
+  for (int i = 0; service->chunks != NULL && i < service->chunk_count; ++i) {
+    free(service->chunks[i].output);
+  }
+
+  free(service->chunks);
+}
+
+int run_batch(int threads, const search_limits_t *limits, stats_t *stats) {
+  if (threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (int)cpus : 1;
+  }
+
+  batch_service_t service;
+  service.chunk_count = 2 * threads + 2;
+  service.chunks = calloc(service.chunk_count, sizeof(batch_chunk_t));
+  service.chunks_read = 0;
+  service.eof = false;
+  service.limits = limits;
+  service.stats = stats;
+  service.chunk_lines = limits != NULL ? 1 : BATCH_CHUNK_LINES;
+  service.result_size = BATCH_RESULT_SIZE;
+
+  if (limits != NULL) {
+    service.result_size += MAX_MULTIPV * BATCH_PV_SIZE;
+  }
+
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  bool ready = service.chunks != NULL && workers != NULL;
+
+  for (int i = 0; ready && i < service.chunk_count; ++i) {
+    service.chunks[i].output =
+        malloc(service.chunk_lines * service.result_size);
+    ready = service.chunks[i].output != NULL;
+  }
+
+  if (!ready) {
+    free_chunks(&service);
+    free(workers);
+    return 1;
+  }
+
+  pthread_mutex_init(&service.lock, NULL);
+  pthread_cond_init(&service.changed, NULL);
+
+  pthread_t reader;
+  pthread_create(&reader, NULL, batch_reader, &service);
+
+  for (int i = 0; i < threads; ++i) {
+    pthread_create(&workers[i], NULL, batch_worker, &service);
+  }
+
+  batch_writer(&service);
+
+  pthread_join(reader, NULL);
+
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&service.changed);
+  pthread_mutex_destroy(&service.lock);
+  free_chunks(&service);
+  free(workers);
+
+  return 0;
+}
@@ -0,0 +1,9 @@
+#include "search.h"
+#include "types.h"
+
+#pragma once
+
+// Answers one status line per FEN line on stdin. With limits, each position
+// is also searched and its best lines are added to its status. With stats,
+// the workers count their calls into it.
+int run_batch(int threads, const search_limits_t *limits, stats_t *stats);
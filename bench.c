@@ -0,0 +1,653 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "position_batch.h"
+#include "stats.h"
+#include "types.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_SAMPLES 10
+#define BENCH_SAMPLE_NS 20000000.0
+#define BENCH_BATCH_POSITIONS 4096
+#define BENCH_BATCH_NS 200000000.0
+
+typedef struct BenchPosition {
+  const char *fen;
+  const char *san;
+  board_t *board;
+  board_t *scratch;
+  piece_color_t color;
+} bench_position_t;
+
+// Each benchmark runs over one position, returns a value that is folded into
+// its signature and reports how many operations it performed.
+typedef struct Benchmark {
+  const char *name;
+  unsigned long long (*run)(bench_position_t *position, int *ops);
+  double median_ns;
+  double spread_ns;
+  int ops_per_pass;
+  long passes;
+  double samples[BENCH_SAMPLES];
+  unsigned long long signature;
+} benchmark_t;
+
+bench_position_t positions[] = {
+    {.fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+     .san = "Nf3"},
+    {.fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - "
+            "0 1",
+     .san = "Qxf6"},
+    {.fen = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", .san = "e4"},
+    {.fen = "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+     .san = "Kh1"},
+    {.fen = "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+     .san = "dxc8=Q"},
+    {.fen = "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - "
+            "- 0 10",
+     .san = "Nd5"},
+    {.fen = "8/5k2/8/8/8/8/3K4/4R3 w - - 0 1", .san = "Re7"},
+};
+
+#define POSITION_COUNT (int)(sizeof(positions) / sizeof(positions[0]))
+
+unsigned long long bench_square_attacked(bench_position_t *position,
+                                         int *ops) {
+  board_t *board = position->board;
+  unsigned long long attacked = 0;
+
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      square_t *square = &board->squares[i][j];
+      attacked = attacked * 3 + square_attacked(board, square, WHITE);
+      attacked = attacked * 3 + square_attacked(board, square, BLACK);
+    }
+  }
+
+  *ops = 128;
+  return attacked;
+}
+
+unsigned long long bench_is_in_check(bench_position_t *position, int *ops) {
+  *ops = 2;
+  return is_in_check(position->board, WHITE) * 2 +
+         is_in_check(position->board, BLACK);
+}
+
+unsigned long long bench_has_legal_move(bench_position_t *position,
+                                        int *ops) {
+  *ops = 2;
+  return has_legal_move(position->board, WHITE) * 2 +
+         has_legal_move(position->board, BLACK);
+}
+
+unsigned long long bench_is_legal_move(bench_position_t *position, int *ops) {
+  unsigned long long legal = 0;
+  *ops = 0;
+
+  for (int i = 0; i < position->board->piece_count; ++i) {
+    piece_t *piece = &position->board->pieces[i];
+
+    if (piece->square == NULL || piece->color != position->color) {
+      continue;
+    }
+
+    for (int j = 0; j < 64; ++j) {
+      square_t *square = &position->board->squares[j / 8][j % 8];
+      legal = legal * 3 + is_legal_move(position->board, piece, square);
+      (*ops)++;
+    }
+  }
+
+  return legal;
+}
+
+unsigned long long bench_move_from_san(bench_position_t *position, int *ops) {
+  char san[16];
+  strcpy(san, position->san);
+
+  // Every operation starts from a fresh copy of the position, so copy_board
+  // is included in the timing.
+  copy_board(position->scratch, position->board);
+
+  if (!move_from_san(position->scratch, san, position->color)) {
+    fprintf(stderr, "bench: %s is not legal in %s\n", position->san,
+            position->fen);
+    exit(1);
+  }
+
+  *ops = 1;
+  return position->scratch->fifty_move_rule_counter;
+}
+
+unsigned long long bench_board_to_fen(bench_position_t *position, int *ops) {
+  char *fen = board_to_fen(position->board, position->color);
+  unsigned long long hash = 14695981039346656037ULL;
+
+  for (char *c = fen; *c != '\0'; ++c) {
+    hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+  }
+
+  free(fen);
+
+  *ops = 1;
+  return hash;
+}
+
+unsigned long long bench_create_board(bench_position_t *position, int *ops) {
+  (void)position;
+
+  board_t *board = create_board();
+  unsigned long long pieces = board->piece_count;
+  free_board(board);
+
+  *ops = 1;
+  return pieces;
+}
+
+benchmark_t benchmarks[] = {
+    {.name = "square_attacked", .run = bench_square_attacked},
+    {.name = "is_in_check", .run = bench_is_in_check},
+    {.name = "has_legal_move", .run = bench_has_legal_move},
+    {.name = "is_legal_move", .run = bench_is_legal_move},
+    {.name = "move_from_san", .run = bench_move_from_san},
+    {.name = "board_to_fen", .run = bench_board_to_fen},
+    {.name = "create_board/free_board", .run = bench_create_board},
+};
+
+#define BENCHMARK_COUNT (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+double now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+unsigned long long mix_signature(unsigned long long signature,
+                                 unsigned long long value) {
+  return (signature ^ value) * 1099511628211ULL;
+}
+
+// Runs the benchmark over every position `passes` times and returns the
+// elapsed time in nanoseconds.
+double run_passes(benchmark_t *benchmark, long passes) {
+  int ops;
+  volatile unsigned long long sink = 0;
+  double start = now_ns();
+
+  for (long pass = 0; pass < passes; ++pass) {
+    for (int i = 0; i < POSITION_COUNT; ++i) {
+      sink += benchmark->run(&positions[i], &ops);
+    }
+  }
+
+  (void)sink;
+  return now_ns() - start;
+}
+
+// Computes the signature and finds how many passes fill about one sample.
+void calibrate(benchmark_t *benchmark) {
+  benchmark->signature = 14695981039346656037ULL;
+  benchmark->ops_per_pass = 0;
+
+  for (int i = 0; i < POSITION_COUNT; ++i) {
+    int ops;
+    unsigned long long value = benchmark->run(&positions[i], &ops);
+    benchmark->signature = mix_signature(benchmark->signature, value);
+    benchmark->ops_per_pass += ops;
+  }
+
+  long passes = 1;
+
+  while (run_passes(benchmark, passes) < BENCH_SAMPLE_NS / 4) {
+    passes *= 2;
+  }
+
+  benchmark->passes = passes * 4;
+}
+
+int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+double median(double *values, int count) {
+  qsort(values, count, sizeof(double), compare_doubles);
+  return (values[(count - 1) / 2] + values[count / 2]) / 2;
+}
+
+// Summarises the samples by their median and by the median absolute
+// deviation scaled to match a standard deviation, neither of which a few
+// samples slowed by the machine can move far.
+void summarise(benchmark_t *benchmark) {
+  double values[BENCH_SAMPLES];
+
+  memcpy(values, benchmark->samples, sizeof(values));
+  benchmark->median_ns = median(values, BENCH_SAMPLES);
+
+  for (int i = 0; i < BENCH_SAMPLES; ++i) {
+    values[i] = fabs(benchmark->samples[i] - benchmark->median_ns);
+  }
+
+  benchmark->spread_ns = 1.4826 * median(values, BENCH_SAMPLES);
+}
+
+// Takes the samples of all benchmarks in rounds, one sample of each per
+// round, so that a slow spell of the machine lands on every benchmark
+// rather than on whichever was running.
+void measure_all(void) {
+  for (int i = 0; i < BENCHMARK_COUNT; ++i) {
+    calibrate(&benchmarks[i]);
+  }
+
+  for (int round = 0; round < BENCH_SAMPLES; ++round) {
+    for (int i = 0; i < BENCHMARK_COUNT; ++i) {
+      benchmark_t *benchmark = &benchmarks[i];
+      double ops = (double)benchmark->passes * benchmark->ops_per_pass;
+      benchmark->samples[round] =
+          run_passes(benchmark, benchmark->passes) / ops;
+    }
+  }
+
+  for (int i = 0; i < BENCHMARK_COUNT; ++i) {
+    summarise(&benchmarks[i]);
+  }
+}
+
+bool save_baseline(const char *path) {
+  FILE *file = fopen(path, "w");
+
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+
+  for (int i = 0; i < BENCHMARK_COUNT; ++i) {
+    fprintf(file, "%s %.3f %.3f %016llx\n", benchmarks[i].name,
+            benchmarks[i].median_ns, benchmarks[i].spread_ns,
+            benchmarks[i].signature);
+  }
+
+  fclose(file);
+  return true;
+}
+
+// Returns false if any benchmark got slower than the baseline or computed a
+// different signature. Timings are compared by their medians, and a
+// slowdown only counts when it is over tolerance percent and over three
+// times the spread both runs measured.
+bool compare_baseline(const char *path, double tolerance) {
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+
+  bool passed = true;
+  bool seen[BENCHMARK_COUNT] = {false};
+  int entries = 0;
+  char line[256];
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char name[64];
+    double median_ns, spread_ns;
+    unsigned long long signature;
+
+    if (sscanf(line, "%63s %lf %lf %llx", name, &median_ns, &spread_ns,
+               &signature) != 4) {
+      continue;
+    }
+
+    benchmark_t *benchmark = NULL;
+    ++entries;
+
+    for (int i = 0; i < BENCHMARK_COUNT; ++i) {
+      if (strcmp(benchmarks[i].name, name) == 0) {
+        benchmark = &benchmarks[i];
+        seen[i] = true;
+      }
+    }
+
+    if (benchmark == NULL) {
+      continue;
+    }
+
+    double change = (benchmark->median_ns - median_ns) / median_ns * 100;
+    double noise = 3 * sqrt(benchmark->spread_ns * benchmark->spread_ns +
+                            spread_ns * spread_ns);
+
+    if (benchmark->signature != signature) {
+      printf("SIGNATURE MISMATCH %s: %016llx, baseline %016llx\n", name,
+             benchmark->signature, signature);
+      passed = false;
+    } else if (change > tolerance &&
+               benchmark->median_ns - median_ns > noise) {
+      printf("REGRESSION %s: %.1f ns/op, baseline %.1f ns/op (%+.1f%%, "
+             "noise %.1f ns/op)\n",
+             name, benchmark->median_ns, median_ns, change, noise);
+      passed = false;
+    } else {
+      printf("ok %s: %+.1f%%\n", name, change);
+    }
+  }
+
+  fclose(file);
+
+  // A baseline that is empty, truncated or from an older benchmark set
+  // cannot vouch for the benchmarks it does not list.
+  if (entries == 0) {
+    printf("NO BASELINE in %s\n", path);
+    return false;
+  }
+
+  for (int i = 0; i < BENCHMARK_COUNT; ++i) {
+    if (!seen[i]) {
+      printf("MISSING %s: not in baseline\n", benchmarks[i].name);
+      passed = false;
+    }
+  }
+
+  return passed;
+}
+
+// Plays random moves out from the benchmark positions to get count
+// unrelated positions. Every eighth has the wrong side to move, so that some
+// positions are illegal.
+board_t **random_positions(int count) {
+  board_t **boards = calloc(count, sizeof(board_t *));
+  board_t *board = create_board();
+  move_list_t moves;
+  unsigned long long seed = 88172645463325252ULL;
+  undo_t undo;
+
+  for (int i = 0; boards != NULL && board != NULL && i < count; ++i) {
+    if (i % 64 == 0) {
+      copy_board(board, positions[i / 64 % POSITION_COUNT].board);
+    }
+
+    generate_legal_moves(board, board->side_to_move, &moves);
+
+    if (moves.length == 0) {
+      copy_board(board, positions[i % POSITION_COUNT].board);
+      generate_legal_moves(board, board->side_to_move, &moves);
+    }
+
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    make_move(board, moves.moves[seed % moves.length], &undo);
+
+    if ((boards[i] = create_board()) == NULL) {
+      break;
+    }
+
+    copy_board(boards[i], board);
+
+    if (i % 8 == 7) {
+      boards[i]->side_to_move = board->side_to_move == WHITE ? BLACK : WHITE;
+    }
+  }
+
+  if (board != NULL) {
+    free_board(board);
+  }
+
+  return boards;
+}
+
+// The batch answers from is_in_check and square_attacked, one board at a
+// time.
+void board_check_status(board_t **boards, int count, unsigned char *status) {
+  for (int i = 0; i < count; ++i) {
+    piece_color_t mover = boards[i]->side_to_move;
+    piece_color_t other = mover == WHITE ? BLACK : WHITE;
+
+    status[i] = (is_in_check(boards[i], mover) ? POSITION_IN_CHECK : 0) |
+                (is_in_check(boards[i], other) ? POSITION_ILLEGAL : 0);
+  }
+}
+
+void board_attack_maps(board_t **boards, int count, piece_color_t color,
+                       unsigned long long *maps) {
+  for (int i = 0; i < count; ++i) {
+    maps[i] = 0;
+
+    for (int square = 0; square < 64; ++square) {
+      square_t *target = &boards[i]->squares[square / 8][square % 8];
+
+      if (square_attacked(boards[i], target, color)) {
+        maps[i] |= 1ULL << square;
+      }
+    }
+  }
+}
+
+typedef struct BatchBenchmark {
+  board_t **boards;
+  position_batch_t *batch;
+  unsigned char *status;
+  unsigned long long *maps;
+} batch_benchmark_t;
+
+void run_board_status(batch_benchmark_t *bench) {
+  board_check_status(bench->boards, bench->batch->length, bench->status);
+}
+
+void run_board_maps(batch_benchmark_t *bench) {
+  board_attack_maps(bench->boards, bench->batch->length, WHITE, bench->maps);
+}
+
+void run_scalar_status(batch_benchmark_t *bench) {
+  batch_check_status_scalar(bench->batch, bench->status);
+}
+
+void run_scalar_maps(batch_benchmark_t *bench) {
+  batch_attack_maps_scalar(bench->batch, WHITE, bench->maps);
+}
+
+void run_batch_status(batch_benchmark_t *bench) {
+  batch_check_status(bench->batch, bench->status);
+}
+
+void run_batch_maps(batch_benchmark_t *bench) {
+  batch_attack_maps(bench->batch, WHITE, bench->maps);
+}
+
+// Returns the positions per second run manages over the whole batch.
+double positions_per_second(batch_benchmark_t *bench,
+                            void (*run)(batch_benchmark_t *bench)) {
+  long passes = 0;
+  double start = now_ns(), elapsed;
+
+  do {
+    run(bench);
+    passes++;
+  } while ((elapsed = now_ns() - start) < BENCH_BATCH_NS);
+
+  return passes * bench->batch->length / (elapsed / 1e9);
+}
+
+// Checks the batch kernels against is_in_check and square_attacked on
+// random positions, then compares their speed.
+bool bench_position_batch(void) {
+  int count = BENCH_BATCH_POSITIONS;
+  batch_benchmark_t bench = {.boards = random_positions(count),
+                             .batch = create_position_batch(count),
+                             .status = malloc(3 * count),
+                             .maps = malloc(3 * count * sizeof(long long))};
+
+  if (bench.boards == NULL || bench.boards[count - 1] == NULL ||
+      bench.batch == NULL || bench.status == NULL || bench.maps == NULL) {
+    fprintf(stderr, "bench: out of memory\n");
+    return false;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    add_batch_position(bench.batch, bench.boards[i]);
+  }
+
+  unsigned char *status = bench.status;
+  unsigned long long *maps = bench.maps;
+  long mismatches = 0, checks = 0, illegal = 0;
+
+  board_check_status(bench.boards, count, status);
+  batch_check_status_scalar(bench.batch, status + count);
+  batch_check_status(bench.batch, status + 2 * count);
+
+  for (int i = 0; i < count; ++i) {
+    mismatches += status[i] != status[count + i] ||
+                  status[i] != status[2 * count + i];
+    checks += (status[i] & POSITION_IN_CHECK) != 0;
+    illegal += (status[i] & POSITION_ILLEGAL) != 0;
+  }
+
+  for (int color = WHITE; color <= BLACK; ++color) {
+    board_attack_maps(bench.boards, count, color, maps);
+    batch_attack_maps_scalar(bench.batch, color, maps + count);
+    batch_attack_maps(bench.batch, color, maps + 2 * count);
+
+    for (int i = 0; i < count; ++i) {
+      mismatches +=
+          maps[i] != maps[count + i] || maps[i] != maps[2 * count + i];
+    }
+  }
+
+  printf("%d positions (%ld in check, %ld illegal), %ld mismatches\n", count,
+         checks, illegal, mismatches);
+
+  if (mismatches == 0) {
+    const char *kernel = batch_simd_enabled() ? "avx2" : "scalar";
+
+    printf("%-24s %14s %14s\n", "positions/s", "check status",
+           "attack maps");
+    printf("%-24s %14.0f %14.0f\n", "board_t",
+           positions_per_second(&bench, run_board_status),
+           positions_per_second(&bench, run_board_maps));
+    printf("%-24s %14.0f %14.0f\n", "batch (scalar)",
+           positions_per_second(&bench, run_scalar_status),
+           positions_per_second(&bench, run_scalar_maps));
+    printf("batch (%s)%*s %14.0f %14.0f\n", kernel,
+           (int)(16 - strlen(kernel)), "",
+           positions_per_second(&bench, run_batch_status),
+           positions_per_second(&bench, run_batch_maps));
+  }
+
+  for (int i = 0; i < count; ++i) {
+    free_board(bench.boards[i]);
+  }
+
+  free(bench.boards);
+  free_position_batch(bench.batch);
+  free(bench.status);
+  free(bench.maps);
+  return mismatches == 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--save FILE] [--compare FILE] [--tolerance PERCENT]\n"
+          "          [--stats]\n"
+          "       %s --position-batch [--stats]\n",
+          program, program);
+}
+
+int main(int argc, char **argv) {
+  const char *save_path = NULL;
+  const char *compare_path = NULL;
+  double tolerance = 10;
+  bool position_batch = false;
+  bool show_stats = false;
+  stats_t stats = {0};
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+      save_path = argv[++i];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      compare_path = argv[++i];
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--position-batch") == 0) {
+      position_batch = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < POSITION_COUNT; ++i) {
+    positions[i].board = create_board();
+    positions[i].scratch = create_board();
+
+    if (positions[i].board == NULL || positions[i].scratch == NULL ||
+        load_fen(positions[i].board, positions[i].fen, &positions[i].color) ==
+            NULL) {
+      fprintf(stderr, "bench: could not load %s\n", positions[i].fen);
+      return 1;
+    }
+
+    // The counters slow the benchmarks down, so only --stats attaches them.
+    positions[i].board->stats = show_stats ? &stats : NULL;
+  }
+
+  if (position_batch) {
+    bool passed = bench_position_batch();
+
+    if (show_stats) {
+      stats_print(stdout, &stats);
+    }
+
+    return passed ? 0 : 1;
+  }
+
+  unsigned long long total_signature = 14695981039346656037ULL;
+  long long total_ops = 0;
+
+  printf("%-24s %12s %9s %10s %16s\n", "benchmark", "ns/op", "spread",
+         "ops/pass", "signature");
+
+  measure_all();
+
+  for (int i = 0; i < BENCHMARK_COUNT; ++i) {
+    benchmark_t *benchmark = &benchmarks[i];
+
+    printf("%-24s %12.1f %8.1f%% %10d %016llx\n", benchmark->name,
+           benchmark->median_ns,
+           benchmark->spread_ns / benchmark->median_ns * 100,
+           benchmark->ops_per_pass, benchmark->signature);
+
+    total_signature = mix_signature(total_signature, benchmark->signature);
+    total_ops += benchmark->ops_per_pass;
+  }
+
+  printf("total: %lld ops/pass, signature %016llx\n", total_ops,
+         total_signature);
+
+  if (show_stats) {
+    stats_print(stdout, &stats);
+  }
+
+  for (int i = 0; i < POSITION_COUNT; ++i) {
+    free_board(positions[i].board);
+    free_board(positions[i].scratch);
+  }
+
+  if (save_path != NULL && !save_baseline(save_path)) {
+    return 1;
+  }
+
+  if (compare_path != NULL && !compare_baseline(compare_path, tolerance)) {
+    return 1;
+  }
+
+  return 0;
+}
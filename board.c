@@ -1,22 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
 #include "legal_moves.h"
+#include "nnue.h"
 #include "types.h"
+#include "zobrist.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+void free_board(board_t *board) { free(board); }
+
+void add_material(board_t *board, piece_type_t type, piece_color_t color) {
+  int *count = &board->piece_counts[color][type];
+  board->material_key ^= material_count_key(type, color, *count);
+  (*count)++;
+}
+
+void remove_material(board_t *board, piece_type_t type, piece_color_t color) {
+  int *count = &board->piece_counts[color][type];
+  (*count)--;
+  board->material_key ^= material_count_key(type, color, *count);
+}
 
-void free_board(board_t *board) {
+piece_t *place_piece(board_t *board, piece_type_t type, piece_color_t color,
+                     int rank, int file) {
+  if (board->piece_count == 32) {
+    return NULL;
+  }
+
+  piece_t *piece = &board->pieces[board->piece_count++];
+
+  piece->type = type;
+  piece->color = color;
+  piece->has_moved = false;
+  piece->square = &board->squares[rank][file];
+  board->squares[rank][file].piece = piece;
+  add_material(board, type, color);
+
+  if (type == PAWN) {
+    board->pawn_key ^= piece_key(PAWN, color, rank, file);
+  }
+
+  if (type == KING) {
+    if (color == WHITE) {
+      board->white_king = piece;
+    } else {
+      board->black_king = piece;
+    }
+  }
+
+  return piece;
+}
+
+void clear_board(board_t *board) {
   for (int i = 0; i < 8; ++i) {
     for (int j = 0; j < 8; ++j) {
-      piece_t *piece = board->squares[i][j].piece;
-      if (piece != NULL) {
-        free(piece);
-      }
+      board->squares[i][j].rank = i;
+      board->squares[i][j].file = j;
+      board->squares[i][j].piece = NULL;
     }
   }
 
-  free(board);
+  board->piece_count = 0;
+  board->white_king = NULL;
+  board->black_king = NULL;
+  board->enpassantable_pawn = NULL;
+  board->fifty_move_rule_counter = 0;
+  board->side_to_move = WHITE;
+  memset(board->piece_counts, 0, sizeof(board->piece_counts));
+  board->material_key = 0;
+  board->pawn_key = 0;
+  board->checkers = 0;
 }
 
 board_t *create_board() {
@@ -26,122 +85,420 @@ board_t *create_board() {
     return NULL;
   }
 
-  board->fifty_move_rule_counter = 0;
+  clear_board(board);
+
+  const piece_type_t back_rank[8] = {ROOK,  KNIGHT, BISHOP, QUEEN,
+                                     KING,  BISHOP, KNIGHT, ROOK};
+
+  for (int j = 0; j < 8; ++j) {
+    place_piece(board, back_rank[j], WHITE, 0, j);
+    place_piece(board, PAWN, WHITE, 1, j);
+    place_piece(board, PAWN, BLACK, 6, j);
+    place_piece(board, back_rank[j], BLACK, 7, j);
+  }
+
+  board->hash = compute_hash(board, WHITE);
+
+  return board;
+}
+
+// Copies src into dst, re-pointing every piece/square link at dst's own
+// storage.
+void copy_board(board_t *dst, board_t *src) {
+  memcpy(dst, src, sizeof(board_t));
 
   for (int i = 0; i < 8; ++i) {
     for (int j = 0; j < 8; ++j) {
-      board->squares[i][j].rank = i;
-      board->squares[i][j].file = j;
-      board->squares[i][j].piece = NULL;
+      piece_t *piece = src->squares[i][j].piece;
+      dst->squares[i][j].piece =
+          piece == NULL ? NULL : &dst->pieces[piece - src->pieces];
+    }
+  }
 
-      if (i > 1 && i < 6) {
-        continue;
-      }
+  for (int i = 0; i < src->piece_count; ++i) {
+    square_t *square = src->pieces[i].square;
 
-      board->squares[i][j].piece = malloc(sizeof(piece_t));
+    if (square != NULL) {
+      dst->pieces[i].square = &dst->squares[square->rank][square->file];
+    }
+  }
 
-      piece_t *piece = board->squares[i][j].piece;
+  dst->white_king = &dst->pieces[src->white_king - src->pieces];
+  dst->black_king = &dst->pieces[src->black_king - src->pieces];
+
+  if (src->enpassantable_pawn != NULL) {
+    dst->enpassantable_pawn =
+        &dst->pieces[src->enpassantable_pawn - src->pieces];
+  }
+}
 
-      if (!piece) {
-        free_board(board);
+bool fen_castling_consistent(board_t *board, int rank, int rook_file) {
+  piece_t *king = board->squares[rank][4].piece;
+  piece_t *rook = board->squares[rank][rook_file].piece;
+  piece_color_t color = rank == 0 ? WHITE : BLACK;
+
+  return king != NULL && king->type == KING && king->color == color &&
+         rook != NULL && rook->type == ROOK && rook->color == color;
+}
+
+const char *load_fen(board_t *board, const char *fen,
+                     piece_color_t *color_to_move) {
+  clear_board(board);
+
+  const char *c = fen;
+
+  while (*c == ' ') {
+    c++;
+  }
+
+  int rank = 7, file = 0;
+
+  for (; *c != ' '; ++c) {
+    if (*c == '/') {
+      if (file != 8 || rank == 0) {
         return NULL;
       }
+      rank--;
+      file = 0;
+      continue;
+    }
 
-      piece->has_moved = false;
-      piece->square = &board->squares[i][j];
+    if (*c >= '1' && *c <= '8') {
+      file += *c - '0';
+      if (file > 8) {
+        return NULL;
+      }
+      continue;
+    }
 
-      if (i == 0 || i == 1) {
-        piece->color = WHITE;
+    if (file > 7) {
+      return NULL;
+    }
+
+    piece_type_t type;
+
+    switch (tolower((unsigned char)*c)) {
+    case 'p':
+      type = PAWN;
+      break;
+    case 'n':
+      type = KNIGHT;
+      break;
+    case 'b':
+      type = BISHOP;
+      break;
+    case 'r':
+      type = ROOK;
+      break;
+    case 'q':
+      type = QUEEN;
+      break;
+    case 'k':
+      type = KING;
+      break;
+    default:
+      return NULL;
+    }
+
+    piece_color_t color = isupper((unsigned char)*c) ? WHITE : BLACK;
+    piece_t *king = color == WHITE ? board->white_king : board->black_king;
+
+    if ((type == PAWN && (rank == 0 || rank == 7)) ||
+        (type == KING && king != NULL)) {
+      return NULL;
+    }
+
+    piece_t *piece = place_piece(board, type, color, rank, file);
+
+    if (piece == NULL) {
+      return NULL;
+    }
+
+    piece->has_moved = type != PAWN || rank != (color == WHITE ? 1 : 6);
+    file++;
+  }
+
+  if (rank != 0 || file != 8 || board->white_king == NULL ||
+      board->black_king == NULL) {
+    return NULL;
+  }
+
+  c++;
+
+  if (*c == 'w') {
+    *color_to_move = WHITE;
+  } else if (*c == 'b') {
+    *color_to_move = BLACK;
+  } else {
+    return NULL;
+  }
+
+  c++;
+
+  if (*c != ' ') {
+    return NULL;
+  }
+
+  c++;
+
+  if (*c == '-') {
+    c++;
+  } else {
+    for (; *c != ' ' && *c != '\0'; ++c) {
+      int castle_rank = isupper((unsigned char)*c) ? 0 : 7;
+      int rook_file;
+
+      if (*c == 'K' || *c == 'k') {
+        rook_file = 7;
+      } else if (*c == 'Q' || *c == 'q') {
+        rook_file = 0;
       } else {
-        piece->color = BLACK;
+        return NULL;
       }
 
-      if (i == 0 || i == 7) {
-        switch (j) {
-        case 0:
-        case 7:
-          piece->type = ROOK;
-          break;
-        case 1:
-        case 6:
-          piece->type = KNIGHT;
-          break;
-        case 2:
-        case 5:
-          piece->type = BISHOP;
-          break;
-        case 3:
-          piece->type = QUEEN;
-          break;
-        case 4:
-          piece->type = KING;
-          if (piece->color == WHITE) {
-            board->white_king = piece;
-          } else {
-            board->black_king = piece;
-          }
-          break;
-        }
-      } else {
-        piece->type = PAWN;
+      if (!fen_castling_consistent(board, castle_rank, rook_file)) {
+        return NULL;
       }
+
+      board->squares[castle_rank][4].piece->has_moved = false;
+      board->squares[castle_rank][rook_file].piece->has_moved = false;
     }
   }
 
-  return board;
-}
+  if (*c != ' ') {
+    return NULL;
+  }
 
-void print_board(board_t *board) {
-  printf("\033[2J\033[H");
+  c++;
 
-  for (int i = 7; i >= 0; --i) {
-    printf("\033[90m%d\033[0m", i + 1);
+  if (*c == '-') {
+    c++;
+  } else {
+    char ep_rank = *color_to_move == WHITE ? '6' : '3';
 
-    for (int j = 0; j < 8; ++j) {
-      piece_t *piece = board->squares[i][j].piece;
+    if (c[0] < 'a' || c[0] > 'h' || c[1] != ep_rank) {
+      return NULL;
+    }
 
-      printf(" ");
+    int ep_file = c[0] - 'a';
+    int pawn_rank = *color_to_move == WHITE ? 4 : 3;
+    piece_t *pawn = board->squares[pawn_rank][ep_file].piece;
 
-      if (piece == NULL) {
-        printf("-");
+    if (pawn == NULL || pawn->type != PAWN || pawn->color == *color_to_move) {
+      return NULL;
+    }
+
+    // Like move_piece, only remember the pawn when it can actually be taken
+    // so that FENs (and therefore repetitions) compare equal.
+    for (int df = -1; df <= 1; df += 2) {
+      if (ep_file + df < 0 || ep_file + df > 7) {
         continue;
       }
 
-      if (piece->color == BLACK) {
-        printf("\033[0;32m");
+      piece_t *neighbour = board->squares[pawn_rank][ep_file + df].piece;
+
+      if (neighbour != NULL && neighbour->type == PAWN &&
+          neighbour->color == *color_to_move) {
+        board->enpassantable_pawn = pawn;
       }
+    }
 
-      switch (piece->type) {
-      case PAWN:
-        printf("p");
-        break;
-      case KNIGHT:
-        printf("N");
-        break;
-      case BISHOP:
-        printf("B");
-        break;
-      case ROOK:
-        printf("R");
-        break;
-      case QUEEN:
-        printf("Q");
-        break;
-      case KING:
-        if (is_in_check(board, piece->color)) {
-          printf("\033[0;31m");
-        }
-        printf("K");
-        break;
+    c += 2;
+  }
+
+  const char *end = c;
+
+  if (*c == ' ' && isdigit((unsigned char)c[1])) {
+    board->fifty_move_rule_counter = (int)strtol(c + 1, (char **)&c, 10);
+    end = c;
+
+    if (*c == ' ' && isdigit((unsigned char)c[1])) {
+      strtol(c + 1, (char **)&c, 10);
+      end = c;
+    }
+  }
+
+  if (*end != '\0' && *end != ' ' && *end != '\n') {
+    return NULL;
+  }
+
+  if (is_in_check(board, *color_to_move == WHITE ? BLACK : WHITE)) {
+    return NULL;
+  }
+
+  board->hash = compute_hash(board, *color_to_move);
+  board->side_to_move = *color_to_move;
+  board->checkers = compute_checkers(board);
+
+  if (board->network != NULL) {
+    nnue_refresh(board);
+  }
+
+  return end;
+}
+
+typedef struct FrameBuffer {
+  char data[4096];
+  size_t length;
+} frame_buffer_t;
+
+// Writes out and empties the buffer.
+void frame_flush(frame_buffer_t *frame) {
+  fflush(stdout);
+
+  size_t written = 0;
+
+  while (written < frame->length) {
+    ssize_t res =
+        write(STDOUT_FILENO, frame->data + written, frame->length - written);
+
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      break;
+    }
 
-      printf("\033[0m");
+    written += res;
+  }
+
+  // What could not be written is dropped, so that appending can go on.
+  frame->length = 0;
+}
+
+// Output that does not fit is written out as the buffer fills, so a frame
+// larger than the buffer reaches the terminal in several writes instead of
+// being cut short.
+void frame_append(frame_buffer_t *frame, const char *str) {
+  size_t length = strlen(str);
+
+  while (frame->length + length > sizeof(frame->data)) {
+    size_t room = sizeof(frame->data) - frame->length;
+    memcpy(frame->data + frame->length, str, room);
+    frame->length += room;
+    str += room;
+    length -= room;
+    frame_flush(frame);
+  }
+
+  memcpy(frame->data + frame->length, str, length);
+  frame->length += length;
+}
+
+char piece_glyph(piece_t *piece) {
+  if (piece == NULL) {
+    return '-';
+  }
+
+  switch (piece->type) {
+  case PAWN:
+    return 'p';
+  case KNIGHT:
+    return 'N';
+  case BISHOP:
+    return 'B';
+  case ROOK:
+    return 'R';
+  case QUEEN:
+    return 'Q';
+  case KING:
+    return 'K';
+  }
+
+  return '?';
+}
+
+cell_style_t piece_style(piece_t *piece, piece_t *checked_king) {
+  if (piece == NULL) {
+    return STYLE_PLAIN;
+  }
+
+  if (piece == checked_king) {
+    return STYLE_CHECK;
+  }
+
+  return piece->color == BLACK ? STYLE_BLACK : STYLE_PLAIN;
+}
+
+void frame_append_cell(frame_buffer_t *frame, char glyph, cell_style_t style) {
+  switch (style) {
+  case STYLE_PLAIN:
+    break;
+  case STYLE_BLACK:
+    frame_append(frame, "\033[0;32m");
+    break;
+  case STYLE_CHECK:
+    frame_append(frame, "\033[0;31m");
+    break;
+  }
+
+  char glyph_str[2] = {glyph, '\0'};
+  frame_append(frame, glyph_str);
+
+  if (style != STYLE_PLAIN) {
+    frame_append(frame, "\033[0m");
+  }
+}
+
+void reset_renderer(renderer_t *renderer) { renderer->drawn = false; }
+
+void print_board(renderer_t *renderer, board_t *board, piece_t *checked_king) {
+  frame_buffer_t frame;
+  frame.length = 0;
+
+  if (!renderer->drawn) {
+    frame_append(&frame, "\033[2J\033[H");
+
+    for (int i = 7; i >= 0; --i) {
+      char label[16];
+      snprintf(label, sizeof(label), "\033[90m%d\033[0m", i + 1);
+      frame_append(&frame, label);
+
+      for (int j = 0; j < 8; ++j) {
+        piece_t *piece = board->squares[i][j].piece;
+        char glyph = piece_glyph(piece);
+        cell_style_t style = piece_style(piece, checked_king);
+
+        frame_append(&frame, " ");
+        frame_append_cell(&frame, glyph, style);
+
+        renderer->glyphs[i][j] = glyph;
+        renderer->styles[i][j] = style;
+      }
+
+      frame_append(&frame, "\n");
     }
 
-    printf("\n");
+    frame_append(&frame, "\033[90m  a b c d e f g h\033[0m\n");
+    renderer->drawn = true;
+    frame_flush(&frame);
+    return;
+  }
+
+  for (int i = 7; i >= 0; --i) {
+    for (int j = 0; j < 8; ++j) {
+      piece_t *piece = board->squares[i][j].piece;
+      char glyph = piece_glyph(piece);
+      cell_style_t style = piece_style(piece, checked_king);
+
+      if (renderer->glyphs[i][j] == glyph && renderer->styles[i][j] == style) {
+        continue;
+      }
+
+      char position[16];
+      snprintf(position, sizeof(position), "\033[%d;%dH", 8 - i, 3 + 2 * j);
+      frame_append(&frame, position);
+      frame_append_cell(&frame, glyph, style);
+
+      renderer->glyphs[i][j] = glyph;
+      renderer->styles[i][j] = style;
+    }
   }
 
-  printf("\033[90m  a b c d e f g h\033[0m\n");
+  // Everything below the board (prompts, echoed input) is redrawn by the
+  // caller, so clear it rather than diffing it.
+  frame_append(&frame, "\033[10;1H\033[J");
+  frame_flush(&frame);
 }
 
 char *board_to_fen(board_t *board, piece_color_t color_to_move) {
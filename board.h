@@ -1,8 +1,20 @@
 #include "types.h"
 
 #pragma once
+#pragma GCC visibility push(default)
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
 
 board_t *create_board();
 void free_board(board_t *board);
-void print_board(board_t *board);
+void copy_board(board_t *dst, board_t *src);
+void add_material(board_t *board, piece_type_t type, piece_color_t color);
+void remove_material(board_t *board, piece_type_t type, piece_color_t color);
+const char *load_fen(board_t *board, const char *fen,
+                     piece_color_t *color_to_move);
+void reset_renderer(renderer_t *renderer);
+void print_board(renderer_t *renderer, board_t *board,
+                 piece_t *checked_king);
 char *board_to_fen(board_t *board, piece_color_t color_to_move);
+
+#pragma GCC visibility pop
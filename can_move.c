@@ -1,9 +1,9 @@
+#include "stats.h"
+#include "tables.h"
 #include "types.h"
 #include <stdbool.h>
 #include <stdlib.h>
 
-#define sign(x) ((x >= 0) ? 1 : -1)
-
 bool pawn_can_move(board_t *board, square_t *start, square_t *end,
                    int direction, bool has_moved) {
   int diff = end->rank - start->rank;
@@ -32,105 +32,72 @@ bool pawn_can_move(board_t *board, square_t *start, square_t *end,
   return diff == direction;
 }
 
-bool knight_can_move(square_t *start, square_t *end) {
-  return (abs(end->rank - start->rank) == 1 &&
-          abs(end->file - start->file) == 2) ||
-         (abs(end->rank - start->rank) == 2 &&
-          abs(end->file - start->file) == 1);
+bool knight_can_move(int from, int to) {
+  return knight_attacks[from] >> to & 1;
 }
 
-bool bishop_can_move(board_t *board, square_t *start, square_t *end) {
-  int rank_diff = end->rank - start->rank;
-  int file_diff = end->file - start->file;
-
-  if (abs(rank_diff) == abs(file_diff)) {
-    for (int i = 1; i < abs(rank_diff); ++i) {
-      if (board
-              ->squares[start->rank + i * sign(rank_diff)]
-                       [start->file + i * sign(file_diff)]
-              .piece != NULL) {
-        return false;
-      }
-    }
+// Whether to lies in one of directions first to last - 1 from from (the
+// diagonals are 0-3, the ranks and files 4-7) with nothing in between.
+bool slider_can_move(board_t *board, int from, int to, int first, int last) {
+  int direction = square_directions[from][to];
 
-    return true;
+  if (direction < first || direction >= last) {
+    return false;
   }
 
-  return false;
-}
-
-bool rook_can_move(board_t *board, square_t *start, square_t *end) {
-  if (start->rank == end->rank) {
-    int file_diff = end->file - start->file;
+  const unsigned char *ray = ray_squares[from][direction];
 
-    for (int i = 1; i < abs(file_diff); ++i) {
-      if (board->squares[start->rank][start->file + i * sign(file_diff)]
-              .piece != NULL) {
-        return false;
-      }
+  for (int i = 0; i < square_distances[from][to] - 1; ++i) {
+    if (board->squares[ray[i] / 8][ray[i] % 8].piece != NULL) {
+      return false;
     }
-
-    return true;
   }
 
-  if (start->file == end->file) {
-    int rank_diff = end->rank - start->rank;
-
-    for (int i = 1; i < abs(rank_diff); ++i) {
-      if (board->squares[start->rank + i * sign(rank_diff)][start->file]
-              .piece != NULL) {
-        return false;
-      }
-    }
-
-    return true;
-  }
-
-  return false;
+  return true;
 }
 
-bool queen_can_move(board_t *board, square_t *start, square_t *end) {
-  return rook_can_move(board, start, end) || bishop_can_move(board, start, end);
-}
-
-bool king_can_move(square_t *start, square_t *end) {
-  return abs(end->rank - start->rank) <= 1 && abs(end->file - start->file) <= 1;
-}
+bool king_can_move(int from, int to) { return king_attacks[from] >> to & 1; }
 
 bool can_move(board_t *board, piece_t *piece, square_t *square) {
+  STATS_ENTER();
+
   if (piece == NULL || square == NULL) {
-    return false;
+    return STATS_RETURN(STAT_CAN_MOVE, false);
   }
 
   if (square == piece->square) {
-    return false;
+    return STATS_RETURN(STAT_CAN_MOVE, false);
   }
 
   if (square->piece != NULL && piece->color == square->piece->color) {
-    return false;
+    return STATS_RETURN(STAT_CAN_MOVE, false);
   }
 
+  int from = piece->square->rank * 8 + piece->square->file;
+  int to = square->rank * 8 + square->file;
+  bool res = false;
+
   switch (piece->type) {
   case PAWN:
-    return pawn_can_move(board, piece->square, square,
-                         piece->color == WHITE ? 1 : -1, piece->has_moved);
+    res = pawn_can_move(board, piece->square, square,
+                        piece->color == WHITE ? 1 : -1, piece->has_moved);
     break;
   case KNIGHT:
-    return knight_can_move(piece->square, square);
+    res = knight_can_move(from, to);
     break;
   case BISHOP:
-    return bishop_can_move(board, piece->square, square);
+    res = slider_can_move(board, from, to, 0, 4);
     break;
   case ROOK:
-    return rook_can_move(board, piece->square, square);
+    res = slider_can_move(board, from, to, 4, 8);
     break;
   case QUEEN:
-    return queen_can_move(board, piece->square, square);
+    res = slider_can_move(board, from, to, 0, 8);
     break;
   case KING:
-    return king_can_move(piece->square, square);
+    res = king_can_move(from, to);
     break;
   }
 
-  return false;
+  return STATS_RETURN(STAT_CAN_MOVE, res);
 }
@@ -2,4 +2,5 @@
 
 #pragma once
 
+bool slider_can_move(board_t *board, int from, int to, int first, int last);
 bool can_move(board_t *board, piece_t *piece, square_t *square);
@@ -0,0 +1,103 @@
+#include "datagen.h"
+#include "types.h"
+#include "zobrist.h"
+#include <stdio.h>
+#include <string.h>
+
+void pack_position(board_t *board, int score, int fullmove,
+                   packed_position_t *packed) {
+  memset(packed, 0, sizeof(packed_position_t));
+  int count = 0;
+
+  for (int index = 0; index < 64; ++index) {
+    piece_t *piece = board->squares[index / 8][index % 8].piece;
+
+    if (piece == NULL) {
+      continue;
+    }
+
+    packed->occupancy |= 1ULL << index;
+    packed->pieces[count / 2] |= (piece->color << 3 | piece->type)
+                                 << (count % 2 * 4);
+    count++;
+  }
+
+  packed->score = score > 32767 ? 32767 : score < -32767 ? -32767 : score;
+  packed->flags = board->side_to_move | castling_rights(board) << 1;
+  packed->enpassant_file = board->enpassantable_pawn != NULL
+                               ? board->enpassantable_pawn->square->file
+                               : 0xff;
+  packed->halfmove_clock = board->fifty_move_rule_counter > 255
+                               ? 255
+                               : board->fifty_move_rule_counter;
+  packed->fullmove = fullmove;
+}
+
+// Writes the position as FEN; fen needs room for 100 characters.
+void packed_to_fen(const packed_position_t *packed, char *fen) {
+  static const char glyphs[] = "PNBRQK..pnbrqk..";
+  char squares[64] = {0};
+  int count = 0;
+
+  for (int index = 0; index < 64; ++index) {
+    if (packed->occupancy >> index & 1) {
+      squares[index] =
+          glyphs[packed->pieces[count / 2] >> (count % 2 * 4) & 0xf];
+      count++;
+    }
+  }
+
+  for (int rank = 7; rank >= 0; --rank) {
+    int empty = 0;
+
+    for (int file = 0; file < 8; ++file) {
+      char glyph = squares[rank * 8 + file];
+
+      if (glyph == 0) {
+        empty++;
+        continue;
+      }
+
+      if (empty > 0) {
+        *fen++ = '0' + empty;
+        empty = 0;
+      }
+
+      *fen++ = glyph;
+    }
+
+    if (empty > 0) {
+      *fen++ = '0' + empty;
+    }
+
+    if (rank > 0) {
+      *fen++ = '/';
+    }
+  }
+
+  int color = packed->flags & 1;
+  *fen++ = ' ';
+  *fen++ = color == WHITE ? 'w' : 'b';
+  *fen++ = ' ';
+
+  if ((packed->flags >> 1) == 0) {
+    *fen++ = '-';
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    if (packed->flags >> (i + 1) & 1) {
+      *fen++ = "KQkq"[i];
+    }
+  }
+
+  *fen++ = ' ';
+
+  if (packed->enpassant_file == 0xff) {
+    *fen++ = '-';
+  } else {
+    *fen++ = 'a' + packed->enpassant_file;
+    *fen++ = color == WHITE ? '6' : '3';
+  }
+
+  sprintf(fen, " %d %d", packed->halfmove_clock, packed->fullmove);
+}
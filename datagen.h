@@ -0,0 +1,30 @@
+#include "types.h"
+
+#pragma once
+
+// One training position in 32 bytes. occupancy has bit rank * 8 + file set
+// for every occupied square, and pieces holds a 4-bit code (color << 3 |
+// type) for each of those squares in ascending order, two to a byte, low
+// nibble first. score is the search score in centipawns for the side to
+// move and result the game's outcome from white's side: 0 loss, 1 draw,
+// 2 win. flags has the side to move in bit 0 and the castling_rights bits
+// above it; enpassant_file is 0xff when there is no en passant capture.
+// Records are written with fwrite, so multi-byte fields are in the host's
+// byte order.
+typedef struct PackedPosition {
+  unsigned long long occupancy;
+  unsigned char pieces[16];
+  short score;
+  unsigned char result;
+  unsigned char flags;
+  unsigned char enpassant_file;
+  unsigned char halfmove_clock;
+  unsigned short fullmove;
+} packed_position_t;
+
+_Static_assert(sizeof(packed_position_t) == 32,
+               "packed_position_t must be 32 bytes");
+
+void pack_position(board_t *board, int score, int fullmove,
+                   packed_position_t *packed);
+void packed_to_fen(const packed_position_t *packed, char *fen);
@@ -0,0 +1,407 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "datagen.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "nnue.h"
+#include "search.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_GAME_PLIES 400
+#define MAX_OPENING_SCORE 400
+#define ADJUDICATE_SCORE 1000
+#define ADJUDICATE_PLIES 8
+
+typedef struct DatagenOptions {
+  int threads;
+  long games;
+  int depth;
+  unsigned long long nodes;
+  int random_plies;
+  size_t hash_megabytes;
+  unsigned long long seed;
+  const char *network_path;
+  bool stats;
+} datagen_options_t;
+
+// Each worker keeps its own board, search table and record buffer for the
+// game it is playing; only the output file is shared.
+typedef struct DatagenWorker {
+  board_t *board;
+  search_table_t *table;
+  packed_position_t records[MAX_GAME_PLIES];
+  unsigned long long hashes[MAX_GAME_PLIES + 1];
+} datagen_worker_t;
+
+typedef struct Datagen {
+  const datagen_options_t *options;
+  const nnue_network_t *network;
+  datagen_worker_t *workers;
+  FILE *out;
+  pthread_mutex_t lock;
+  atomic_long next_game;
+  atomic_long positions;
+  atomic_long results[4];
+  stats_t stats;
+} datagen_t;
+
+double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+unsigned long long next_random(unsigned long long *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
+
+// Plays the random opening moves. Returns false if the game ended during
+// them.
+bool play_opening(datagen_worker_t *worker, int plies,
+                  unsigned long long *rng, int *hash_count) {
+  board_t *board = worker->board;
+
+  for (int ply = 0; ply < plies; ++ply) {
+    move_list_t moves;
+    generate_legal_moves(board, board->side_to_move, &moves);
+
+    if (moves.length == 0) {
+      return false;
+    }
+
+    undo_t undo;
+    worker->hashes[(*hash_count)++] = board->hash;
+    make_move(board, moves.moves[next_random(rng) % moves.length], &undo);
+  }
+
+  return true;
+}
+
+bool is_repeated(datagen_worker_t *worker, int hash_count) {
+  board_t *board = worker->board;
+
+  for (int i = hash_count - 2;
+       i >= 0 && i >= hash_count - board->fifty_move_rule_counter; i -= 2) {
+    if (worker->hashes[i] == board->hash) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Plays one self-play game and returns the number of positions recorded in
+// worker->records, or -1 if the opening was discarded.
+int play_game(datagen_t *datagen, datagen_worker_t *worker, long game) {
+  const datagen_options_t *options = datagen->options;
+  board_t *board = worker->board;
+  unsigned long long rng =
+      (options->seed + game + 1) * 0x9e3779b97f4a7c15ULL | 1;
+  piece_color_t color;
+
+  nnue_attach(board, datagen->network);
+  load_fen(board, START_FEN, &color);
+  clear_search_table(worker->table);
+
+  // An odd number of extra plies now and then gives black openings too.
+  int hash_count = 0;
+  int opening = options->random_plies + (int)(next_random(&rng) % 2);
+
+  if (!play_opening(worker, opening, &rng, &hash_count)) {
+    return -1;
+  }
+
+  search_limits_t limits = {.depth = options->depth,
+                            .nodes = options->nodes,
+                            .history = worker->hashes};
+  game_result_t result = DRAWN;
+  int record_count = 0;
+  int winning_plies = 0;
+
+  for (int ply = opening; ply < MAX_GAME_PLIES; ++ply) {
+    if (board->fifty_move_rule_counter >= 100 ||
+        insufficient_material(board) || is_repeated(worker, hash_count)) {
+      break;
+    }
+
+    search_result_t found;
+    limits.history_length = hash_count;
+
+    if (!search(board, &limits, worker->table, &found)) {
+      if (board->checkers != 0) {
+        result = board->side_to_move == WHITE ? BLACK_WINS : WHITE_WINS;
+      }
+
+      break;
+    }
+
+    if (ply == opening && abs(found.score) > MAX_OPENING_SCORE) {
+      return -1;
+    }
+
+    int white_score =
+        board->side_to_move == WHITE ? found.score : -found.score;
+
+    if (abs(found.score) < MATE_BOUND && board->checkers == 0 &&
+        !is_capture(board, found.best_move) &&
+        found.best_move.promotion == PAWN) {
+      pack_position(board, found.score, ply / 2 + 1,
+                    &worker->records[record_count++]);
+    }
+
+    // Adjudicate once one side has been clearly winning for a while.
+    if (abs(white_score) >= ADJUDICATE_SCORE) {
+      winning_plies = winning_plies * white_score > 0
+                          ? winning_plies + (white_score > 0 ? 1 : -1)
+                          : (white_score > 0 ? 1 : -1);
+    } else {
+      winning_plies = 0;
+    }
+
+    if (abs(winning_plies) >= ADJUDICATE_PLIES) {
+      result = winning_plies > 0 ? WHITE_WINS : BLACK_WINS;
+      break;
+    }
+
+    undo_t undo;
+    worker->hashes[hash_count++] = board->hash;
+    make_move(board, found.best_move, &undo);
+  }
+
+  unsigned char packed_result =
+      result == WHITE_WINS ? 2 : result == BLACK_WINS ? 0 : 1;
+
+  for (int i = 0; i < record_count; ++i) {
+    worker->records[i].result = packed_result;
+  }
+
+  atomic_fetch_add(&datagen->results[result], 1);
+  return record_count;
+}
+
+// Each task keeps taking game numbers until every game has been played,
+// writing a game's positions in one go once its result is known.
+void play_games(thread_pool_t *pool, int index, void *arg) {
+  (void)pool;
+  datagen_t *datagen = arg;
+  datagen_worker_t *worker = &datagen->workers[index];
+  long game;
+
+  while ((game = atomic_fetch_add(&datagen->next_game, 1)) <
+         datagen->options->games) {
+    // A discarded opening is replaced by playing the game again with the
+    // seed of one beyond the requested count.
+    long attempt = game;
+    int count;
+
+    while ((count = play_game(datagen, worker, attempt)) < 0) {
+      attempt += datagen->options->games;
+    }
+
+    pthread_mutex_lock(&datagen->lock);
+    fwrite(worker->records, sizeof(packed_position_t), count, datagen->out);
+    pthread_mutex_unlock(&datagen->lock);
+
+    atomic_fetch_add(&datagen->positions, count);
+  }
+}
+
+// Frees the pool and workers of a run and closes its output. Returns 0 if
+// the output was written out.
+int free_datagen(datagen_t *datagen, thread_pool_t *pool, int threads) {
+  free_thread_pool(pool);
+
+  for (int i = 0; datagen->workers != NULL && i < threads; ++i) {
+    free_board(datagen->workers[i].board);
+
+    if (datagen->workers[i].table != NULL) {
+      free_search_table(datagen->workers[i].table);
+    }
+  }
+
+  free(datagen->workers);
+  pthread_mutex_destroy(&datagen->lock);
+  return fclose(datagen->out) == 0 ? 0 : 1;
+}
+
+int generate(const char *path, const datagen_options_t *options) {
+  nnue_network_t *network = NULL;
+
+  if (options->network_path != NULL &&
+      (network = load_network(options->network_path)) == NULL) {
+    fprintf(stderr, "datagen: could not load %s\n", options->network_path);
+    return 1;
+  }
+
+  FILE *out = fopen(path, "ab");
+
+  if (out == NULL) {
+    fprintf(stderr, "datagen: could not open %s\n", path);
+    return 1;
+  }
+
+  thread_pool_t *pool = create_thread_pool(options->threads);
+
+  if (pool == NULL) {
+    fprintf(stderr, "datagen: could not start threads\n");
+    fclose(out);
+    free_network(network);
+    return 1;
+  }
+
+  int threads = thread_pool_size(pool);
+  datagen_t datagen = {.options = options,
+                       .network = network,
+                       .workers = calloc(threads, sizeof(datagen_worker_t)),
+                       .out = out};
+  bool out_of_memory = datagen.workers == NULL;
+  pthread_mutex_init(&datagen.lock, NULL);
+
+  for (int i = 0; !out_of_memory && i < threads; ++i) {
+    datagen.workers[i].board = create_board();
+    datagen.workers[i].table = create_search_table(options->hash_megabytes);
+
+    out_of_memory =
+        datagen.workers[i].board == NULL || datagen.workers[i].table == NULL;
+
+    if (!out_of_memory && options->stats) {
+      datagen.workers[i].board->stats = &datagen.stats;
+    }
+  }
+
+  if (out_of_memory) {
+    fprintf(stderr, "datagen: out of memory\n");
+    free_datagen(&datagen, pool, threads);
+    free_network(network);
+    return 1;
+  }
+
+  double start = now_seconds();
+
+  for (int i = 0; i < threads; ++i) {
+    thread_pool_submit(pool, i, play_games, &datagen);
+  }
+
+  thread_pool_wait(pool);
+  double seconds = now_seconds() - start;
+  long positions = atomic_load(&datagen.positions);
+
+  printf("%ld games (+%ld =%ld -%ld), %ld positions in %.2f s\n",
+         options->games, atomic_load(&datagen.results[WHITE_WINS]),
+         atomic_load(&datagen.results[DRAWN]),
+         atomic_load(&datagen.results[BLACK_WINS]), positions, seconds);
+  printf("%.0f positions/s, %.0f positions/s per thread on %d threads\n",
+         positions / seconds, positions / seconds / threads, threads);
+
+  if (options->stats) {
+    stats_print(stdout, &datagen.stats);
+  }
+
+  int status = free_datagen(&datagen, pool, threads);
+  free_network(network);
+  return status;
+}
+
+// Prints each record as FEN, score and result.
+int dump(const char *path) {
+  FILE *in = fopen(path, "rb");
+
+  if (in == NULL) {
+    fprintf(stderr, "datagen: could not open %s\n", path);
+    return 1;
+  }
+
+  packed_position_t packed;
+  char fen[100];
+
+  while (fread(&packed, sizeof(packed), 1, in) == 1) {
+    packed_to_fen(&packed, fen);
+    printf("%s | %d | %.1f\n", fen, packed.score, packed.result / 2.0);
+  }
+
+  fclose(in);
+  return 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s play OUT [--games N] [--threads N] [--depth D]\n"
+          "                   [--nodes N] [--random-plies N] [--hash MB]\n"
+          "                   [--seed N] [--network FILE] [--stats]\n"
+          "       %s dump FILE\n",
+          program, program);
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+    return dump(argv[2]);
+  }
+
+  if (argc < 3 || strcmp(argv[1], "play") != 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  datagen_options_t options = {.threads = 0,
+                               .games = 100,
+                               .nodes = 5000,
+                               .random_plies = 8,
+                               .hash_megabytes = 16};
+
+  for (int i = 3; i < argc; ++i) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      options.stats = true;
+      continue;
+    }
+
+    if (i + 1 == argc) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    if (strcmp(argv[i], "--games") == 0) {
+      options.games = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      options.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--depth") == 0) {
+      options.depth = atoi(argv[++i]);
+      options.nodes = 0;
+    } else if (strcmp(argv[i], "--nodes") == 0) {
+      options.nodes = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--random-plies") == 0) {
+      options.random_plies = atoi(argv[++i]);
+
+      // The opening may add one more ply and must leave room for the game.
+      if (options.random_plies < 0 ||
+          options.random_plies >= MAX_GAME_PLIES - 1) {
+        fprintf(stderr, "datagen: --random-plies must be below %d\n",
+                MAX_GAME_PLIES - 1);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--hash") == 0) {
+      options.hash_megabytes = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      options.seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--network") == 0) {
+      options.network_path = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  return generate(argv[2], &options);
+}
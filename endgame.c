@@ -0,0 +1,304 @@
+#include "endgame.h"
+#include "eval.h"
+#include "types.h"
+#include "zobrist.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENDGAMES 255
+#define ENDGAME_SLOTS 4096
+
+// The known endgames are looked up by material key through a perfect hash:
+// setup picks the bits of the key that give every endgame its own slot, so a
+// probe reads one slot and compares one key. Nothing changes after setup.
+endgame_t endgames[MAX_ENDGAMES];
+int endgame_count;
+unsigned char endgame_slots[ENDGAME_SLOTS];
+int endgame_shift;
+pthread_once_t endgames_once = PTHREAD_ONCE_INIT;
+
+int square_index(piece_t *piece) {
+  return piece->square->rank * 8 + piece->square->file;
+}
+
+piece_t *find_piece(board_t *board, piece_type_t type, piece_color_t color) {
+  for (int i = 0; i < board->piece_count; ++i) {
+    piece_t *piece = &board->pieces[i];
+
+    if (piece->square != NULL && piece->type == type && piece->color == color) {
+      return piece;
+    }
+  }
+
+  return NULL;
+}
+
+int king_square(board_t *board, piece_color_t color) {
+  return square_index(color == WHITE ? board->white_king : board->black_king);
+}
+
+// 0 in the four centre squares up to 3 on the edge.
+int centre_distance(int square) {
+  int rank = square / 8, file = square % 8;
+  int ranks = rank < 4 ? 3 - rank : rank - 4;
+  int files = file < 4 ? 3 - file : file - 4;
+  return ranks > files ? ranks : files;
+}
+
+// Bonus for driving the weak king to the edge and bringing the strong king
+// close to it.
+int mating_bonus(board_t *board, piece_color_t strong) {
+  int weak_king = king_square(board, !strong);
+  int strong_king = king_square(board, strong);
+
+  return 20 * centre_distance(weak_king) +
+         10 * (7 - square_distance(strong_king, weak_king));
+}
+
+// KQK, KRK: a win once the weak king is mated on an edge.
+int evaluate_kxk(board_t *board, piece_color_t strong) {
+  int material = 0;
+
+  for (int type = KNIGHT; type < KING; ++type) {
+    material += board->piece_counts[strong][type] * piece_values[type];
+  }
+
+  return KNOWN_WIN + material + mating_bonus(board, strong);
+}
+
+// KBNK: mate is only possible in a corner of the bishop's colour.
+int evaluate_kbnk(board_t *board, piece_color_t strong) {
+  int bishop = square_index(find_piece(board, BISHOP, strong));
+  int weak_king = king_square(board, !strong);
+  bool dark = (bishop / 8 + bishop % 8) % 2 == 0;
+  int first = square_distance(weak_king, dark ? 0 : 7);
+  int second = square_distance(weak_king, dark ? 63 : 56);
+  int corner = first < second ? first : second;
+
+  return KNOWN_WIN + piece_values[BISHOP] + piece_values[KNIGHT] +
+         20 * (7 - corner) + mating_bonus(board, strong);
+}
+
+// KRKP: the rook wins unless the pawn is far advanced, its king is beside it
+// and the strong king is too far away to help.
+int evaluate_krkp(board_t *board, piece_color_t strong) {
+  int weak_king = king_square(board, !strong);
+  int strong_king = king_square(board, strong);
+  int rook = square_index(find_piece(board, ROOK, strong));
+  int pawn = square_index(find_piece(board, PAWN, !strong));
+  int forward = strong == WHITE ? -8 : 8;
+  int queening = pawn % 8 + (strong == WHITE ? 0 : 56);
+  bool strong_to_move = board->side_to_move == strong;
+
+  // Ranks from the strong side's back rank.
+  int weak_king_rank = strong == WHITE ? weak_king / 8 : 7 - weak_king / 8;
+  int strong_king_rank =
+      strong == WHITE ? strong_king / 8 : 7 - strong_king / 8;
+  bool king_in_front =
+      strong_king % 8 == pawn % 8 &&
+      (strong == WHITE ? strong_king < pawn : strong_king > pawn);
+
+  if (king_in_front) {
+    return piece_values[ROOK] - square_distance(strong_king, pawn);
+  }
+
+  if (square_distance(weak_king, pawn) >= 3 + !strong_to_move &&
+      square_distance(weak_king, rook) >= 3) {
+    return piece_values[ROOK] - square_distance(strong_king, pawn);
+  }
+
+  if (weak_king_rank <= 2 && square_distance(weak_king, pawn) == 1 &&
+      strong_king_rank >= 3 &&
+      square_distance(strong_king, pawn) > 2 + strong_to_move) {
+    return 80 - 8 * square_distance(strong_king, pawn);
+  }
+
+  return 200 - 8 * (square_distance(strong_king, pawn + forward) -
+                    square_distance(weak_king, pawn + forward) -
+                    square_distance(pawn, queening));
+}
+
+// KRKB, KRKN: usually a draw; only the edge gives the rook chances.
+int evaluate_krk_minor(board_t *board, piece_color_t strong) {
+  return 10 * centre_distance(king_square(board, !strong));
+}
+
+// KNNK cannot be forced.
+int evaluate_draw(board_t *board, piece_color_t strong) {
+  (void)board;
+  (void)strong;
+  return 0;
+}
+
+// KB and rook pawns: a dead draw when the pawns are all on one rook file, the
+// bishop does not control the queening square and the defending king reaches
+// the corner first.
+int scale_wrong_bishop(board_t *board, piece_color_t strong) {
+  int file = -1;
+
+  for (int i = 0; i < board->piece_count; ++i) {
+    piece_t *piece = &board->pieces[i];
+
+    if (piece->square == NULL || piece->type != PAWN) {
+      continue;
+    }
+
+    if ((piece->square->file != 0 && piece->square->file != 7) ||
+        (file != -1 && piece->square->file != file)) {
+      return SCALE_NORMAL;
+    }
+
+    file = piece->square->file;
+  }
+
+  int bishop = square_index(find_piece(board, BISHOP, strong));
+  int queening = file + (strong == WHITE ? 56 : 0);
+  bool bishop_dark = (bishop / 8 + bishop % 8) % 2 == 0;
+  bool queening_dark = (queening / 8 + queening % 8) % 2 == 0;
+
+  if (bishop_dark != queening_dark &&
+      square_distance(king_square(board, !strong), queening) <= 1) {
+    return 0;
+  }
+
+  return SCALE_NORMAL;
+}
+
+// Bishops of opposite colours with only pawns besides: hard to win even a
+// pawn or two up.
+int scale_opposite_bishops(board_t *board, piece_color_t strong) {
+  int white = square_index(find_piece(board, BISHOP, WHITE));
+  int black = square_index(find_piece(board, BISHOP, BLACK));
+
+  if ((white / 8 + white % 8) % 2 == (black / 8 + black % 8) % 2) {
+    return SCALE_NORMAL;
+  }
+
+  int pawns = board->piece_counts[strong][PAWN] -
+              board->piece_counts[!strong][PAWN];
+
+  return abs(pawns) <= 1 ? 16 : 32;
+}
+
+unsigned long long signature_key(const int counts[2][6]) {
+  unsigned long long key = 0;
+
+  for (int color = WHITE; color <= BLACK; ++color) {
+    for (int type = PAWN; type <= KING; ++type) {
+      for (int count = 0; count < counts[color][type]; ++count) {
+        key ^= material_count_key(type, color, count);
+      }
+    }
+  }
+
+  return key;
+}
+
+// Registers the balance for strong as white and as black. code names the
+// strong side's pieces and then the weak side's, each starting with its king,
+// as in "KRKP"; pawns adds that many pawns to each side.
+void add_endgame(const char *code, const int pawns[2], endgame_fn_t evaluate,
+                 endgame_fn_t scale) {
+  int sides[2][6] = {{0}};
+  int side = -1;
+
+  for (const char *c = code; *c != '\0'; ++c) {
+    const char *type = strchr("PNBRQK", *c);
+    side += *c == 'K';
+    sides[side][type - "PNBRQK"]++;
+  }
+
+  sides[0][PAWN] += pawns[0];
+  sides[1][PAWN] += pawns[1];
+
+  for (int strong = WHITE; strong <= BLACK; ++strong) {
+    int counts[2][6];
+    memcpy(counts[strong], sides[0], sizeof(sides[0]));
+    memcpy(counts[!strong], sides[1], sizeof(sides[1]));
+    unsigned long long key = signature_key(counts);
+    bool known = false;
+
+    for (int i = 0; i < endgame_count; ++i) {
+      known |= endgames[i].key == key;
+    }
+
+    if (!known && endgame_count < MAX_ENDGAMES) {
+      endgames[endgame_count++] = (endgame_t){
+          .key = key, .strong = strong, .evaluate = evaluate, .scale = scale};
+    }
+  }
+}
+
+int endgame_slot(unsigned long long key) {
+  return (key >> endgame_shift) & (ENDGAME_SLOTS - 1);
+}
+
+void setup_endgames(void) {
+  const int none[2] = {0, 0};
+
+  add_endgame("KQK", none, evaluate_kxk, NULL);
+  add_endgame("KRK", none, evaluate_kxk, NULL);
+  add_endgame("KBNK", none, evaluate_kbnk, NULL);
+  add_endgame("KRKP", none, evaluate_krkp, NULL);
+  add_endgame("KRKB", none, evaluate_krk_minor, NULL);
+  add_endgame("KRKN", none, evaluate_krk_minor, NULL);
+  add_endgame("KNNK", none, evaluate_draw, NULL);
+
+  for (int strong = 1; strong <= 8; ++strong) {
+    const int pawns[2] = {strong, 0};
+    add_endgame("KBK", pawns, NULL, scale_wrong_bishop);
+  }
+
+  for (int strong = 0; strong <= 8; ++strong) {
+    for (int weak = 0; weak <= strong; ++weak) {
+      const int pawns[2] = {strong, weak};
+      add_endgame("KBKB", pawns, NULL, scale_opposite_bishops);
+    }
+  }
+
+  // Use the shift that leaves the fewest endgames out; in practice one gives
+  // every endgame its own slot.
+  int best_shift = 0, best_collisions = endgame_count + 1;
+
+  for (endgame_shift = 0; endgame_shift <= 52; ++endgame_shift) {
+    memset(endgame_slots, 0, sizeof(endgame_slots));
+    int collisions = 0;
+
+    for (int i = 0; i < endgame_count; ++i) {
+      unsigned char *slot = &endgame_slots[endgame_slot(endgames[i].key)];
+      collisions += *slot != 0;
+      *slot = i + 1;
+    }
+
+    if (collisions < best_collisions) {
+      best_shift = endgame_shift;
+      best_collisions = collisions;
+    }
+  }
+
+  endgame_shift = best_shift;
+  memset(endgame_slots, 0, sizeof(endgame_slots));
+
+  for (int i = 0; i < endgame_count; ++i) {
+    unsigned char *slot = &endgame_slots[endgame_slot(endgames[i].key)];
+
+    if (*slot == 0) {
+      *slot = i + 1;
+    }
+  }
+}
+
+// Returns the specialised evaluation for the board's material, or NULL.
+const endgame_t *probe_endgame(board_t *board) {
+  pthread_once(&endgames_once, setup_endgames);
+
+  int index = endgame_slots[endgame_slot(board->material_key)];
+
+  if (index == 0 || endgames[index - 1].key != board->material_key) {
+    return NULL;
+  }
+
+  return &endgames[index - 1];
+}
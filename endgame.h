@@ -0,0 +1,21 @@
+#include "types.h"
+
+#pragma once
+
+// Scale factors are out of SCALE_NORMAL; 0 means a dead draw.
+#define SCALE_NORMAL 64
+#define KNOWN_WIN 1000
+
+typedef int (*endgame_fn_t)(board_t *board, piece_color_t strong);
+
+// A material balance with a specialised evaluation. Exactly one of evaluate
+// (the score for strong, replacing the general evaluation) and scale (a factor
+// applied to the general evaluation) is set.
+typedef struct Endgame {
+  unsigned long long key;
+  piece_color_t strong;
+  endgame_fn_t evaluate;
+  endgame_fn_t scale;
+} endgame_t;
+
+const endgame_t *probe_endgame(board_t *board);
@@ -0,0 +1,445 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "move_piece.h"
+#include "nnue.h"
+#include "search.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EPD_MAX_MOVES 8
+
+typedef struct EpdOptions {
+  search_limits_t limits;
+  int threads;
+  size_t hash_megabytes;
+  const char *network_path;
+  bool stats;
+} epd_options_t;
+
+// A test position with its bm (best move) and am (avoid move) operations,
+// and what the search made of it. solved_seconds is when the search last
+// switched to a correct move, or negative while its move is wrong.
+typedef struct EpdPosition {
+  char fen[128];
+  char id[64];
+  char expected[64];
+  move_t best[EPD_MAX_MOVES];
+  int best_count;
+  move_t avoid[EPD_MAX_MOVES];
+  int avoid_count;
+  bool done;
+  bool solved;
+  char found[10];
+  int depth;
+  double solved_seconds;
+  int solved_depth;
+  unsigned long long nodes;
+} epd_position_t;
+
+typedef struct EpdWorker {
+  board_t *board;
+  search_table_t *table;
+} epd_worker_t;
+
+typedef struct EpdSuite {
+  const epd_options_t *options;
+  const nnue_network_t *network;
+  epd_position_t *positions;
+  long count;
+  epd_worker_t *workers;
+  atomic_long next_position;
+  pthread_mutex_t lock;
+  long next_to_print;
+  stats_t stats;
+} epd_suite_t;
+
+double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+bool is_expected_move(const epd_position_t *position, move_t move) {
+  for (int i = 0; i < position->avoid_count; ++i) {
+    if (encode_move(position->avoid[i]) == encode_move(move)) {
+      return false;
+    }
+  }
+
+  for (int i = 0; i < position->best_count; ++i) {
+    if (encode_move(position->best[i]) == encode_move(move)) {
+      return true;
+    }
+  }
+
+  return position->best_count == 0;
+}
+
+// Reads the SAN moves of a bm or am operation into moves.
+bool parse_epd_moves(board_t *board, char *operands, move_t *moves,
+                     int *count) {
+  char *save;
+
+  for (char *san = strtok_r(operands, " \t", &save); san != NULL;
+       san = strtok_r(NULL, " \t", &save)) {
+    if (*count == EPD_MAX_MOVES ||
+        !san_to_move(board, san, board->side_to_move, &moves[*count])) {
+      return false;
+    }
+
+    (*count)++;
+  }
+
+  return *count > 0;
+}
+
+// Parses a line such as
+//   r1b2rk1/... w - - bm Qxh7+; id "WAC.005";
+// The four position fields may be followed by the halfmove and fullmove
+// counters. Operations other than bm, am and id are ignored.
+bool parse_epd(char *line, board_t *board, epd_position_t *position) {
+  char *save;
+  char *fields[4];
+
+  for (int i = 0; i < 4; ++i) {
+    fields[i] = strtok_r(i == 0 ? line : NULL, " \t", &save);
+
+    if (fields[i] == NULL) {
+      return false;
+    }
+  }
+
+  char *rest = save;
+  int halfmove = 0, fullmove = 1, length = 0;
+
+  if (sscanf(rest, " %d %d%n", &halfmove, &fullmove, &length) == 2) {
+    rest += length;
+  }
+
+  snprintf(position->fen, sizeof(position->fen), "%s %s %s %s %d %d",
+           fields[0], fields[1], fields[2], fields[3], halfmove, fullmove);
+  piece_color_t color;
+
+  if (load_fen(board, position->fen, &color) == NULL) {
+    return false;
+  }
+
+  // Operations end at semicolons outside quoted strings.
+  while (*rest != '\0') {
+    while (isspace((unsigned char)*rest)) {
+      rest++;
+    }
+
+    char *operation = rest;
+    bool quoted = false;
+
+    while (*rest != '\0' && (quoted || *rest != ';')) {
+      quoted ^= *rest++ == '"';
+    }
+
+    if (*rest == ';') {
+      *rest++ = '\0';
+    }
+
+    char *operands = operation + strcspn(operation, " \t");
+
+    if (*operands != '\0') {
+      *operands++ = '\0';
+    }
+
+    if (strcmp(operation, "bm") == 0 || strcmp(operation, "am") == 0) {
+      snprintf(position->expected, sizeof(position->expected), "%s %s",
+               operation, operands);
+
+      if (!parse_epd_moves(board, operands,
+                           operation[0] == 'b' ? position->best
+                                               : position->avoid,
+                           operation[0] == 'b' ? &position->best_count
+                                               : &position->avoid_count)) {
+        return false;
+      }
+    } else if (strcmp(operation, "id") == 0) {
+      operands += *operands == '"';
+      operands[strcspn(operands, "\"")] = '\0';
+      snprintf(position->id, sizeof(position->id), "%s", operands);
+    }
+  }
+
+  return position->best_count > 0 || position->avoid_count > 0;
+}
+
+epd_position_t *read_suite(const char *path, long *count) {
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    return NULL;
+  }
+
+  epd_position_t *positions = NULL;
+  long capacity = 0;
+  char line[1024];
+  long number = 0;
+  board_t *board = create_board();
+  *count = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    number++;
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (line[0] == '\0' || line[0] == '#') {
+      continue;
+    }
+
+    if (*count == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      positions = realloc(positions, capacity * sizeof(epd_position_t));
+    }
+
+    epd_position_t *position = &positions[*count];
+    memset(position, 0, sizeof(epd_position_t));
+
+    if (!parse_epd(line, board, position)) {
+      fprintf(stderr, "epd: skipping line %ld\n", number);
+      continue;
+    }
+
+    if (position->id[0] == '\0') {
+      snprintf(position->id, sizeof(position->id), "line %ld", number);
+    }
+
+    (*count)++;
+  }
+
+  free_board(board);
+  fclose(file);
+  return positions;
+}
+
+void track_solution(const search_result_t *result, void *arg) {
+  epd_position_t *position = arg;
+
+  if (!is_expected_move(position, result->best_move)) {
+    position->solved_seconds = -1;
+  } else if (position->solved_seconds < 0) {
+    position->solved_seconds = result->seconds;
+    position->solved_depth = result->depth;
+  }
+}
+
+// Prints finished positions in suite order.
+void print_finished(epd_suite_t *suite) {
+  while (suite->next_to_print < suite->count &&
+         suite->positions[suite->next_to_print].done) {
+    epd_position_t *position = &suite->positions[suite->next_to_print++];
+    printf("%-16s %-6s %-7s %-20s", position->id,
+           position->solved ? "solved" : "failed", position->found,
+           position->expected);
+
+    if (position->solved) {
+      printf(" %6.2f s at depth %d\n", position->solved_seconds,
+             position->solved_depth);
+    } else {
+      printf(" depth %d\n", position->depth);
+    }
+  }
+
+  fflush(stdout);
+}
+
+// Each task searches one position at a time until the suite is done.
+void solve_positions(thread_pool_t *pool, int index, void *arg) {
+  (void)pool;
+  epd_suite_t *suite = arg;
+  epd_worker_t *worker = &suite->workers[index];
+  long next;
+
+  while ((next = atomic_fetch_add(&suite->next_position, 1)) < suite->count) {
+    epd_position_t *position = &suite->positions[next];
+    search_limits_t limits = suite->options->limits;
+    search_result_t result;
+    piece_color_t color;
+
+    limits.progress = track_solution;
+    limits.progress_arg = position;
+    position->solved_seconds = -1;
+    clear_search_table(worker->table);
+    nnue_attach(worker->board, suite->network);
+    load_fen(worker->board, position->fen, &color);
+
+    if (search(worker->board, &limits, worker->table, &result)) {
+      move_to_san(worker->board, result.best_move, position->found);
+      position->solved = is_expected_move(position, result.best_move);
+      position->depth = result.depth;
+      position->nodes = result.nodes;
+    } else {
+      snprintf(position->found, sizeof(position->found), "-");
+    }
+
+    pthread_mutex_lock(&suite->lock);
+    position->done = true;
+    print_finished(suite);
+    pthread_mutex_unlock(&suite->lock);
+  }
+}
+
+int run_suite(const char *path, const epd_options_t *options) {
+  epd_suite_t suite = {.options = options};
+
+  if ((suite.positions = read_suite(path, &suite.count)) == NULL ||
+      suite.count == 0) {
+    fprintf(stderr, "epd: no positions in %s\n", path);
+    free(suite.positions);
+    return 1;
+  }
+
+  nnue_network_t *network = NULL;
+
+  if (options->network_path != NULL &&
+      (network = load_network(options->network_path)) == NULL) {
+    fprintf(stderr, "epd: could not load %s\n", options->network_path);
+    free(suite.positions);
+    return 1;
+  }
+
+  suite.network = network;
+  thread_pool_t *pool = create_thread_pool(options->threads);
+  int threads = thread_pool_size(pool);
+  suite.workers = calloc(threads, sizeof(epd_worker_t));
+  pthread_mutex_init(&suite.lock, NULL);
+
+  for (int i = 0; suite.workers != NULL && i < threads; ++i) {
+    suite.workers[i].board = create_board();
+    suite.workers[i].table = create_search_table(options->hash_megabytes);
+
+    if (suite.workers[i].board == NULL || suite.workers[i].table == NULL) {
+      fprintf(stderr, "epd: out of memory\n");
+      return 1;
+    }
+
+    suite.workers[i].board->stats = options->stats ? &suite.stats : NULL;
+  }
+
+  double start = now_seconds();
+
+  for (int i = 0; i < threads; ++i) {
+    thread_pool_submit(pool, i, solve_positions, &suite);
+  }
+
+  thread_pool_wait(pool);
+  double seconds = now_seconds() - start;
+  long solved = 0;
+  double solve_time = 0;
+  unsigned long long nodes = 0;
+
+  for (long i = 0; i < suite.count; ++i) {
+    nodes += suite.positions[i].nodes;
+
+    if (suite.positions[i].solved) {
+      solved++;
+      solve_time += suite.positions[i].solved_seconds;
+    }
+  }
+
+  printf("solved %ld/%ld (%.1f%%)", solved, suite.count,
+         100.0 * solved / suite.count);
+
+  if (solved > 0) {
+    printf(", mean time to solution %.2f s", solve_time / solved);
+  }
+
+  printf("\n%llu nodes in %.2f s, %.0f nodes/s on %d threads\n", nodes,
+         seconds, nodes / seconds, threads);
+
+  if (options->stats) {
+    stats_print(stdout, &suite.stats);
+  }
+
+  free_thread_pool(pool);
+
+  for (int i = 0; i < threads; ++i) {
+    free_board(suite.workers[i].board);
+    free_search_table(suite.workers[i].table);
+  }
+
+  free(suite.workers);
+  free(suite.positions);
+  free_network(network);
+  pthread_mutex_destroy(&suite.lock);
+  return 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s SUITE [--ms N | --nodes N | --depth D] [--threads N]\n"
+          "                [--hash MB] [--network FILE] [--telemetry FILE]\n"
+          "                [--stats]\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  epd_options_t options = {.hash_megabytes = 16};
+  bool limited = false;
+
+  for (int i = 2; i < argc; ++i) {
+    int left = argc - i - 1;
+
+    if (strcmp(argv[i], "--ms") == 0 && left >= 1) {
+      options.limits.milliseconds = atol(argv[++i]);
+      limited = true;
+    } else if (strcmp(argv[i], "--nodes") == 0 && left >= 1) {
+      options.limits.nodes = strtoull(argv[++i], NULL, 10);
+      limited = true;
+    } else if (strcmp(argv[i], "--depth") == 0 && left >= 1) {
+      options.limits.depth = atoi(argv[++i]);
+      limited = true;
+    } else if (strcmp(argv[i], "--threads") == 0 && left >= 1) {
+      options.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hash") == 0 && left >= 1) {
+      options.hash_megabytes = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--network") == 0 && left >= 1) {
+      options.network_path = argv[++i];
+    } else if (strcmp(argv[i], "--telemetry") == 0 && left >= 1) {
+      if (options.limits.telemetry != NULL) {
+        close_telemetry(options.limits.telemetry);
+      }
+
+      if ((options.limits.telemetry = open_telemetry(argv[++i])) == NULL) {
+        fprintf(stderr, "epd: could not open %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options.stats = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!limited) {
+    options.limits.milliseconds = 1000;
+  }
+
+  int status = run_suite(argv[1], &options);
+
+  if (options.limits.telemetry != NULL) {
+    close_telemetry(options.limits.telemetry);
+  }
+
+  return status;
+}
@@ -0,0 +1,358 @@
+#include "eval.h"
+#include "endgame.h"
+#include "nnue.h"
+#include "stats.h"
+#include "tables.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define PAWN_TABLE_SIZE 8192
+#define FILE_A 0x0101010101010101ULL
+
+const int piece_values[6] = {100, 320, 330, 500, 900, 0};
+
+// Piece-square bonuses from white's side, a8 first. Black uses the same
+// tables mirrored vertically.
+const int piece_squares[6][64] = {
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,
+         50,  50,  50,  50,  50,  50,  50,  50,
+         10,  10,  20,  30,  30,  20,  10,  10,
+          5,   5,  10,  25,  25,  10,   5,   5,
+          0,   0,   0,  20,  20,   0,   0,   0,
+          5,  -5, -10,   0,   0, -10,  -5,   5,
+          5,  10,  10, -20, -20,  10,  10,   5,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    },
+    {
+        -50, -40, -30, -30, -30, -30, -40, -50,
+        -40, -20,   0,   0,   0,   0, -20, -40,
+        -30,   0,  10,  15,  15,  10,   0, -30,
+        -30,   5,  15,  20,  20,  15,   5, -30,
+        -30,   0,  15,  20,  20,  15,   0, -30,
+        -30,   5,  10,  15,  15,  10,   5, -30,
+        -40, -20,   0,   5,   5,   0, -20, -40,
+        -50, -40, -30, -30, -30, -30, -40, -50,
+    },
+    {
+        -20, -10, -10, -10, -10, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   5,   5,  10,  10,   5,   5, -10,
+        -10,   0,  10,  10,  10,  10,   0, -10,
+        -10,  10,  10,  10,  10,  10,  10, -10,
+        -10,   5,   0,   0,   0,   0,   5, -10,
+        -20, -10, -10, -10, -10, -10, -10, -20,
+    },
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,
+          5,  10,  10,  10,  10,  10,  10,   5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+          0,   0,   0,   5,   5,   0,   0,   0,
+    },
+    {
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+         -5,   0,   5,   5,   5,   5,   0,  -5,
+          0,   0,   5,   5,   5,   5,   0,  -5,
+        -10,   5,   5,   5,   5,   5,   0, -10,
+        -10,   0,   5,   0,   0,   0,   0, -10,
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+    },
+    {
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -20, -30, -30, -40, -40, -30, -30, -20,
+        -10, -20, -20, -20, -20, -20, -20, -10,
+         20,  20,   0,   0,   0,   0,  20,  20,
+         20,  30,  10,   0,   0,  10,  30,  20,
+    },
+};
+
+// In the endgame the king belongs in the centre.
+const int king_endgame_squares[64] = {
+    -50, -40, -30, -20, -20, -30, -40, -50,
+    -30, -20, -10,   0,   0, -10, -20, -30,
+    -30, -10,  20,  30,  30,  20, -10, -30,
+    -30, -10,  30,  40,  40,  30, -10, -30,
+    -30, -10,  30,  40,  40,  30, -10, -30,
+    -30, -10,  20,  30,  30,  20, -10, -30,
+    -30, -30,   0,   0,   0,   0, -30, -30,
+    -50, -30, -30, -30, -30, -30, -30, -50,
+};
+
+// Middlegame and endgame bonuses for a passed pawn by how far it has
+// advanced.
+const int passed_middlegame[8] = {0, 5, 10, 15, 25, 40, 60, 0};
+const int passed_endgame[8] = {0, 10, 20, 35, 60, 100, 150, 0};
+
+// Pawn structure depends only on where the pawns are, so its evaluation is
+// cached under board->pawn_key. Scores are from white's side; pawns and passed
+// are bitboards (bit rank * 8 + file) that let the king-dependent terms be
+// worked out without looking at the board again.
+typedef struct PawnEntry {
+  unsigned long long key;
+  unsigned long long pawns[2];
+  unsigned long long passed;
+  short middlegame;
+  short endgame;
+} pawn_entry_t;
+
+// Each search has its own table, so probes need no locking.
+struct PawnTable {
+  pawn_entry_t entries[PAWN_TABLE_SIZE];
+};
+
+pawn_table_t *create_pawn_table(void) {
+  return calloc(1, sizeof(pawn_table_t));
+}
+
+void free_pawn_table(pawn_table_t *table) { free(table); }
+
+unsigned long long adjacent_files(int file) {
+  return (file > 0 ? FILE_A << (file - 1) : 0) |
+         (file < 7 ? FILE_A << (file + 1) : 0);
+}
+
+// Squares on ranks strictly in front of rank from color's side.
+unsigned long long ranks_ahead(piece_color_t color, int rank) {
+  if (color == WHITE) {
+    return rank == 7 ? 0 : ~0ULL << (8 * (rank + 1));
+  }
+
+  return (1ULL << (8 * rank)) - 1;
+}
+
+void evaluate_pawns(board_t *board, pawn_entry_t *entry) {
+  entry->key = board->pawn_key;
+  entry->pawns[WHITE] = entry->pawns[BLACK] = entry->passed = 0;
+
+  for (int i = 0; i < board->piece_count; ++i) {
+    piece_t *piece = &board->pieces[i];
+
+    if (piece->square != NULL && piece->type == PAWN) {
+      entry->pawns[piece->color] |=
+          1ULL << (piece->square->rank * 8 + piece->square->file);
+    }
+  }
+
+  int middlegame = 0, endgame = 0;
+
+  for (int i = 0; i < board->piece_count; ++i) {
+    piece_t *piece = &board->pieces[i];
+
+    if (piece->square == NULL || piece->type != PAWN) {
+      continue;
+    }
+
+    piece_color_t color = piece->color;
+    int rank = piece->square->rank, file = piece->square->file;
+    int relative_rank = color == WHITE ? rank : 7 - rank;
+    int forward = color == WHITE ? 1 : -1;
+    unsigned long long own = entry->pawns[color];
+    unsigned long long enemy = entry->pawns[!color];
+    unsigned long long ahead = ranks_ahead(color, rank);
+    unsigned long long neighbours = adjacent_files(file);
+    int mg = 0, eg = 0;
+
+    if (own & FILE_A << file & ahead) {
+      mg -= 10;
+      eg -= 20;
+    } else if (!(enemy & (neighbours | FILE_A << file) & ahead)) {
+      entry->passed |= 1ULL << (rank * 8 + file);
+      mg += passed_middlegame[relative_rank];
+      eg += passed_endgame[relative_rank];
+    }
+
+    if (!(own & neighbours)) {
+      mg -= 10;
+      eg -= 15;
+    } else if (!(own & neighbours & ~ahead)) {
+      // No pawn beside or behind can support it, and an enemy pawn guards
+      // the square in front.
+      int stop = rank + forward;
+      int guard = stop + forward;
+
+      if (guard >= 0 && guard <= 7 &&
+          enemy & neighbours & 0xffULL << (8 * guard)) {
+        mg -= 8;
+        eg -= 10;
+      }
+    }
+
+    middlegame += color == WHITE ? mg : -mg;
+    endgame += color == WHITE ? eg : -eg;
+  }
+
+  entry->middlegame = middlegame;
+  entry->endgame = endgame;
+}
+
+// Returns the pawn evaluation of board from table, or worked out into scratch
+// when there is no table.
+pawn_entry_t *probe_pawns(board_t *board, pawn_table_t *table,
+                          pawn_entry_t *scratch) {
+  if (table == NULL) {
+    evaluate_pawns(board, scratch);
+    return scratch;
+  }
+
+  pawn_entry_t *entry = &table->entries[board->pawn_key % PAWN_TABLE_SIZE];
+
+  STATS_COUNT(COUNTER_PAWN_PROBES);
+
+  if (entry->key == board->pawn_key) {
+    STATS_COUNT(COUNTER_PAWN_HITS);
+    return entry;
+  }
+
+  evaluate_pawns(board, entry);
+  return entry;
+}
+
+int square_distance(int from, int to) { return square_distances[from][to]; }
+
+// Terms that depend on the kings as well as the pawns: the pawns sheltering a
+// king that has stayed on its back two ranks, and in the endgame how close
+// each king is to the square in front of every passed pawn.
+void evaluate_kings(board_t *board, pawn_entry_t *entry, int *middlegame,
+                    int *endgame) {
+  piece_t *kings[2] = {board->white_king, board->black_king};
+  int squares[2];
+
+  for (int color = WHITE; color <= BLACK; ++color) {
+    square_t *square = kings[color]->square;
+    squares[color] = square->rank * 8 + square->file;
+    int relative_rank = color == WHITE ? square->rank : 7 - square->rank;
+
+    if (relative_rank > 1) {
+      continue;
+    }
+
+    unsigned long long files =
+        adjacent_files(square->file) | FILE_A << square->file;
+    unsigned long long ahead = ranks_ahead(color, square->rank) &
+                               ~ranks_ahead(color, color == WHITE
+                                                       ? square->rank + 2
+                                                       : square->rank - 2);
+    int shield = 0;
+
+    for (unsigned long long pawns = entry->pawns[color] & files & ahead;
+         pawns != 0; pawns &= pawns - 1) {
+      shield += 10;
+    }
+
+    *middlegame += color == WHITE ? shield : -shield;
+  }
+
+  for (int i = 0; i < board->piece_count; ++i) {
+    piece_t *piece = &board->pieces[i];
+
+    if (piece->square == NULL || piece->type != PAWN) {
+      continue;
+    }
+
+    int index = piece->square->rank * 8 + piece->square->file;
+
+    if (!(entry->passed >> index & 1)) {
+      continue;
+    }
+
+    piece_color_t color = piece->color;
+    int stop = index + (color == WHITE ? 8 : -8);
+    int relative_rank =
+        color == WHITE ? piece->square->rank : 7 - piece->square->rank;
+    int bonus = (4 * square_distance(squares[!color], stop) -
+                 2 * square_distance(squares[color], stop)) *
+                relative_rank / 2;
+
+    *endgame += color == WHITE ? bonus : -bonus;
+  }
+}
+
+// Game phase from the pieces left: 24 with all minor and major pieces on the
+// board, 0 with none.
+int game_phase(board_t *board) {
+  int phase = 0;
+
+  for (int color = WHITE; color <= BLACK; ++color) {
+    int *counts = board->piece_counts[color];
+    phase += counts[KNIGHT] + counts[BISHOP] + 2 * counts[ROOK] +
+             4 * counts[QUEEN];
+  }
+
+  return phase > 24 ? 24 : phase;
+}
+
+// Material, piece-square and pawn structure terms, from white's side.
+int classical_evaluate(board_t *board, pawn_table_t *pawn_table) {
+  int phase = game_phase(board);
+  int score = 0;
+
+  for (int i = 0; i < board->piece_count; ++i) {
+    piece_t *piece = &board->pieces[i];
+
+    if (piece->square == NULL) {
+      continue;
+    }
+
+    int rank = piece->color == WHITE ? 7 - piece->square->rank
+                                     : piece->square->rank;
+    int index = rank * 8 + piece->square->file;
+    int value = piece_values[piece->type];
+
+    if (piece->type == KING) {
+      value += (piece_squares[KING][index] * phase +
+                king_endgame_squares[index] * (24 - phase)) /
+               24;
+    } else {
+      value += piece_squares[piece->type][index];
+    }
+
+    score += piece->color == WHITE ? value : -value;
+  }
+
+  pawn_entry_t scratch;
+  pawn_entry_t *pawns = probe_pawns(board, pawn_table, &scratch);
+  int middlegame = pawns->middlegame, endgame = pawns->endgame;
+  evaluate_kings(board, pawns, &middlegame, &endgame);
+  score += (middlegame * phase + endgame * (24 - phase)) / 24;
+
+  return score;
+}
+
+// Returns the evaluation in centipawns from the side to move's point of view.
+// Known endgames are scored or scaled by their own rules; otherwise the
+// attached network is used if there is one. Pawn structure is cached in
+// pawns, which may be NULL.
+int evaluate(board_t *board, pawn_table_t *pawns) {
+  const endgame_t *endgame = probe_endgame(board);
+
+  if (endgame != NULL && endgame->evaluate != NULL) {
+    int score = endgame->evaluate(board, endgame->strong);
+    return board->side_to_move == endgame->strong ? score : -score;
+  }
+
+  int score;
+
+  if (board->network != NULL) {
+    score = nnue_evaluate(board);
+  } else {
+    score = classical_evaluate(board, pawns);
+    score = board->side_to_move == WHITE ? score : -score;
+  }
+
+  if (endgame != NULL) {
+    score = score * endgame->scale(board, endgame->strong) / SCALE_NORMAL;
+  }
+
+  return score;
+}
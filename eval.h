@@ -0,0 +1,15 @@
+#include "types.h"
+
+#pragma once
+#pragma GCC visibility push(default)
+
+extern const int piece_values[6];
+
+typedef struct PawnTable pawn_table_t;
+
+pawn_table_t *create_pawn_table(void);
+void free_pawn_table(pawn_table_t *table);
+int square_distance(int from, int to);
+int evaluate(board_t *board, pawn_table_t *pawns);
+
+#pragma GCC visibility pop
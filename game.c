@@ -0,0 +1,442 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "game.h"
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "search.h"
+#include "types.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+game_history_t *init_history(unsigned long long hash) {
+  game_history_t *history = malloc(sizeof(game_history_t));
+
+  if (!history) {
+    return NULL;
+  }
+
+  history->length = 0;
+  history->capacity = 64;
+  history->borrowed = false;
+  history->moves = malloc(history->capacity * sizeof(unsigned short));
+  history->hashes =
+      malloc((history->capacity + 1) * sizeof(unsigned long long));
+
+  if (!history->moves || !history->hashes) {
+    free(history->moves);
+    free(history->hashes);
+    free(history);
+    return NULL;
+  }
+
+  history->hashes[0] = hash;
+  return history;
+}
+
+void append_history(game_history_t *history, move_t move,
+                    unsigned long long hash) {
+  if (history->length == history->capacity && history->borrowed) {
+    size_t new_capacity = history->capacity * 2;
+    unsigned short *new_moves = malloc(new_capacity * sizeof(unsigned short));
+    unsigned long long *new_hashes =
+        malloc((new_capacity + 1) * sizeof(unsigned long long));
+
+    if (!new_moves || !new_hashes) {
+      free(new_moves);
+      free(new_hashes);
+      return;
+    }
+
+    memcpy(new_moves, history->moves,
+           history->length * sizeof(unsigned short));
+    memcpy(new_hashes, history->hashes,
+           (history->length + 1) * sizeof(unsigned long long));
+    history->moves = new_moves;
+    history->hashes = new_hashes;
+    history->capacity = new_capacity;
+    history->borrowed = false;
+  } else if (history->length == history->capacity) {
+    size_t new_capacity = history->capacity * 2;
+    unsigned short *new_moves =
+        realloc(history->moves, new_capacity * sizeof(unsigned short));
+    unsigned long long *new_hashes = realloc(
+        history->hashes, (new_capacity + 1) * sizeof(unsigned long long));
+
+    if (new_moves) {
+      history->moves = new_moves;
+    }
+
+    if (new_hashes) {
+      history->hashes = new_hashes;
+    }
+
+    if (!new_moves || !new_hashes) {
+      return;
+    }
+
+    history->capacity = new_capacity;
+  }
+
+  history->moves[history->length] = encode_move(move);
+  history->hashes[++history->length] = hash;
+}
+
+// Counts earlier occurrences of the current position. The hash covers side to
+// move, castling rights and en passant, so equal hashes are repetitions, and
+// nothing before the last capture or pawn move can repeat.
+int repetitions(game_history_t *history, int reversible_plies) {
+  unsigned long long hash = history->hashes[history->length];
+  size_t first = (size_t)reversible_plies < history->length
+                     ? history->length - reversible_plies
+                     : 0;
+  int count = 0;
+
+  for (size_t i = first; i < history->length; i++) {
+    count += history->hashes[i] == hash;
+  }
+
+  return count;
+}
+
+void free_history(game_history_t *history) {
+  if (!history->borrowed) {
+    free(history->moves);
+    free(history->hashes);
+  }
+
+  free(history);
+}
+
+// Starts a game from fen, or from the standard position when fen is NULL.
+// Returns NULL if the FEN is invalid or memory runs out.
+game_t *create_game(const char *fen) {
+  game_t *game = calloc(1, sizeof(game_t));
+
+  if (!game) {
+    return NULL;
+  }
+
+  game->board = create_board();
+  piece_color_t color;
+
+  if (!game->board ||
+      (fen != NULL && load_fen(game->board, fen, &color) == NULL)) {
+    free_board(game->board);
+    free(game);
+    return NULL;
+  }
+
+  game->history = init_history(game->board->hash);
+
+  if (!game->history) {
+    free_board(game->board);
+    free(game);
+    return NULL;
+  }
+
+  game->draw_offer = NO_OFFER;
+  game->table_megabytes = 16;
+  game_update_status(game);
+  return game;
+}
+
+void free_game(game_t *game) {
+  game_stop_pondering(game);
+
+  if (game->table != NULL) {
+    free_search_table(game->table);
+  }
+
+  free_history(game->history);
+  free_board(game->board);
+  free(game);
+}
+
+// Starts a game inside arena, which needs no allocation unless the game
+// outgrows the history kept there. Returns NULL if the FEN is invalid.
+game_t *start_arena_game(game_arena_t *arena, const char *fen) {
+  game_t *game = &arena->game;
+  piece_color_t color;
+
+  memset(game, 0, sizeof(game_t));
+  memset(&arena->board, 0, sizeof(board_t));
+
+  if (load_fen(&arena->board, fen != NULL ? fen : START_FEN, &color) ==
+      NULL) {
+    return NULL;
+  }
+
+  arena->history.moves = arena->moves;
+  arena->history.hashes = arena->hashes;
+  arena->history.length = 0;
+  arena->history.capacity = GAME_ARENA_PLIES;
+  arena->history.borrowed = true;
+  arena->hashes[0] = arena->board.hash;
+
+  game->board = &arena->board;
+  game->history = &arena->history;
+  game->draw_offer = NO_OFFER;
+  game->table_megabytes = 16;
+  game_update_status(game);
+  return game;
+}
+
+// Releases whatever the arena's game allocated, leaving the arena ready for
+// the next start_arena_game.
+void finish_arena_game(game_arena_t *arena) {
+  game_t *game = &arena->game;
+  game_stop_pondering(game);
+
+  if (game->table != NULL) {
+    free_search_table(game->table);
+    game->table = NULL;
+  }
+
+  if (!arena->history.borrowed) {
+    free(arena->history.moves);
+    free(arena->history.hashes);
+    arena->history.borrowed = true;
+  }
+}
+
+void end_game(game_t *game, gameover_t reason, game_result_t result) {
+  game->over = true;
+  game->reason = reason;
+  game->result = result;
+}
+
+// Checks whether the position on the board ends the game and records how.
+// Returns whether the game is over.
+bool game_update_status(game_t *game) {
+  if (game->over) {
+    return true;
+  }
+
+  board_t *board = game->board;
+  piece_color_t color = board->side_to_move;
+
+  if (!has_legal_move(board, color)) {
+    if (board->checkers != 0) {
+      end_game(game, CHECKMATE, color == WHITE ? BLACK_WINS : WHITE_WINS);
+    } else {
+      end_game(game, STALEMATE, DRAWN);
+    }
+  } else if (insufficient_material(board)) {
+    end_game(game, INSUFFICIENT_MATERIAL, DRAWN);
+  } else if (repetitions(game->history, board->fifty_move_rule_counter) >= 2) {
+    end_game(game, THREEFOLD, DRAWN);
+  } else if (board->fifty_move_rule_counter >= 100) {
+    end_game(game, FIFTY_MOVE_RULE, DRAWN);
+  }
+
+  return game->over;
+}
+
+bool game_move_is_legal(game_t *game, move_t move) {
+  move_list_t moves;
+  generate_legal_moves(game->board, game->board->side_to_move, &moves);
+
+  for (int i = 0; i < moves.length; ++i) {
+    if (encode_move(moves.moves[i]) == encode_move(move)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Plays a move for the side to move if it is legal. A draw offer from the
+// opponent lapses once the move is made.
+bool game_play_move(game_t *game, move_t move) {
+  if (game->over || !game_move_is_legal(game, move)) {
+    return false;
+  }
+
+  board_t *board = game->board;
+  piece_color_t color = board->side_to_move;
+  undo_t undo;
+  make_move(board, move, &undo);
+
+  if ((game->draw_offer == WHITE_OFFERED && color == BLACK) ||
+      (game->draw_offer == BLACK_OFFERED && color == WHITE)) {
+    game->draw_offer = NO_OFFER;
+  }
+
+  append_history(game->history, move, board->hash);
+  game_update_status(game);
+  return true;
+}
+
+bool game_play_san(game_t *game, const char *san) {
+  move_t move;
+
+  if (game->over ||
+      !san_to_move(game->board, san, game->board->side_to_move, &move)) {
+    return false;
+  }
+
+  return game_play_move(game, move);
+}
+
+void game_resign(game_t *game) {
+  if (!game->over) {
+    end_game(game, RESIGNATION,
+             game->board->side_to_move == WHITE ? BLACK_WINS : WHITE_WINS);
+  }
+}
+
+// The side to move offers a draw, withdraws its own offer, or accepts the
+// opponent's. Returns whether the game was drawn.
+bool game_offer_draw(game_t *game) {
+  if (game->over) {
+    return false;
+  }
+
+  draw_offer_t own =
+      game->board->side_to_move == WHITE ? WHITE_OFFERED : BLACK_OFFERED;
+
+  if (game->draw_offer == NO_OFFER) {
+    game->draw_offer = own;
+  } else if (game->draw_offer == own) {
+    game->draw_offer = NO_OFFER;
+  } else {
+    end_game(game, DRAW_OFFER, DRAWN);
+  }
+
+  return game->over;
+}
+
+// Returns the current position as a malloc'd FEN string.
+char *game_fen(game_t *game) {
+  return board_to_fen(game->board, game->board->side_to_move);
+}
+
+// Searches the current position with the game's own table, treating
+// repetitions of earlier positions in the game as draws. If the game was
+// pondering this position, that search carries on within the time allowed and
+// its result is returned; otherwise it is stopped, leaving what it found in the
+// table.
+bool game_search(game_t *game, const search_limits_t *limits,
+                 search_result_t *result) {
+  ponder_t *ponder = &game->ponder;
+
+  if (ponder->active && ponder->hash == game->board->hash) {
+    struct timespec start, now;
+    const struct timespec pause = {0, 1000000};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!atomic_load(&ponder->done) &&
+           (limits->stop == NULL || !atomic_load(limits->stop))) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      if (limits->milliseconds > 0 &&
+          (now.tv_sec - start.tv_sec) * 1000 +
+                  (now.tv_nsec - start.tv_nsec) / 1000000 >=
+              limits->milliseconds) {
+        break;
+      }
+
+      nanosleep(&pause, NULL);
+    }
+
+    game_stop_pondering(game);
+
+    if (ponder->found) {
+      *result = ponder->result;
+      return true;
+    }
+  }
+
+  game_stop_pondering(game);
+
+  if (game->table == NULL &&
+      (game->table = create_search_table(game->table_megabytes)) == NULL) {
+    return false;
+  }
+
+  search_limits_t game_limits = *limits;
+  game_limits.history = game->history->hashes;
+  game_limits.history_length = game->history->length;
+  return search(game->board, &game_limits, game->table, result);
+}
+
+void *ponder_thread(void *arg) {
+  ponder_t *ponder = arg;
+  ponder->found =
+      search(ponder->board, &ponder->limits, ponder->table, &ponder->result);
+  atomic_store(&ponder->done, true);
+  return NULL;
+}
+
+// Starts searching, in the background, the position after the side to move
+// plays expected. The search keeps the depth and node limits given but has no
+// time limit: the clock starts when game_search picks it up.
+bool game_ponder(game_t *game, move_t expected, const search_limits_t *limits) {
+  game_stop_pondering(game);
+
+  if (game->over || !game_move_is_legal(game, expected)) {
+    return false;
+  }
+
+  if (game->table == NULL &&
+      (game->table = create_search_table(game->table_megabytes)) == NULL) {
+    return false;
+  }
+
+  ponder_t *ponder = &game->ponder;
+  size_t length = game->history->length + 1;
+  ponder->board = create_board();
+  ponder->history = malloc(length * sizeof(unsigned long long));
+
+  if (!ponder->board || !ponder->history) {
+    free_board(ponder->board);
+    free(ponder->history);
+    return false;
+  }
+
+  undo_t undo;
+  copy_board(ponder->board, game->board);
+  make_move(ponder->board, expected, &undo);
+  ponder->hash = ponder->board->hash;
+  memcpy(ponder->history, game->history->hashes,
+         length * sizeof(unsigned long long));
+
+  ponder->limits = *limits;
+  ponder->limits.milliseconds = 0;
+  ponder->limits.stop = &ponder->stop;
+  ponder->limits.history = ponder->history;
+  ponder->limits.history_length = length;
+  ponder->limits.progress = NULL;
+  ponder->table = game->table;
+  ponder->found = false;
+  atomic_store(&ponder->stop, false);
+  atomic_store(&ponder->done, false);
+
+  if (pthread_create(&ponder->thread, NULL, ponder_thread, ponder) != 0) {
+    free_board(ponder->board);
+    free(ponder->history);
+    return false;
+  }
+
+  ponder->active = true;
+  return true;
+}
+
+void game_stop_pondering(game_t *game) {
+  ponder_t *ponder = &game->ponder;
+
+  if (!ponder->active) {
+    return;
+  }
+
+  atomic_store(&ponder->stop, true);
+  pthread_join(ponder->thread, NULL);
+  free_board(ponder->board);
+  free(ponder->history);
+  ponder->active = false;
+}
@@ -0,0 +1,76 @@
+#include "search.h"
+#include "types.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#pragma once
+#pragma GCC visibility push(default)
+
+// A search of the position after the opponent's expected reply, run on its
+// own board in the background while the opponent thinks. hash identifies the
+// position searched, since board changes as the search runs.
+typedef struct Ponder {
+  bool active;
+  pthread_t thread;
+  board_t *board;
+  unsigned long long hash;
+  unsigned long long *history;
+  search_limits_t limits;
+  search_result_t result;
+  search_table_t *table;
+  atomic_bool stop;
+  atomic_bool done;
+  bool found;
+} ponder_t;
+
+// Everything about one game in progress. Games share no state with each
+// other, so any number can be played at once from different threads.
+typedef struct Game {
+  board_t *board;
+  game_history_t *history;
+  draw_offer_t draw_offer;
+  bool over;
+  gameover_t reason;
+  game_result_t result;
+  // Created by the first game_search, with the size in table_megabytes.
+  search_table_t *table;
+  size_t table_megabytes;
+  ponder_t ponder;
+} game_t;
+
+// Everything a game needs in one block, so that games can be started and
+// finished without touching the heap. Only the first GAME_ARENA_PLIES plies
+// of history fit; longer games move it to the heap.
+#define GAME_ARENA_PLIES 256
+
+typedef struct GameArena {
+  game_t game;
+  board_t board;
+  game_history_t history;
+  unsigned short moves[GAME_ARENA_PLIES];
+  unsigned long long hashes[GAME_ARENA_PLIES + 1];
+} game_arena_t;
+
+game_history_t *init_history(unsigned long long hash);
+void append_history(game_history_t *history, move_t move,
+                    unsigned long long hash);
+int repetitions(game_history_t *history, int reversible_plies);
+void free_history(game_history_t *history);
+
+game_t *create_game(const char *fen);
+void free_game(game_t *game);
+game_t *start_arena_game(game_arena_t *arena, const char *fen);
+void finish_arena_game(game_arena_t *arena);
+bool game_move_is_legal(game_t *game, move_t move);
+bool game_play_move(game_t *game, move_t move);
+bool game_play_san(game_t *game, const char *san);
+bool game_update_status(game_t *game);
+void game_resign(game_t *game);
+bool game_offer_draw(game_t *game);
+char *game_fen(game_t *game);
+bool game_search(game_t *game, const search_limits_t *limits,
+                 search_result_t *result);
+bool game_ponder(game_t *game, move_t expected, const search_limits_t *limits);
+void game_stop_pondering(game_t *game);
+
+#pragma GCC visibility pop
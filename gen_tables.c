@@ -0,0 +1,216 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Writes tables.c, the constant lookup tables declared in tables.h, to
+// standard output. Squares are numbered rank * 8 + file; directions are
+// ordered as in tables.h.
+
+const int direction_ranks[8] = {1, -1, 1, -1, 0, 0, 1, -1};
+const int direction_files[8] = {1, -1, -1, 1, 1, -1, 0, 0};
+
+// The knight and king moves in the order move generation has always tried
+// them.
+int knight_rank_delta(int i) {
+  return (i % 2 == 0 ? 1 : 2) * ((i % 4 < 2) ? 1 : -1);
+}
+
+int knight_file_delta(int i) { return (i % 2 == 0 ? 2 : 1) * (i < 4 ? 1 : -1); }
+
+int king_rank_delta(int i) { return (i < 4 ? i : i + 1) / 3 - 1; }
+
+int king_file_delta(int i) { return (i < 4 ? i : i + 1) % 3 - 1; }
+
+bool on_board(int rank, int file) {
+  return rank >= 0 && rank < 8 && file >= 0 && file < 8;
+}
+
+// Prints count values as an initializer nested to match dims, wrapping the
+// innermost lists to stay within 80 columns.
+void print_values(const unsigned long long *values, const int *dims,
+                  int depth, bool hex, int indent) {
+  int count = 1;
+
+  for (int i = 1; i < depth; ++i) {
+    count *= dims[i];
+  }
+
+  if (depth == 1) {
+    int column = indent;
+    printf("%*s", indent, "");
+
+    for (int i = 0; i < dims[0]; ++i) {
+      char text[32];
+      int length =
+          hex ? snprintf(text, sizeof(text), "0x%016llxULL,", values[i])
+              : snprintf(text, sizeof(text), "%lld,", (long long)values[i]);
+
+      if (i > 0 && column + length + 1 > 80) {
+        printf("\n%*s", indent, "");
+        column = indent;
+      } else if (i > 0) {
+        printf(" ");
+        column++;
+      }
+
+      printf("%s", text);
+      column += length;
+    }
+
+    printf("\n");
+    return;
+  }
+
+  for (int i = 0; i < dims[0]; ++i) {
+    const unsigned long long *row = values + i * count;
+
+    // Short rows go on one line.
+    if (depth == 2 && !hex && indent + 3 + 5 * dims[1] <= 80) {
+      printf("%*s{", indent, "");
+
+      for (int j = 0; j < dims[1]; ++j) {
+        printf(j == 0 ? "%lld" : ", %lld", (long long)row[j]);
+      }
+
+      printf("},\n");
+      continue;
+    }
+
+    printf("%*s{\n", indent, "");
+    print_values(row, dims + 1, depth - 1, hex, indent + 4);
+    printf("%*s},\n", indent, "");
+  }
+}
+
+void print_table(const char *declaration, const unsigned long long *values,
+                 const int *dims, int depth, bool hex) {
+  printf("%s = {\n", declaration);
+  print_values(values, dims, depth, hex, 4);
+  printf("};\n\n");
+}
+
+void print_leaper(const char *name, int (*rank_delta)(int),
+                  int (*file_delta)(int)) {
+  static unsigned long long targets[64 * 8];
+  static unsigned long long counts[64];
+  static unsigned long long attacks[64];
+  char declaration[128];
+
+  for (int square = 0; square < 64; ++square) {
+    counts[square] = 0;
+    attacks[square] = 0;
+
+    for (int i = 0; i < 8; ++i) {
+      targets[square * 8 + i] = 0;
+    }
+
+    for (int i = 0; i < 8; ++i) {
+      int rank = square / 8 + rank_delta(i);
+      int file = square % 8 + file_delta(i);
+
+      if (on_board(rank, file)) {
+        targets[square * 8 + counts[square]++] = rank * 8 + file;
+        attacks[square] |= 1ULL << (rank * 8 + file);
+      }
+    }
+  }
+
+  snprintf(declaration, sizeof(declaration),
+           "const unsigned char %s_targets[64][8]", name);
+  print_table(declaration, targets, (const int[]){64, 8}, 2, false);
+  snprintf(declaration, sizeof(declaration),
+           "const unsigned char %s_target_counts[64]", name);
+  print_table(declaration, counts, (const int[]){64}, 1, false);
+  snprintf(declaration, sizeof(declaration),
+           "const unsigned long long %s_attacks[64]", name);
+  print_table(declaration, attacks, (const int[]){64}, 1, true);
+}
+
+int main(void) {
+  static unsigned long long ray_squares[64 * 8 * 7];
+  static unsigned long long ray_lengths[64 * 8];
+  static unsigned long long ray_masks[64 * 8];
+  static unsigned long long between[64 * 64];
+  static unsigned long long lines[64 * 64];
+  static unsigned long long distances[64 * 64];
+  static unsigned long long directions[64 * 64];
+  static unsigned long long pawn_attacks[2 * 64];
+
+  for (int square = 0; square < 64; ++square) {
+    for (int d = 0; d < 8; ++d) {
+      int length = 0;
+      unsigned long long mask = 0;
+      int rank = square / 8 + direction_ranks[d];
+      int file = square % 8 + direction_files[d];
+
+      for (; on_board(rank, file);
+           rank += direction_ranks[d], file += direction_files[d]) {
+        ray_squares[(square * 8 + d) * 7 + length++] = rank * 8 + file;
+        mask |= 1ULL << (rank * 8 + file);
+      }
+
+      ray_lengths[square * 8 + d] = length;
+      ray_masks[square * 8 + d] = mask;
+    }
+  }
+
+  for (int from = 0; from < 64; ++from) {
+    for (int to = 0; to < 64; ++to) {
+      int ranks = abs(to / 8 - from / 8), files = abs(to % 8 - from % 8);
+      int index = from * 64 + to;
+
+      distances[index] = ranks > files ? ranks : files;
+      directions[index] = (unsigned long long)-1;
+
+      for (int d = 0; d < 8; ++d) {
+        if (ray_masks[from * 8 + d] >> to & 1) {
+          directions[index] = d;
+          // The opposite direction is the one with the other parity.
+          lines[index] = ray_masks[from * 8 + d] |
+                         ray_masks[from * 8 + (d ^ 1)] | 1ULL << from;
+
+          const unsigned long long *ray = &ray_squares[(from * 8 + d) * 7];
+
+          for (int i = 0; ray[i] != (unsigned long long)to; ++i) {
+            between[index] |= 1ULL << ray[i];
+          }
+        }
+      }
+    }
+  }
+
+  for (int square = 0; square < 64; ++square) {
+    for (int color = 0; color < 2; ++color) {
+      int rank = square / 8 + (color == 0 ? 1 : -1);
+
+      for (int file = square % 8 - 1; file <= square % 8 + 1; file += 2) {
+        if (on_board(rank, file)) {
+          pawn_attacks[color * 64 + square] |= 1ULL << (rank * 8 + file);
+        }
+      }
+    }
+  }
+
+  printf("// Generated by gen_tables.c; do not edit.\n\n");
+  printf("#include \"tables.h\"\n\n");
+  print_leaper("knight", knight_rank_delta, knight_file_delta);
+  print_leaper("king", king_rank_delta, king_file_delta);
+  print_table("const unsigned long long pawn_attacks[2][64]", pawn_attacks,
+              (const int[]){2, 64}, 2, true);
+  print_table("const unsigned char ray_squares[64][8][7]", ray_squares,
+              (const int[]){64, 8, 7}, 3, false);
+  print_table("const unsigned char ray_lengths[64][8]", ray_lengths,
+              (const int[]){64, 8}, 2, false);
+  print_table("const unsigned long long ray_masks[64][8]", ray_masks,
+              (const int[]){64, 8}, 2, true);
+  print_table("const unsigned long long between_masks[64][64]", between,
+              (const int[]){64, 64}, 2, true);
+  print_table("const unsigned long long line_masks[64][64]", lines,
+              (const int[]){64, 64}, 2, true);
+  print_table("const unsigned char square_distances[64][64]", distances,
+              (const int[]){64, 64}, 2, false);
+  print_table("const signed char square_directions[64][64]", directions,
+              (const int[]){64, 64}, 2, false);
+
+  return 0;
+}
@@ -1,9 +1,48 @@
 #include "can_move.h"
+#include "legal_moves.h"
+#include "stats.h"
+#include "tables.h"
 #include "types.h"
 #include <stdbool.h>
 #include <stdlib.h>
 
+unsigned long long square_bit(square_t *square) {
+  return 1ULL << (square->rank * 8 + square->file);
+}
+
+// A pawn attacks diagonally whether or not the square is occupied, unlike
+// can_move, which follows its pushes; the other pieces attack the squares
+// they could move to.
+bool piece_attacks(board_t *board, piece_t *piece, square_t *square) {
+  int from = piece->square->rank * 8 + piece->square->file;
+  int to = square->rank * 8 + square->file;
+
+  if (piece->type != PAWN && square->piece != NULL &&
+      square->piece->color == piece->color) {
+    return false;
+  }
+
+  switch (piece->type) {
+  case PAWN:
+    return pawn_attacks[piece->color][from] >> to & 1;
+  case KNIGHT:
+    return knight_attacks[from] >> to & 1;
+  case BISHOP:
+    return slider_can_move(board, from, to, 0, 4);
+  case ROOK:
+    return slider_can_move(board, from, to, 4, 8);
+  case QUEEN:
+    return slider_can_move(board, from, to, 0, 8);
+  case KING:
+    return king_attacks[from] >> to & 1;
+  }
+
+  return false;
+}
+
 bool square_attacked(board_t *board, square_t *square, piece_color_t color) {
+  STATS_ENTER();
+
   for (int i = 0; i < 8; ++i) {
     for (int j = 0; j < 8; ++j) {
       piece_t *piece = board->squares[i][j].piece;
@@ -16,25 +55,120 @@ bool square_attacked(board_t *board, square_t *square, piece_color_t color) {
         continue;
       }
 
-      if (can_move(board, piece, square)) {
-        return true;
+      if (piece_attacks(board, piece, square)) {
+        return STATS_RETURN(STAT_SQUARE_ATTACKED, true);
       }
     }
   }
 
-  return false;
+  return STATS_RETURN(STAT_SQUARE_ATTACKED, false);
 }
 
 bool is_in_check(board_t *board, piece_color_t color) {
-  return (color == WHITE &&
-          square_attacked(board, board->white_king->square, BLACK)) ||
-         (color == BLACK &&
-          square_attacked(board, board->black_king->square, WHITE));
+  STATS_ENTER();
+
+  bool in_check =
+      (color == WHITE &&
+       square_attacked(board, board->white_king->square, BLACK)) ||
+      (color == BLACK &&
+       square_attacked(board, board->black_king->square, WHITE));
+
+  return STATS_RETURN(STAT_IS_IN_CHECK, in_check);
+}
+
+// Scans the whole board for the pieces checking board->side_to_move.
+unsigned long long compute_checkers(board_t *board) {
+  piece_color_t color = board->side_to_move;
+  piece_t *king = color == WHITE ? board->white_king : board->black_king;
+  unsigned long long checkers = 0;
+
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      piece_t *piece = board->squares[i][j].piece;
+
+      if (piece != NULL && piece->color != color &&
+          piece_attacks(board, piece, king->square)) {
+        checkers |= square_bit(piece->square);
+      }
+    }
+  }
+
+  return checkers;
+}
+
+// Returns the slider of the given colour (if any) that now attacks target
+// along the line through the just-vacated square through.
+unsigned long long discovered_checker(board_t *board, square_t *target,
+                                      square_t *through, piece_color_t color) {
+  int from = target->rank * 8 + target->file;
+  int direction = square_directions[from][through->rank * 8 + through->file];
+
+  if (direction < 0) {
+    return 0;
+  }
+
+  piece_type_t slider = direction < 4 ? BISHOP : ROOK;
+  const unsigned char *ray = ray_squares[from][direction];
+
+  for (int i = 0; i < ray_lengths[from][direction]; ++i) {
+    piece_t *piece = board->squares[ray[i] / 8][ray[i] % 8].piece;
+
+    if (piece == NULL) {
+      continue;
+    }
+
+    if (piece->color == color &&
+        (piece->type == slider || piece->type == QUEEN)) {
+      return square_bit(piece->square);
+    }
+
+    return 0;
+  }
+
+  return 0;
+}
+
+// Works out which pieces check the opponent after piece has moved from
+// `from`, looking only at the moved pieces and the lines they uncovered.
+// vacated is the square of a pawn taken en passant and rook the rook moved
+// by castling; either may be NULL.
+unsigned long long checkers_after_move(board_t *board, piece_t *piece,
+                                       square_t *from, square_t *vacated,
+                                       piece_t *rook) {
+  piece_t *king =
+      piece->color == WHITE ? board->black_king : board->white_king;
+  unsigned long long checkers = 0;
+
+  if (piece_attacks(board, piece, king->square)) {
+    checkers |= square_bit(piece->square);
+  }
+
+  if (rook != NULL && piece_attacks(board, rook, king->square)) {
+    checkers |= square_bit(rook->square);
+  }
+
+  checkers |= discovered_checker(board, king->square, from, piece->color);
+
+  if (vacated != NULL) {
+    checkers |= discovered_checker(board, king->square, vacated, piece->color);
+  }
+
+  return checkers;
 }
 
 bool is_legal_move(board_t *board, piece_t *piece, square_t *square) {
+  STATS_ENTER();
+
   if (!can_move(board, piece, square)) {
-    return false;
+    return STATS_RETURN(STAT_IS_LEGAL_MOVE, false);
+  }
+
+  piece_t *enpassant_capture = NULL;
+
+  if (piece->type == PAWN && square->piece == NULL &&
+      square->file != piece->square->file) {
+    enpassant_capture = board->enpassantable_pawn;
+    enpassant_capture->square->piece = NULL;
   }
 
   piece->square->piece = NULL;
@@ -49,106 +183,123 @@ bool is_legal_move(board_t *board, piece_t *piece, square_t *square) {
   square->piece = prev_piece;
   piece->square->piece = piece;
 
-  return !in_check;
+  if (enpassant_capture != NULL) {
+    enpassant_capture->square->piece = enpassant_capture;
+  }
+
+  return STATS_RETURN(STAT_IS_LEGAL_MOVE, !in_check);
 }
 
-bool has_legal_move_from_deltas(board_t *board, piece_t *piece,
-                                int (*get_rank_delta)(int),
-                                int (*get_file_delta)(int), int num_moves) {
-  for (int i = 0; i < num_moves; ++i) {
-    int new_rank = piece->square->rank + get_rank_delta(i);
-    if (new_rank < 0 || new_rank > 7) {
-      continue;
-    }
+// Returns whether the piece can legally move to the square. When moves is
+// non-NULL the move is also appended to it (once per promotion choice).
+bool try_legal_move(board_t *board, piece_t *piece, square_t *square,
+                    move_list_t *moves) {
+  if (!is_legal_move(board, piece, square)) {
+    return false;
+  }
 
-    int new_file = piece->square->file + get_file_delta(i);
-    if (new_file < 0 || new_file > 7) {
-      continue;
+  if (moves == NULL) {
+    return true;
+  }
+
+  move_t move = {piece->square->rank, piece->square->file, square->rank,
+                 square->file, PAWN};
+
+  if (piece->type == PAWN && (square->rank == 0 || square->rank == 7)) {
+    const piece_type_t promotions[4] = {QUEEN, ROOK, BISHOP, KNIGHT};
+
+    for (int i = 0; i < 4; ++i) {
+      move.promotion = promotions[i];
+      moves->moves[moves->length++] = move;
     }
 
-    if (is_legal_move(board, piece, &board->squares[new_rank][new_file])) {
-      return true;
+    return true;
+  }
+
+  moves->moves[moves->length++] = move;
+  return true;
+}
+
+// The per-piece functions below stop at the first legal move when moves is
+// NULL, and otherwise collect every legal move into it.
+bool has_legal_move_to_targets(board_t *board, piece_t *piece,
+                               const unsigned char *targets, int count,
+                               move_list_t *moves) {
+  bool found = false;
+
+  for (int i = 0; i < count; ++i) {
+    if (try_legal_move(board, piece,
+                       &board->squares[targets[i] / 8][targets[i] % 8],
+                       moves)) {
+      found = true;
+
+      if (moves == NULL) {
+        return true;
+      }
     }
   }
 
-  return false;
+  return found;
 }
 
-bool pawn_has_legal_move(board_t *board, piece_t *pawn) {
+bool pawn_has_legal_move(board_t *board, piece_t *pawn, move_list_t *moves) {
   int rank = pawn->square->rank;
   int file = pawn->square->file;
   int direction = pawn->color == WHITE ? 1 : -1;
+  bool found = false;
 
-  if (is_legal_move(board, pawn, &board->squares[rank + direction][file])) {
-    return true;
+  if (try_legal_move(board, pawn, &board->squares[rank + direction][file],
+                     moves)) {
+    found = true;
   }
 
-  if (!pawn->has_moved &&
-      is_legal_move(board, pawn, &board->squares[rank + 2 * direction][file])) {
-    return true;
+  if (!pawn->has_moved && (moves != NULL || !found) &&
+      try_legal_move(board, pawn, &board->squares[rank + 2 * direction][file],
+                     moves)) {
+    found = true;
   }
 
-  if (file != 0 &&
-      is_legal_move(board, pawn, &board->squares[rank + direction][file - 1])) {
-    return true;
+  if (file != 0 && (moves != NULL || !found) &&
+      try_legal_move(board, pawn,
+                     &board->squares[rank + direction][file - 1], moves)) {
+    found = true;
   }
 
-  if (file != 7 &&
-      is_legal_move(board, pawn, &board->squares[rank + direction][file + 1])) {
-    return true;
+  if (file != 7 && (moves != NULL || !found) &&
+      try_legal_move(board, pawn,
+                     &board->squares[rank + direction][file + 1], moves)) {
+    found = true;
   }
 
-  return false;
+  return found;
 }
 
-int get_knight_rank_delta(int i) {
-  return (i % 2 == 0 ? 1 : 2) * ((i % 4 < 2) ? 1 : -1);
-}
-int get_knight_file_delta(int i) {
-  return (i % 2 == 0 ? 2 : 1) * (i < 4 ? 1 : -1);
+bool knight_has_legal_move(board_t *board, piece_t *knight,
+                           move_list_t *moves) {
+  int from = knight->square->rank * 8 + knight->square->file;
+  return has_legal_move_to_targets(board, knight, knight_targets[from],
+                                   knight_target_counts[from], moves);
 }
 
-bool knight_has_legal_move(board_t *board, piece_t *knight) {
-  return has_legal_move_from_deltas(board, knight, get_knight_rank_delta,
-                                    get_knight_file_delta, 8);
-}
+// Follows the rays in directions first to first + 3 (the diagonals from 0,
+// the ranks and files from 4) up to and including the first occupied square.
+bool slider_has_legal_move(board_t *board, piece_t *piece, int first,
+                           move_list_t *moves) {
+  int from = piece->square->rank * 8 + piece->square->file;
+  bool found = false;
 
-bool bishop_has_legal_move(board_t *board, piece_t *bishop) {
-  int rank = bishop->square->rank;
-  int file = bishop->square->file;
+  for (int d = first; d < first + 4; ++d) {
+    const unsigned char *ray = ray_squares[from][d];
 
-  for (int d = 0; d < 4; ++d) {
-    for (int i = 1; i < 8; ++i) {
-      square_t *square;
+    for (int i = 0; i < ray_lengths[from][d]; ++i) {
+      square_t *square = &board->squares[ray[i] / 8][ray[i] % 8];
 
-      if (d == 0) {
-        if (file + i > 7 || rank + i > 7) {
-          break;
-        }
+      if (try_legal_move(board, piece, square, moves)) {
+        found = true;
 
-        square = &board->squares[rank + i][file + i];
-      } else if (d == 1) {
-        if (file - i < 0 || rank - i < 0) {
-          break;
+        if (moves == NULL) {
+          return true;
         }
-
-        square = &board->squares[rank - i][file - i];
-      } else if (d == 2) {
-        if (rank + i > 7 || file - i < 0) {
-          break;
-        }
-
-        square = &board->squares[rank + i][file - i];
-      } else if (d == 3) {
-        if (rank - i < 0 || file + i > 7) {
-          break;
-        }
-
-        square = &board->squares[rank - i][file + i];
-      }
-
-      if (is_legal_move(board, bishop, square)) {
-        return true;
       }
 
       if (square->piece != NULL) {
@@ -157,70 +308,103 @@ bool bishop_has_legal_move(board_t *board, piece_t *bishop) {
     }
   }
 
-  return false;
+  return found;
 }
 
-bool rook_has_legal_move(board_t *board, piece_t *rook) {
-  int rank = rook->square->rank;
-  int file = rook->square->file;
+bool bishop_has_legal_move(board_t *board, piece_t *bishop,
+                           move_list_t *moves) {
+  return slider_has_legal_move(board, bishop, 0, moves);
+}
 
-  for (int d = 0; d < 4; ++d) {
-    for (int i = 1; i < 8; ++i) {
-      square_t *square;
+bool rook_has_legal_move(board_t *board, piece_t *rook, move_list_t *moves) {
+  return slider_has_legal_move(board, rook, 4, moves);
+}
 
-      if (d == 0) {
-        if (file + i > 7) {
-          break;
-        }
+bool queen_has_legal_move(board_t *board, piece_t *queen,
+                          move_list_t *moves) {
+  if (moves == NULL) {
+    return bishop_has_legal_move(board, queen, NULL) ||
+           rook_has_legal_move(board, queen, NULL);
+  }
 
-        square = &board->squares[rank][file + i];
-      } else if (d == 1) {
-        if (file - i < 0) {
-          break;
-        }
+  bool diagonal = bishop_has_legal_move(board, queen, moves);
+  bool straight = rook_has_legal_move(board, queen, moves);
+  return diagonal || straight;
+}
 
-        square = &board->squares[rank][file - i];
-      } else if (d == 2) {
-        if (rank + i > 7) {
-          break;
-        }
+// Castling never has to be considered when only asking whether a legal move
+// exists: whenever it is legal, so is the king's single step towards the rook.
+void add_castling_moves(board_t *board, piece_t *king, move_list_t *moves) {
+  int rank = king->color == WHITE ? 0 : 7;
 
-        square = &board->squares[rank + i][file];
-      } else if (d == 3) {
-        if (rank - i < 0) {
-          break;
-        }
+  if (king->has_moved || king->square != &board->squares[rank][4] ||
+      is_in_check(board, king->color)) {
+    return;
+  }
 
-        square = &board->squares[rank - i][file];
-      }
+  piece_color_t attacker = king->color == WHITE ? BLACK : WHITE;
+  piece_t *short_rook = board->squares[rank][7].piece;
+  piece_t *long_rook = board->squares[rank][0].piece;
+
+  if (short_rook != NULL && short_rook->type == ROOK &&
+      short_rook->color == king->color && !short_rook->has_moved &&
+      board->squares[rank][5].piece == NULL &&
+      board->squares[rank][6].piece == NULL &&
+      !square_attacked(board, &board->squares[rank][5], attacker) &&
+      !square_attacked(board, &board->squares[rank][6], attacker)) {
+    move_t move = {rank, 4, rank, 6, PAWN};
+    moves->moves[moves->length++] = move;
+  }
 
-      if (is_legal_move(board, rook, square)) {
-        return true;
-      }
+  if (long_rook != NULL && long_rook->type == ROOK &&
+      long_rook->color == king->color && !long_rook->has_moved &&
+      board->squares[rank][1].piece == NULL &&
+      board->squares[rank][2].piece == NULL &&
+      board->squares[rank][3].piece == NULL &&
+      !square_attacked(board, &board->squares[rank][2], attacker) &&
+      !square_attacked(board, &board->squares[rank][3], attacker)) {
+    move_t move = {rank, 4, rank, 2, PAWN};
+    moves->moves[moves->length++] = move;
+  }
+}
 
-      if (square->piece != NULL) {
-        break;
-      }
-    }
+bool king_has_legal_move(board_t *board, piece_t *king, move_list_t *moves) {
+  int from = king->square->rank * 8 + king->square->file;
+  bool found = has_legal_move_to_targets(board, king, king_targets[from],
+                                         king_target_counts[from], moves);
+
+  if (moves != NULL) {
+    add_castling_moves(board, king, moves);
   }
 
-  return false;
+  return found;
 }
 
-bool queen_has_legal_move(board_t *board, piece_t *queen) {
-  return bishop_has_legal_move(board, queen) ||
-         rook_has_legal_move(board, queen);
+bool piece_has_legal_move(board_t *board, piece_t *piece, move_list_t *moves) {
+  switch (piece->type) {
+  case PAWN:
+    return pawn_has_legal_move(board, piece, moves);
+  case KNIGHT:
+    return knight_has_legal_move(board, piece, moves);
+  case BISHOP:
+    return bishop_has_legal_move(board, piece, moves);
+  case ROOK:
+    return rook_has_legal_move(board, piece, moves);
+  case QUEEN:
+    return queen_has_legal_move(board, piece, moves);
+  case KING:
+    return king_has_legal_move(board, piece, moves);
+  }
+
+  return false;
 }
 
-int get_king_rank_delta(int i) { return (i < 4 ? i : i + 1) / 3 - 1; }
-int get_king_file_delta(int i) { return (i < 4 ? i : i + 1) % 3 - 1; }
+void generate_legal_moves(board_t *board, piece_color_t color,
+                          move_list_t *moves) {
+  STATS_ENTER();
 
-bool king_has_legal_move(board_t *board, piece_t *king) {
-  return has_legal_move_from_deltas(board, king, get_king_rank_delta,
-                                    get_king_file_delta, 8);
-}
+  moves->length = 0;
 
-bool has_legal_move(board_t *board, piece_color_t color) {
   for (int i = 0; i < 8; ++i) {
     for (int j = 0; j < 8; ++j) {
       piece_t *piece = board->squares[i][j].piece;
@@ -228,71 +412,44 @@ bool has_legal_move(board_t *board, piece_color_t color) {
         continue;
       }
 
-      bool res;
+      piece_has_legal_move(board, piece, moves);
+    }
+  }
 
-      switch (piece->type) {
-      case PAWN:
-        res = pawn_has_legal_move(board, piece);
-        break;
-      case KNIGHT:
-        res = knight_has_legal_move(board, piece);
-        break;
-      case BISHOP:
-        res = bishop_has_legal_move(board, piece);
-        break;
-      case ROOK:
-        res = rook_has_legal_move(board, piece);
-        break;
-      case QUEEN:
-        res = queen_has_legal_move(board, piece);
-        break;
-      case KING:
-        res = king_has_legal_move(board, piece);
-        break;
+  STATS_LEAVE(STAT_GENERATE_LEGAL_MOVES);
+}
+
+bool has_legal_move(board_t *board, piece_color_t color) {
+  STATS_ENTER();
+
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      piece_t *piece = board->squares[i][j].piece;
+      if (piece == NULL || piece->color != color) {
+        continue;
       }
 
-      if (res) {
-        return true;
+      if (piece_has_legal_move(board, piece, NULL)) {
+        return STATS_RETURN(STAT_HAS_LEGAL_MOVE, true);
       }
     }
   }
 
-  return false;
+  return STATS_RETURN(STAT_HAS_LEGAL_MOVE, false);
 }
 
+// Each side has at most a knight or two, or a single bishop.
 bool insufficient_material(board_t *board) {
-  bool hasKnight[2] = {false, false};
-  bool hasBishop[2] = {false, false};
+  STATS_ENTER();
 
-  for (int i = 0; i < 8; i++) {
-    for (int j = 0; j < 8; j++) {
-      piece_t *piece = board->squares[i][j].piece;
-      if (piece == NULL) {
-        continue;
-      }
+  for (int color = WHITE; color <= BLACK; ++color) {
+    int *counts = board->piece_counts[color];
 
-      switch (piece->type) {
-      case PAWN:
-      case ROOK:
-      case QUEEN:
-        return false;
-      case KNIGHT:
-        if (hasBishop[piece->color]) {
-          return false;
-        }
-        hasKnight[piece->color] = true;
-        break;
-      case BISHOP:
-        if (hasKnight[piece->color] || hasBishop[piece->color]) {
-          return false;
-        }
-        hasBishop[piece->color] = true;
-        break;
-      case KING:
-        break;
-      }
+    if (counts[PAWN] > 0 || counts[ROOK] > 0 || counts[QUEEN] > 0 ||
+        counts[BISHOP] > 1 || (counts[BISHOP] == 1 && counts[KNIGHT] > 0)) {
+      return STATS_RETURN(STAT_INSUFFICIENT_MATERIAL, false);
     }
   }
 
-  return true;
+  return STATS_RETURN(STAT_INSUFFICIENT_MATERIAL, true);
 }
@@ -1,9 +1,18 @@
 #include "types.h"
 
 #pragma once
+#pragma GCC visibility push(default)
 
 bool square_attacked(board_t *board, square_t *square, piece_color_t color);
 bool is_in_check(board_t *board, piece_color_t color);
+unsigned long long compute_checkers(board_t *board);
+unsigned long long checkers_after_move(board_t *board, piece_t *piece,
+                                       square_t *from, square_t *vacated,
+                                       piece_t *rook);
 bool is_legal_move(board_t *board, piece_t *piece, square_t *square);
 bool has_legal_move(board_t *board, piece_color_t color);
+void generate_legal_moves(board_t *board, piece_color_t color,
+                          move_list_t *moves);
 bool insufficient_material(board_t *board);
+
+#pragma GCC visibility pop
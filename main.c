@@ -1,6 +1,12 @@
+#include "analysis.h"
+#include "batch.h"
 #include "board.h"
-#include "legal_moves.h"
+#include "game.h"
 #include "move_piece.h"
+#include "search.h"
+#include "server.h"
+#include "stats.h"
+#include "telemetry.h"
 #include "types.h"
 #include <regex.h>
 #include <stdbool.h>
@@ -8,52 +14,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-fen_array_t *init_fen_array() {
-  fen_array_t *arr = malloc(sizeof(fen_array_t));
-
-  if (!arr) {
-    return NULL;
-  }
-
-  arr->fens = NULL;
-  arr->length = 0;
-  arr->capacity = 0;
-  return arr;
-}
-
-void append_fen(fen_array_t *arr, char *str) {
-  if (arr->length == arr->capacity) {
-    size_t new_capacity = arr->capacity == 0 ? 4 : arr->capacity * 2;
-    char **new_fens = realloc(arr->fens, new_capacity * sizeof(char *));
-
-    if (!new_fens) {
-      return;
-    }
-
-    arr->fens = new_fens;
-    arr->capacity = new_capacity;
-  }
-
-  arr->fens[arr->length] = malloc(strlen(str) + 1);
-
-  if (!arr) {
-    return;
-  }
-
-  strcpy(arr->fens[arr->length], str);
-  arr->length++;
-}
-
-void free_fen_array(fen_array_t *arr) {
-  for (size_t i = 0; i < arr->length; i++) {
-    free(arr->fens[i]);
-  }
-
-  free(arr->fens);
-  arr->fens = NULL;
-  arr->length = arr->capacity = 0;
-}
-
 bool is_valid_san(const char *move) {
   const char *pattern =
       "^(O-O(-O)?|([KQRBN]?[a-h]?[1-8]?x?[a-h][1-8](=[QRBN])?[+#]?))$";
@@ -70,7 +30,8 @@ bool is_valid_san(const char *move) {
   return status == 0;
 }
 
-void game_over(gameover_t type, piece_color_t color) {
+void announce_game_over(gameover_t type, piece_color_t color,
+                        stats_t *stats) {
   switch (type) {
   case CHECKMATE:
     printf("CHECKMATE! %s WINS!", color == WHITE ? "WHITE" : "BLACK");
@@ -98,6 +59,10 @@ void game_over(gameover_t type, piece_color_t color) {
 
   printf("\n");
 
+  if (stats != NULL) {
+    stats_print(stdout, stats);
+  }
+
   while (true) {
     char choice;
     printf("Do you want to play again? (y/n): ");
@@ -110,63 +75,298 @@ void game_over(gameover_t type, piece_color_t color) {
   }
 }
 
-int main(void) {
-  board_t *board;
-  draw_offer_t draw_offer;
-  piece_color_t color_to_move;
-  fen_array_t *fen_array;
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--stats] [--telemetry FILE] [--batch [--threads N]\n"
+          "         [--multipv N [--movetime MS]]]\n"
+          "       %s [--stats] --computer white|black [--movetime MS] "
+          "[--no-ponder]\n"
+          "         [--multipv N] [--analyse PGN]\n"
+          "       %s --server SOCKET [--max-games N]\n",
+          program, program, program);
+}
+
+// Plays the computer's move and, unless pondering is off, starts thinking
+// about the position after the reply it expects. The move is written to san.
+bool play_computer_move(game_t *game, const search_limits_t *limits,
+                        bool ponder, char *san) {
+  search_result_t result;
+
+  if (!game_search(game, limits, &result)) {
+    return false;
+  }
+
+  move_to_san(game->board, result.best_move, san);
+  game_play_move(game, result.best_move);
+
+  if (ponder && !game->over && result.pv_length >= 2) {
+    game_ponder(game, result.pv[1], limits);
+  }
+
+  return true;
+}
+
+// Prints the best lines for the side to move, in SAN with scores from its
+// side. The hint is searched on a board and table of its own, so that the
+// computer goes on pondering its reply meanwhile.
+bool print_hint(game_t *game, const search_limits_t *limits) {
+  search_result_t *result = malloc(sizeof(search_result_t));
+  search_table_t *table = create_search_table(game->table_megabytes);
+  board_t *root = create_board();
+  search_limits_t hint_limits = *limits;
+  hint_limits.history = game->history->hashes;
+  hint_limits.history_length = game->history->length;
+
+  if (root != NULL) {
+    copy_board(root, game->board);
+  }
+
+  bool found = result != NULL && table != NULL && root != NULL &&
+               search(root, &hint_limits, table, result);
+
+  if (table != NULL) {
+    free_search_table(table);
+  }
+
+  free_board(root);
+
+  if (!found) {
+    free(result);
+    return false;
+  }
+
+  printf("Depth %d:\n", result->depth);
+
+  for (int i = 0; i < result->line_count; ++i) {
+    const search_line_t *line = &result->lines[i];
+    board_t *board = create_board();
+    char score[16];
+
+    if (board == NULL) {
+      break;
+    }
+
+    copy_board(board, game->board);
+    format_score(line->score, score, sizeof(score));
+    printf("%d. %6s ", i + 1, score);
+
+    for (int j = 0; j < line->pv_length && j < 8; ++j) {
+      char san[10];
+      undo_t undo;
+      move_to_san(board, line->pv[j], san);
+      make_move(board, line->pv[j], &undo);
+      printf(" %s", san);
+    }
+
+    printf("\n");
+    free_board(board);
+  }
+
+  free(result);
+  return true;
+}
+
+// Appends the finished game to path as PGN, with each move evaluated and
+// marked by analyse_game.
+void save_analysis(game_t *game, const char *path, telemetry_t *telemetry) {
+  const char tags[] = "Event\0Terminal Chess\0";
+  size_t plies = game->history->length;
+  unsigned char *encoded = malloc(2 * plies + 1);
+  move_analysis_t *moves = malloc(plies * sizeof(move_analysis_t) + 1);
+  thread_pool_t *pool = create_thread_pool(0);
+  search_table_t *table = create_search_table(64);
+  search_limits_t limits = {.milliseconds = 200, .telemetry = telemetry};
+  unsigned long long nodes;
+  FILE *file = fopen(path, "a");
+
+  printf("Analysing the game...\n");
+  fflush(stdout);
+
+  for (size_t i = 0; encoded != NULL && i < plies; ++i) {
+    encoded[2 * i] = game->history->moves[i] & 0xff;
+    encoded[2 * i + 1] = game->history->moves[i] >> 8;
+  }
+
+  archive_game_t record = {.tags = tags,
+                           .tags_length = sizeof(tags) - 1,
+                           .fen = "",
+                           .result = game->result,
+                           .moves = encoded,
+                           .ply_count = plies};
+
+  if (encoded == NULL || moves == NULL || pool == NULL || table == NULL ||
+      file == NULL ||
+      !analyse_game(&record, pool, table, &limits, game->board->stats, moves,
+                    &nodes) ||
+      !write_analysed_game(file, &record, moves)) {
+    printf("Could not write the analysis to %s\n", path);
+  } else {
+    printf("Analysis written to %s\n", path);
+  }
+
+  if (file != NULL) {
+    fclose(file);
+  }
+
+  if (table != NULL) {
+    free_search_table(table);
+  }
+
+  if (pool != NULL) {
+    free_thread_pool(pool);
+  }
+
+  free(encoded);
+  free(moves);
+}
+
+int main(int argc, char **argv) {
+  bool batch = false;
+  const char *analysis_path = NULL;
+  const char *telemetry_path = NULL;
+  const char *server_path = NULL;
+  int max_games = 0;
+  bool show_stats = false;
+  stats_t stats = {0};
+  int threads = 0;
+  bool computer = false;
+  piece_color_t computer_color = BLACK;
+  bool ponder = true;
+  search_limits_t limits = {0};
+  limits.milliseconds = 2000;
+  int multipv = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--batch") == 0) {
+      batch = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--computer") == 0 && i + 1 < argc &&
+               (strcmp(argv[i + 1], "white") == 0 ||
+                strcmp(argv[i + 1], "black") == 0)) {
+      computer = true;
+      computer_color = strcmp(argv[++i], "white") == 0 ? WHITE : BLACK;
+    } else if (strcmp(argv[i], "--movetime") == 0 && i + 1 < argc) {
+      limits.milliseconds = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+      server_path = argv[++i];
+    } else if (strcmp(argv[i], "--max-games") == 0 && i + 1 < argc) {
+      max_games = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--analyse") == 0 && i + 1 < argc) {
+      analysis_path = argv[++i];
+    } else if (strcmp(argv[i], "--multipv") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) >= 1 && atoi(argv[i + 1]) <= MAX_MULTIPV) {
+      multipv = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+      telemetry_path = argv[++i];
+    } else if (strcmp(argv[i], "--no-ponder") == 0) {
+      ponder = false;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (telemetry_path != NULL &&
+      (limits.telemetry = open_telemetry(telemetry_path)) == NULL) {
+    fprintf(stderr, "Could not open %s\n", telemetry_path);
+    return 1;
+  }
+
+  if (server_path != NULL) {
+    return run_server(server_path, max_games);
+  }
+
+  if (batch) {
+    search_limits_t batch_limits = limits;
+    batch_limits.multipv = multipv;
+    int res = run_batch(threads, multipv > 0 ? &batch_limits : NULL,
+                        show_stats ? &stats : NULL);
+
+    if (show_stats) {
+      stats_print(stderr, &stats);
+    }
+
+    return res;
+  }
+
+  game_t *game;
+  renderer_t renderer;
   bool illegal_move_made;
-  bool drawn_by_threefold;
+  bool stats_requested;
+  bool hint_requested;
+  char computer_move[10];
 
 game_loop:
-  board = create_board();
+  game = create_game(NULL);
 
-  if (board == NULL) {
+  if (game == NULL) {
     return 1;
   }
 
-  draw_offer = NO_OFFER;
-  color_to_move = WHITE;
-  fen_array = init_fen_array();
+  game->board->stats = show_stats ? &stats : NULL;
   illegal_move_made = false;
-  drawn_by_threefold = false;
+  stats_requested = false;
+  hint_requested = false;
+  computer_move[0] = '\0';
+  reset_renderer(&renderer);
 
   while (true) {
-    print_board(board);
+    board_t *board = game->board;
+    piece_color_t color_to_move = board->side_to_move;
+    bool in_check = board->checkers != 0;
+    piece_t *king =
+        color_to_move == WHITE ? board->white_king : board->black_king;
 
-    bool in_check = is_in_check(board, color_to_move);
-    piece_color_t opposite_color = color_to_move == WHITE ? BLACK : WHITE;
+    print_board(&renderer, board, in_check ? king : NULL);
 
     if (illegal_move_made) {
       printf("\033[0;31mEnter a legal move!\033[0m\n");
       illegal_move_made = false;
     }
 
-    if (!has_legal_move(board, color_to_move)) {
-      game_over(in_check ? CHECKMATE : STALEMATE, opposite_color);
-      break;
+    if (computer_move[0] != '\0') {
+      printf("Computer played %s\n", computer_move);
     }
 
-    if (insufficient_material(board)) {
-      game_over(INSUFFICIENT_MATERIAL, opposite_color);
-      break;
+    if (stats_requested) {
+      stats_print(stdout, &stats);
+      stats_requested = false;
     }
 
-    if (drawn_by_threefold) {
-      game_over(THREEFOLD, opposite_color);
-      break;
+    if (hint_requested) {
+      search_limits_t hint_limits = limits;
+      hint_limits.multipv = multipv > 0 ? multipv : 3;
+      printf("Thinking...\n");
+      fflush(stdout);
+      print_hint(game, &hint_limits);
+      hint_requested = false;
     }
 
-    if (board->fifty_move_rule_counter >= 100) {
-      game_over(FIFTY_MOVE_RULE, opposite_color);
+    if (game->over) {
       break;
     }
 
+    // The computer declines draw offers by playing on.
+    if (computer && color_to_move == computer_color) {
+      printf("Thinking...\n");
+      fflush(stdout);
+      if (!play_computer_move(game, &limits, ponder, computer_move)) {
+        free_game(game);
+        return 1;
+      }
+
+      continue;
+    }
+
+    draw_offer_t draw_offer = game->draw_offer;
     bool have_active_draw_offer =
         (color_to_move == WHITE && draw_offer == WHITE_OFFERED) ||
         (color_to_move == BLACK && draw_offer == BLACK_OFFERED);
 
-    printf("Enter a move for %s (r to resign, d to %s): ",
+    printf("Enter a move for %s (h for a hint, r to resign, d to %s): ",
            color_to_move == WHITE ? "white" : "black",
            draw_offer == NO_OFFER   ? "offer a draw"
            : have_active_draw_offer ? "cancel draw offer"
@@ -175,57 +375,42 @@ game_loop:
     scanf("%9s", move);
 
     if (strcmp(move, "r") == 0) {
-      game_over(RESIGNATION, opposite_color);
+      game_resign(game);
       break;
     }
 
-    if (strcmp(move, "d") == 0) {
-      if (draw_offer == NO_OFFER) {
-        draw_offer = color_to_move == WHITE ? WHITE_OFFERED : BLACK_OFFERED;
-      } else if (have_active_draw_offer) {
-        draw_offer = NO_OFFER;
-      } else {
-        game_over(DRAW_OFFER, opposite_color);
-        break;
-      }
+    if (strcmp(move, "h") == 0) {
+      hint_requested = true;
       continue;
     }
 
-    if (!is_valid_san(move)) {
-      illegal_move_made = true;
+    if (show_stats && strcmp(move, "s") == 0) {
+      stats_requested = true;
       continue;
     }
 
-    if (!move_from_san(board, move, color_to_move)) {
-      illegal_move_made = true;
+    if (strcmp(move, "d") == 0) {
+      if (game_offer_draw(game)) {
+        break;
+      }
       continue;
     }
 
-    color_to_move = opposite_color;
-    if (draw_offer != NO_OFFER && !have_active_draw_offer) {
-      draw_offer = NO_OFFER;
+    if (!is_valid_san(move) || !game_play_san(game, move)) {
+      illegal_move_made = true;
+      continue;
     }
 
-    char *fen = board_to_fen(board, color_to_move);
-
-    bool seen = false;
-
-    for (size_t i = 0; i < fen_array->length; i++) {
-      if (strcmp(fen_array->fens[i], fen) == 0) {
-        if (seen) {
-          drawn_by_threefold = true;
-          break;
-        }
-
-        seen = true;
-      }
-    }
+    computer_move[0] = '\0';
+  }
 
-    append_fen(fen_array, fen);
-    printf("%s", fen);
+  if (analysis_path != NULL) {
+    save_analysis(game, analysis_path, limits.telemetry);
   }
 
-  free_board(board);
-  free_fen_array(fen_array);
+  announce_game_over(game->reason,
+                     game->board->side_to_move == WHITE ? BLACK : WHITE,
+                     show_stats ? &stats : NULL);
+  free_game(game);
   goto game_loop;
 }
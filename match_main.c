@@ -0,0 +1,745 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "archive.h"
+#include "board.h"
+#include "endgame.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "nnue.h"
+#include "pgn.h"
+#include "search.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_GAME_PLIES 600
+#define MAX_OPENING_PLIES 32
+
+typedef struct EngineConfig {
+  char name[32];
+  int depth;
+  unsigned long long nodes;
+  long milliseconds;
+  size_t hash_megabytes;
+  const char *network_path;
+  nnue_network_t *network;
+} engine_config_t;
+
+typedef struct MatchOptions {
+  engine_config_t engines[2];
+  long games;
+  int threads;
+  const char *openings_path;
+  int random_plies;
+  unsigned long long seed;
+  const char *pgn_path;
+  int resign_score;
+  int resign_moves;
+  int draw_score;
+  int draw_moves;
+  int draw_from;
+  bool sprt;
+  double elo0;
+  double elo1;
+  double alpha;
+  double beta;
+  long report_every;
+  bool stats;
+} match_options_t;
+
+// Each worker has a board and a search table per engine; both boards follow
+// the game, so an engine's network accumulator is never shared.
+typedef struct MatchWorker {
+  board_t *boards[2];
+  search_table_t *tables[2];
+  board_t *scratch;
+  unsigned long long hashes[MAX_OPENING_PLIES + MAX_GAME_PLIES + 1];
+  unsigned char moves[2 * (MAX_OPENING_PLIES + MAX_GAME_PLIES)];
+} match_worker_t;
+
+typedef struct Match {
+  const match_options_t *options;
+  match_worker_t *workers;
+  char **openings;
+  long opening_count;
+  FILE *pgn;
+  pthread_mutex_t lock;
+  atomic_long next_pair;
+  atomic_bool stop;
+  // Results from engine 0's side, the number of games last reported and the
+  // time the match started.
+  long wins, draws, losses;
+  long reported;
+  double start;
+  const char *verdict;
+  stats_t stats;
+} match_t;
+
+double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+unsigned long long next_random(unsigned long long *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
+
+double elo_from_score(double score) {
+  return -400 * log10(1 / score - 1);
+}
+
+double score_from_elo(double elo) { return 1 / (1 + pow(10, -elo / 400)); }
+
+// Elo difference with a 95% confidence margin from the per-game score
+// variance.
+void elo_estimate(long wins, long draws, long losses, double *elo,
+                  double *margin) {
+  double games = wins + draws + losses;
+  double score = (wins + draws / 2.0) / games;
+  double variance = (wins * pow(1 - score, 2) + draws * pow(0.5 - score, 2) +
+                     losses * pow(score, 2)) /
+                    games;
+  double deviation = 1.96 * sqrt(variance / games);
+  double low = fmin(fmax(score - deviation, 1e-6), 1 - 1e-6);
+  double high = fmin(fmax(score + deviation, 1e-6), 1 - 1e-6);
+
+  score = fmin(fmax(score, 1e-6), 1 - 1e-6);
+  *elo = elo_from_score(score);
+  *margin = (elo_from_score(high) - elo_from_score(low)) / 2;
+}
+
+// Log-likelihood ratio of elo1 against elo0 under the normal approximation
+// to the trinomial distribution of game results.
+double sprt_llr(long wins, long draws, long losses, double elo0,
+                double elo1) {
+  double games = wins + draws + losses;
+  double score = (wins + draws / 2.0) / games;
+  double variance = (wins * pow(1 - score, 2) + draws * pow(0.5 - score, 2) +
+                     losses * pow(score, 2)) /
+                    games;
+
+  if (variance <= 0) {
+    return 0;
+  }
+
+  double s0 = score_from_elo(elo0), s1 = score_from_elo(elo1);
+  return games * (s1 - s0) * (2 * score - s0 - s1) / (2 * variance);
+}
+
+// The LLR bounds for accepting H0 (lower) and H1 (upper).
+void sprt_bounds(const match_options_t *options, double *lower,
+                 double *upper) {
+  *lower = log(options->beta / (1 - options->alpha));
+  *upper = log((1 - options->beta) / options->alpha);
+}
+
+// Stops the match once the LLR crosses a bound; called after every game with
+// match->lock held.
+void check_sprt(match_t *match) {
+  const match_options_t *options = match->options;
+  double lower, upper;
+
+  if (!options->sprt || match->verdict != NULL) {
+    return;
+  }
+
+  double llr = sprt_llr(match->wins, match->draws, match->losses,
+                        options->elo0, options->elo1);
+  sprt_bounds(options, &lower, &upper);
+
+  if (llr >= upper) {
+    match->verdict = "H1 accepted";
+  } else if (llr <= lower) {
+    match->verdict = "H0 accepted";
+  }
+
+  if (match->verdict != NULL) {
+    atomic_store(&match->stop, true);
+  }
+}
+
+// Prints the running totals; called with match->lock held.
+void report(match_t *match) {
+  const match_options_t *options = match->options;
+  long games = match->wins + match->draws + match->losses;
+  double hours = (now_seconds() - match->start) / 3600;
+  double elo, margin;
+
+  match->reported = games;
+  elo_estimate(match->wins, match->draws, match->losses, &elo, &margin);
+  printf("%6ld games  +%ld =%ld -%ld  Elo %+.1f +/- %.1f  %.0f games/h", games,
+         match->wins, match->draws, match->losses, elo, margin,
+         games / hours);
+
+  if (options->sprt) {
+    double llr = sprt_llr(match->wins, match->draws, match->losses,
+                          options->elo0, options->elo1);
+    double lower, upper;
+    sprt_bounds(options, &lower, &upper);
+    printf("  LLR %.2f [%.2f, %.2f]", llr, lower, upper);
+
+    if (match->verdict != NULL) {
+      printf(" %s", match->verdict);
+    }
+  }
+
+  printf("\n");
+  fflush(stdout);
+}
+
+int count_repetitions(match_worker_t *worker, int hash_count, board_t *board) {
+  int repetitions = 0;
+
+  for (int i = hash_count - 2;
+       i >= 0 && i >= hash_count - board->fifty_move_rule_counter; i -= 2) {
+    repetitions += worker->hashes[i] == board->hash;
+  }
+
+  return repetitions;
+}
+
+// Adjudicates a won or drawn known endgame: one the endgame table scores as a
+// sure win, or scales to nothing. Positions without legal moves are left to
+// the game loop, and a win is only called when the weak side cannot capture
+// anything on its move.
+game_result_t adjudicate_endgame(board_t *board) {
+  const endgame_t *endgame = probe_endgame(board);
+  move_list_t moves;
+
+  if (endgame == NULL) {
+    return RESULT_UNKNOWN;
+  }
+
+  generate_legal_moves(board, board->side_to_move, &moves);
+
+  if (moves.length == 0) {
+    return RESULT_UNKNOWN;
+  }
+
+  if (endgame->evaluate != NULL &&
+      endgame->evaluate(board, endgame->strong) >= KNOWN_WIN) {
+    for (int i = 0;
+         board->side_to_move != endgame->strong && i < moves.length; ++i) {
+      if (is_capture(board, moves.moves[i])) {
+        return RESULT_UNKNOWN;
+      }
+    }
+
+    return endgame->strong == WHITE ? WHITE_WINS : BLACK_WINS;
+  }
+
+  if (endgame->scale != NULL && endgame->scale(board, endgame->strong) == 0) {
+    return DRAWN;
+  }
+
+  return RESULT_UNKNOWN;
+}
+
+// Plays one game with white_engine (0 or 1) as white from the opening and
+// writes it to the PGN file. Returns the result.
+game_result_t play_game(match_t *match, match_worker_t *worker,
+                        const char *fen, move_t *opening, int opening_plies,
+                        int white_engine, long round) {
+  const match_options_t *options = match->options;
+  piece_color_t color;
+  int hash_count = 0;
+  int ply_count = 0;
+
+  for (int engine = 0; engine < 2; ++engine) {
+    nnue_attach(worker->boards[engine], options->engines[engine].network);
+    load_fen(worker->boards[engine], fen != NULL ? fen : START_FEN, &color);
+    clear_search_table(worker->tables[engine]);
+  }
+
+  board_t *board = worker->boards[0];
+
+  for (int ply = 0; ply < opening_plies; ++ply) {
+    unsigned short code = encode_move(opening[ply]);
+    worker->moves[2 * ply_count] = code & 0xff;
+    worker->moves[2 * ply_count + 1] = code >> 8;
+    worker->hashes[hash_count++] = board->hash;
+    ply_count++;
+
+    for (int engine = 0; engine < 2; ++engine) {
+      undo_t undo;
+      make_move(worker->boards[engine], opening[ply], &undo);
+    }
+  }
+
+  game_result_t result = RESULT_UNKNOWN;
+  const char *termination = "normal";
+  int resign_plies = 0, draw_plies = 0;
+
+  while (result == RESULT_UNKNOWN) {
+    if (board->fifty_move_rule_counter >= 100 ||
+        insufficient_material(board) ||
+        count_repetitions(worker, hash_count, board) >= 2) {
+      result = DRAWN;
+      break;
+    }
+
+    if ((result = adjudicate_endgame(board)) != RESULT_UNKNOWN) {
+      termination = "adjudication";
+      break;
+    }
+
+    if (ply_count >= opening_plies + MAX_GAME_PLIES) {
+      result = DRAWN;
+      termination = "adjudication";
+      break;
+    }
+
+    int engine = board->side_to_move == WHITE ? white_engine : !white_engine;
+    const engine_config_t *config = &options->engines[engine];
+    search_limits_t limits = {.depth = config->depth,
+                              .nodes = config->nodes,
+                              .milliseconds = config->milliseconds,
+                              .history = worker->hashes,
+                              .history_length = hash_count};
+    search_result_t found;
+
+    if (!search(worker->boards[engine], &limits, worker->tables[engine],
+                &found)) {
+      result = board->checkers == 0 ? DRAWN
+               : board->side_to_move == WHITE ? BLACK_WINS
+                                              : WHITE_WINS;
+      break;
+    }
+
+    // Resign once both engines have agreed on a large score for the given
+    // number of moves each; call a draw once they have agreed on a small one.
+    int white_score =
+        board->side_to_move == WHITE ? found.score : -found.score;
+
+    if (options->resign_moves > 0 &&
+        abs(white_score) >= options->resign_score) {
+      resign_plies = resign_plies * white_score > 0
+                         ? resign_plies + (white_score > 0 ? 1 : -1)
+                         : (white_score > 0 ? 1 : -1);
+    } else {
+      resign_plies = 0;
+    }
+
+    if (options->draw_moves > 0 && abs(white_score) <= options->draw_score &&
+        ply_count >= 2 * options->draw_from) {
+      draw_plies++;
+    } else {
+      draw_plies = 0;
+    }
+
+    unsigned short code = encode_move(found.best_move);
+    worker->moves[2 * ply_count] = code & 0xff;
+    worker->moves[2 * ply_count + 1] = code >> 8;
+    worker->hashes[hash_count++] = board->hash;
+    ply_count++;
+
+    for (int side = 0; side < 2; ++side) {
+      undo_t undo;
+      make_move(worker->boards[side], found.best_move, &undo);
+    }
+
+    if (abs(resign_plies) >= 2 * options->resign_moves &&
+        options->resign_moves > 0) {
+      result = resign_plies > 0 ? WHITE_WINS : BLACK_WINS;
+      termination = "adjudication";
+    } else if (draw_plies >= 2 * options->draw_moves &&
+               options->draw_moves > 0) {
+      result = DRAWN;
+      termination = "adjudication";
+    }
+  }
+
+  char tags[256];
+  size_t tags_length = 0;
+  const char *pairs[][2] = {
+      {"Event", "match"},
+      {"Round", NULL},
+      {"White", options->engines[white_engine].name},
+      {"Black", options->engines[!white_engine].name},
+      {"Termination", termination},
+  };
+  char round_text[24];
+  snprintf(round_text, sizeof(round_text), "%ld", round);
+  pairs[1][1] = round_text;
+
+  for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i) {
+    for (int j = 0; j < 2; ++j) {
+      size_t length = strlen(pairs[i][j]) + 1;
+      memcpy(tags + tags_length, pairs[i][j], length);
+      tags_length += length;
+    }
+  }
+
+  if (match->pgn != NULL) {
+    archive_game_t game = {.tags = tags,
+                           .tags_length = tags_length,
+                           .fen = fen != NULL ? fen : "",
+                           .fen_length = fen != NULL ? strlen(fen) : 0,
+                           .result = result,
+                           .moves = worker->moves,
+                           .ply_count = ply_count};
+
+    pthread_mutex_lock(&match->lock);
+    write_pgn_game(match->pgn, worker->scratch, &game);
+    pthread_mutex_unlock(&match->lock);
+  }
+
+  return result;
+}
+
+// Picks the pair's opening: the next position from the suite, or random
+// moves from the start position.
+int choose_opening(match_t *match, match_worker_t *worker, long pair,
+                   const char **fen, move_t *moves) {
+  const match_options_t *options = match->options;
+
+  if (match->opening_count > 0) {
+    *fen = match->openings[pair % match->opening_count];
+    return 0;
+  }
+
+  unsigned long long rng = (options->seed + pair + 1) * 0x9e3779b97f4a7c15ULL;
+  board_t *board = worker->scratch;
+  piece_color_t color;
+  int plies = options->random_plies < MAX_OPENING_PLIES
+                  ? options->random_plies
+                  : MAX_OPENING_PLIES;
+
+  *fen = NULL;
+  nnue_attach(board, NULL);
+  load_fen(board, START_FEN, &color);
+
+  for (int ply = 0; ply < plies; ++ply) {
+    move_list_t list;
+    generate_legal_moves(board, board->side_to_move, &list);
+
+    if (list.length == 0) {
+      return ply;
+    }
+
+    undo_t undo;
+    moves[ply] = list.moves[next_random(&rng) % list.length];
+    make_move(board, moves[ply], &undo);
+  }
+
+  return plies;
+}
+
+// Each task takes pairs of games, one with each engine as white, from the
+// same opening until the match is over. An odd number of games leaves the
+// last pair with only its first game.
+void play_pairs(thread_pool_t *pool, int index, void *arg) {
+  (void)pool;
+  match_t *match = arg;
+  match_worker_t *worker = &match->workers[index];
+  long pair;
+
+  while (!atomic_load(&match->stop) &&
+         (pair = atomic_fetch_add(&match->next_pair, 1)) <
+             (match->options->games + 1) / 2) {
+    move_t opening[MAX_OPENING_PLIES];
+    const char *fen;
+    int plies = choose_opening(match, worker, pair, &fen, opening);
+
+    for (int white_engine = 0; white_engine < 2; ++white_engine) {
+      long round = 2 * pair + white_engine + 1;
+
+      if (round > match->options->games || atomic_load(&match->stop)) {
+        break;
+      }
+
+      game_result_t result = play_game(match, worker, fen, opening, plies,
+                                       white_engine, round);
+
+      pthread_mutex_lock(&match->lock);
+
+      if (result == DRAWN) {
+        match->draws++;
+      } else if ((result == WHITE_WINS) == (white_engine == 0)) {
+        match->wins++;
+      } else {
+        match->losses++;
+      }
+
+      long games = match->wins + match->draws + match->losses;
+      bool decided = match->verdict != NULL;
+      check_sprt(match);
+
+      // The game that decides the test is reported straight away.
+      if (games % match->options->report_every == 0 ||
+          (!decided && match->verdict != NULL)) {
+        report(match);
+      }
+
+      pthread_mutex_unlock(&match->lock);
+    }
+  }
+}
+
+// Reads one FEN per line, skipping blank lines and # comments.
+bool read_openings(match_t *match, const char *path) {
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  char line[256];
+  long capacity = 0;
+  board_t *board = create_board();
+  piece_color_t color;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (line[0] == '\0' || line[0] == '#') {
+      continue;
+    }
+
+    if (load_fen(board, line, &color) == NULL) {
+      fprintf(stderr, "match: skipping invalid FEN: %s\n", line);
+      continue;
+    }
+
+    if (match->opening_count == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      match->openings = realloc(match->openings, capacity * sizeof(char *));
+    }
+
+    match->openings[match->opening_count++] = strdup(line);
+  }
+
+  free_board(board);
+  fclose(file);
+  return match->opening_count > 0;
+}
+
+// Parses comma-separated name=value settings such as
+// "nodes=5000,hash=16,network=a.nnue".
+bool parse_engine(char *spec, engine_config_t *config) {
+  char *save;
+
+  for (char *setting = strtok_r(spec, ",", &save); setting != NULL;
+       setting = strtok_r(NULL, ",", &save)) {
+    char *value = strchr(setting, '=');
+
+    if (value == NULL) {
+      return false;
+    }
+
+    *value++ = '\0';
+
+    if (strcmp(setting, "name") == 0) {
+      snprintf(config->name, sizeof(config->name), "%s", value);
+    } else if (strcmp(setting, "depth") == 0) {
+      config->depth = atoi(value);
+      config->nodes = 0;
+    } else if (strcmp(setting, "nodes") == 0) {
+      config->nodes = strtoull(value, NULL, 10);
+    } else if (strcmp(setting, "ms") == 0) {
+      config->milliseconds = atol(value);
+      config->nodes = 0;
+    } else if (strcmp(setting, "hash") == 0) {
+      config->hash_megabytes = strtoul(value, NULL, 10);
+    } else if (strcmp(setting, "network") == 0) {
+      config->network_path = value;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int run_match(match_options_t *options) {
+  match_t match = {.options = options};
+
+  for (int i = 0; i < 2; ++i) {
+    engine_config_t *config = &options->engines[i];
+
+    if (config->network_path != NULL &&
+        (config->network = load_network(config->network_path)) == NULL) {
+      fprintf(stderr, "match: could not load %s\n", config->network_path);
+      return 1;
+    }
+  }
+
+  if (options->openings_path != NULL &&
+      !read_openings(&match, options->openings_path)) {
+    fprintf(stderr, "match: no openings in %s\n", options->openings_path);
+    return 1;
+  }
+
+  if (options->pgn_path != NULL &&
+      (match.pgn = fopen(options->pgn_path, "a")) == NULL) {
+    fprintf(stderr, "match: could not open %s\n", options->pgn_path);
+    return 1;
+  }
+
+  thread_pool_t *pool = create_thread_pool(options->threads);
+  int threads = thread_pool_size(pool);
+  match.workers = calloc(threads, sizeof(match_worker_t));
+  pthread_mutex_init(&match.lock, NULL);
+
+  for (int i = 0; match.workers != NULL && i < threads; ++i) {
+    match_worker_t *worker = &match.workers[i];
+    worker->scratch = create_board();
+
+    for (int engine = 0; engine < 2; ++engine) {
+      worker->boards[engine] = create_board();
+      worker->tables[engine] =
+          create_search_table(options->engines[engine].hash_megabytes);
+
+      if (worker->boards[engine] == NULL || worker->tables[engine] == NULL) {
+        fprintf(stderr, "match: out of memory\n");
+        return 1;
+      }
+
+      worker->boards[engine]->stats = options->stats ? &match.stats : NULL;
+    }
+  }
+
+  printf("%s vs %s, %ld games on %d threads\n", options->engines[0].name,
+         options->engines[1].name, options->games, threads);
+  match.start = now_seconds();
+
+  for (int i = 0; i < threads; ++i) {
+    thread_pool_submit(pool, i, play_pairs, &match);
+  }
+
+  thread_pool_wait(pool);
+
+  if (match.wins + match.draws + match.losses != match.reported) {
+    report(&match);
+  }
+
+  if (options->stats) {
+    stats_print(stdout, &match.stats);
+  }
+
+  free_thread_pool(pool);
+
+  for (int i = 0; i < threads; ++i) {
+    free_board(match.workers[i].scratch);
+
+    for (int engine = 0; engine < 2; ++engine) {
+      free_board(match.workers[i].boards[engine]);
+      free_search_table(match.workers[i].tables[engine]);
+    }
+  }
+
+  for (long i = 0; i < match.opening_count; ++i) {
+    free(match.openings[i]);
+  }
+
+  free(match.openings);
+  free(match.workers);
+  free_network(options->engines[0].network);
+  free_network(options->engines[1].network);
+  pthread_mutex_destroy(&match.lock);
+
+  if (match.pgn != NULL) {
+    fclose(match.pgn);
+  }
+
+  return 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s ENGINE1 ENGINE2 [--games N] [--threads N]\n"
+          "         [--openings FILE | --random-plies N] [--seed N]\n"
+          "         [--pgn FILE] [--resign CP MOVES] [--draw CP MOVES FROM]\n"
+          "         [--sprt ELO0 ELO1] [--alpha A] [--beta B] [--report N]\n"
+          "         [--stats]\n"
+          "ENGINE is comma-separated settings: name=, nodes=, depth=, ms=,\n"
+          "hash= (MB) and network= (file), e.g. nodes=5000,network=a.nnue\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  match_options_t options = {.games = 100,
+                             .random_plies = 8,
+                             .resign_score = 1000,
+                             .resign_moves = 4,
+                             .draw_score = 10,
+                             .draw_moves = 8,
+                             .draw_from = 40,
+                             .alpha = 0.05,
+                             .beta = 0.05,
+                             .report_every = 10};
+
+  for (int i = 0; i < 2; ++i) {
+    engine_config_t *config = &options.engines[i];
+    *config = (engine_config_t){.nodes = 5000, .hash_megabytes = 16};
+    snprintf(config->name, sizeof(config->name), "engine%d", i + 1);
+
+    if (!parse_engine(argv[i + 1], config)) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  for (int i = 3; i < argc; ++i) {
+    int left = argc - i - 1;
+
+    if (strcmp(argv[i], "--games") == 0 && left >= 1) {
+      options.games = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0 && left >= 1) {
+      options.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--openings") == 0 && left >= 1) {
+      options.openings_path = argv[++i];
+    } else if (strcmp(argv[i], "--random-plies") == 0 && left >= 1) {
+      options.random_plies = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && left >= 1) {
+      options.seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--pgn") == 0 && left >= 1) {
+      options.pgn_path = argv[++i];
+    } else if (strcmp(argv[i], "--resign") == 0 && left >= 2) {
+      options.resign_score = atoi(argv[++i]);
+      options.resign_moves = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--draw") == 0 && left >= 3) {
+      options.draw_score = atoi(argv[++i]);
+      options.draw_moves = atoi(argv[++i]);
+      options.draw_from = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sprt") == 0 && left >= 2) {
+      options.sprt = true;
+      options.elo0 = atof(argv[++i]);
+      options.elo1 = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--alpha") == 0 && left >= 1) {
+      options.alpha = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--beta") == 0 && left >= 1) {
+      options.beta = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--report") == 0 && left >= 1) {
+      options.report_every = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options.stats = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.report_every <= 0) {
+    options.report_every = 1;
+  }
+
+  return run_match(&options);
+}
@@ -0,0 +1,332 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "legal_moves.h"
+#include "mate.h"
+#include "move_piece.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Proof and disproof numbers at or above this are infinite.
+#define PROOF_INFINITY 100000000u
+#define MATE_BUCKET 4
+
+// The proof number pn and disproof number dn of a position with the side to
+// move, searched to depth plies. work is the number of nodes spent on it,
+// which decides what a full bucket gives up.
+typedef struct MateEntry {
+  unsigned long long hash;
+  unsigned pn;
+  unsigned dn;
+  unsigned work;
+  int depth;
+} mate_entry_t;
+
+struct MateSolver {
+  mate_entry_t *entries;
+  size_t mask;
+  board_t *board;
+  unsigned long long nodes;
+  unsigned long long max_nodes;
+  bool stopped;
+};
+
+// The table holds at most megabytes of entries, in buckets of MATE_BUCKET.
+mate_solver_t *create_mate_solver(size_t megabytes) {
+  size_t count = MATE_BUCKET;
+
+  while (count * 2 * sizeof(mate_entry_t) <= megabytes * 1024 * 1024) {
+    count *= 2;
+  }
+
+  mate_solver_t *solver = calloc(1, sizeof(mate_solver_t));
+
+  if (!solver) {
+    return NULL;
+  }
+
+  solver->entries = calloc(count, sizeof(mate_entry_t));
+
+  if (!solver->entries) {
+    free(solver);
+    return NULL;
+  }
+
+  solver->mask = count / MATE_BUCKET - 1;
+  return solver;
+}
+
+void free_mate_solver(mate_solver_t *solver) {
+  free(solver->entries);
+  free(solver);
+}
+
+mate_entry_t *mate_bucket(mate_solver_t *solver, unsigned long long hash,
+                          int depth) {
+  size_t index = (hash ^ (unsigned long long)depth * 0x9e3779b97f4a7c15ULL) &
+                 solver->mask;
+  return &solver->entries[index * MATE_BUCKET];
+}
+
+// Unsearched positions start at pn = dn = 1.
+void probe_mate(mate_solver_t *solver, unsigned long long hash, int depth,
+                unsigned *pn, unsigned *dn) {
+  mate_entry_t *bucket = mate_bucket(solver, hash, depth);
+
+  for (int i = 0; i < MATE_BUCKET; ++i) {
+    if (bucket[i].hash == hash && bucket[i].depth == depth &&
+        bucket[i].work > 0) {
+      *pn = bucket[i].pn;
+      *dn = bucket[i].dn;
+      return;
+    }
+  }
+
+  *pn = 1;
+  *dn = 1;
+}
+
+void store_mate(mate_solver_t *solver, unsigned long long hash, int depth,
+                unsigned pn, unsigned dn, unsigned long long work) {
+  mate_entry_t *bucket = mate_bucket(solver, hash, depth);
+  mate_entry_t *replace = &bucket[0];
+
+  for (int i = 0; i < MATE_BUCKET; ++i) {
+    if (bucket[i].hash == hash && bucket[i].depth == depth) {
+      replace = &bucket[i];
+      break;
+    }
+
+    if (bucket[i].work < replace->work) {
+      replace = &bucket[i];
+    }
+  }
+
+  *replace = (mate_entry_t){hash, pn, dn,
+                            work < 0xffffffffULL ? (unsigned)work + 1
+                                                 : 0xffffffffu,
+                            depth};
+}
+
+unsigned add_proof_numbers(unsigned a, unsigned b) {
+  return a + b >= PROOF_INFINITY ? PROOF_INFINITY : a + b;
+}
+
+// Whether the side to move is checkmated.
+bool is_mated(board_t *board) {
+  return board->checkers != 0 && !has_legal_move(board, board->side_to_move);
+}
+
+// The move among moves that mates at once, if any.
+int find_mate_in_one(board_t *board, move_list_t *moves) {
+  for (int i = 0; i < moves->length; ++i) {
+    undo_t undo;
+    make_move(board, moves->moves[i], &undo);
+    bool mate = is_mated(board);
+    unmake_move(board, moves->moves[i], &undo);
+
+    if (mate) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// Depth-first proof-number search of the position on the board, with
+// attacker telling whether the mating side is to move and depth the plies
+// left. Works on phi and delta, which are pn and dn at the attacker's nodes
+// and the other way round at the defender's, so that every node minimises
+// over its children the same way. Returns once phi or delta reaches its
+// threshold, leaving the numbers in the table.
+void mate_mid(mate_solver_t *solver, int depth, bool attacker,
+              unsigned phi_threshold, unsigned delta_threshold) {
+  board_t *board = solver->board;
+  unsigned long long hash = board->hash;
+  unsigned long long start = solver->nodes++;
+  move_list_t moves;
+  generate_legal_moves(board, board->side_to_move, &moves);
+
+  // Checkmate proves the defender's nodes and disproves the attacker's, as
+  // do stalemate and running out of plies the other way round.
+  if (moves.length == 0 || depth == 0 || (attacker && depth == 1)) {
+    bool proven = attacker ? depth == 1 && find_mate_in_one(board, &moves) >= 0
+                           : moves.length == 0 && board->checkers != 0;
+    store_mate(solver, hash, depth, proven ? 0 : PROOF_INFINITY,
+               proven ? PROOF_INFINITY : 0, solver->nodes - start);
+    return;
+  }
+
+  unsigned long long children[256];
+
+  for (int i = 0; i < moves.length; ++i) {
+    undo_t undo;
+    make_move(board, moves.moves[i], &undo);
+    children[i] = board->hash;
+    unmake_move(board, moves.moves[i], &undo);
+  }
+
+  while (true) {
+    unsigned phi = PROOF_INFINITY, delta = 0;
+    unsigned second = PROOF_INFINITY, best_phi = 0;
+    int best = 0;
+
+    for (int i = 0; i < moves.length; ++i) {
+      unsigned pn, dn;
+      probe_mate(solver, children[i], depth - 1, &pn, &dn);
+      unsigned child_phi = attacker ? dn : pn;
+      unsigned child_delta = attacker ? pn : dn;
+      delta = add_proof_numbers(delta, child_phi);
+
+      if (child_delta < phi) {
+        second = phi;
+        phi = child_delta;
+        best_phi = child_phi;
+        best = i;
+      } else if (child_delta < second) {
+        second = child_delta;
+      }
+    }
+
+    if (phi >= phi_threshold || delta >= delta_threshold || solver->stopped) {
+      store_mate(solver, hash, depth, attacker ? phi : delta,
+                 attacker ? delta : phi, solver->nodes - start);
+      return;
+    }
+
+    unsigned child_phi_threshold = delta_threshold - delta + best_phi;
+    unsigned child_delta_threshold =
+        second >= PROOF_INFINITY ? phi_threshold
+        : phi_threshold < second + 1 ? phi_threshold
+                                     : second + 1;
+    undo_t undo;
+    make_move(board, moves.moves[best], &undo);
+    mate_mid(solver, depth - 1, !attacker, child_phi_threshold,
+             child_delta_threshold);
+    unmake_move(board, moves.moves[best], &undo);
+
+    if (solver->max_nodes > 0 && solver->nodes >= solver->max_nodes) {
+      solver->stopped = true;
+    }
+  }
+}
+
+// The fewest plies within which the position after move is proven, or -1 if
+// it is not proven within depth plies. Only the depths of the right parity
+// for the side then to move are tried.
+int mate_distance(mate_solver_t *solver, move_t move, int depth,
+                  bool attacker) {
+  board_t *board = solver->board;
+  undo_t undo;
+  int distance = -1;
+  make_move(board, move, &undo);
+
+  for (int d = attacker ? 1 : 0; d <= depth && !solver->stopped; d += 2) {
+    unsigned pn, dn;
+    probe_mate(solver, board->hash, d, &pn, &dn);
+
+    if (pn != 0 && dn != 0) {
+      mate_mid(solver, d, attacker, PROOF_INFINITY, PROOF_INFINITY);
+      probe_mate(solver, board->hash, d, &pn, &dn);
+    }
+
+    if (pn == 0) {
+      distance = d;
+      break;
+    }
+  }
+
+  unmake_move(board, move, &undo);
+  return distance;
+}
+
+// Follows a proven position to the mate along best play: the attacker's
+// quickest mate against the defender's longest resistance. Leaves the board
+// as it was.
+int mate_line(mate_solver_t *solver, int depth, bool attacker, move_t *line) {
+  board_t *board = solver->board;
+  move_list_t moves;
+  generate_legal_moves(board, board->side_to_move, &moves);
+  int chosen = -1, chosen_distance = 0;
+
+  if (moves.length == 0 || depth == 0) {
+    return 0;
+  }
+
+  for (int i = 0; i < moves.length; ++i) {
+    int distance = mate_distance(solver, moves.moves[i], depth - 1, !attacker);
+
+    if (distance >= 0 &&
+        (chosen < 0 || (attacker ? distance < chosen_distance
+                                 : distance > chosen_distance))) {
+      chosen = i;
+      chosen_distance = distance;
+    }
+  }
+
+  if (chosen < 0 || solver->stopped) {
+    return 0;
+  }
+
+  undo_t undo;
+  line[0] = moves.moves[chosen];
+  make_move(board, line[0], &undo);
+  int length = 1 + mate_line(solver, chosen_distance, !attacker, line + 1);
+  unmake_move(board, line[0], &undo);
+  return length;
+}
+
+double mate_elapsed(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Looks for the shortest mate by the side to move in up to max_moves moves,
+// trying one move, then two and so on. max_nodes of zero means no limit.
+// Returns false if the position has no legal moves.
+bool solve_mate(mate_solver_t *solver, board_t *board, int max_moves,
+                unsigned long long max_nodes, mate_result_t *result) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  memset(result, 0, sizeof(mate_result_t));
+  result->status = MATE_NONE;
+
+  if (!has_legal_move(board, board->side_to_move)) {
+    return false;
+  }
+
+  if (max_moves > MAX_MATE_MOVES) {
+    max_moves = MAX_MATE_MOVES;
+  }
+
+  solver->board = board;
+  solver->nodes = 0;
+  solver->max_nodes = max_nodes;
+  solver->stopped = false;
+
+  for (int moves = 1; moves <= max_moves; ++moves) {
+    int depth = 2 * moves - 1;
+    unsigned pn, dn;
+    mate_mid(solver, depth, true, PROOF_INFINITY, PROOF_INFINITY);
+    probe_mate(solver, board->hash, depth, &pn, &dn);
+
+    if (pn == 0) {
+      result->status = MATE_FOUND;
+      result->moves = moves;
+      result->line_length = mate_line(solver, depth, true, result->line);
+      break;
+    }
+
+    if (solver->stopped) {
+      result->status = MATE_UNKNOWN;
+      break;
+    }
+  }
+
+  result->nodes = solver->nodes;
+  result->seconds = mate_elapsed(&start);
+  return true;
+}
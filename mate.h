@@ -0,0 +1,26 @@
+#include "types.h"
+
+#pragma once
+
+#define MAX_MATE_MOVES 32
+
+typedef struct MateSolver mate_solver_t;
+
+typedef enum MateStatus { MATE_FOUND, MATE_NONE, MATE_UNKNOWN } mate_status_t;
+
+// For MATE_FOUND, moves is the length of the shortest mate and line one
+// mating line; MATE_NONE means no mate within the moves asked for, and
+// MATE_UNKNOWN that the node limit was reached first.
+typedef struct MateResult {
+  mate_status_t status;
+  int moves;
+  move_t line[2 * MAX_MATE_MOVES];
+  int line_length;
+  unsigned long long nodes;
+  double seconds;
+} mate_result_t;
+
+mate_solver_t *create_mate_solver(size_t megabytes);
+void free_mate_solver(mate_solver_t *solver);
+bool solve_mate(mate_solver_t *solver, board_t *board, int max_moves,
+                unsigned long long max_nodes, mate_result_t *result);
@@ -0,0 +1,156 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "mate.h"
+#include "move_piece.h"
+#include "stats.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct MateOptions {
+  int moves;
+  unsigned long long nodes;
+  size_t hash_megabytes;
+  // Counts for the solver's board, or NULL without --stats.
+  stats_t *stats;
+} mate_options_t;
+
+// Prints the mating line in SAN, playing it out on a copy of board.
+void print_line(board_t *board, const mate_result_t *result) {
+  board_t *scratch = create_board();
+
+  if (scratch == NULL) {
+    return;
+  }
+
+  copy_board(scratch, board);
+
+  for (int i = 0; i < result->line_length; ++i) {
+    char san[10];
+    undo_t undo;
+    move_to_san(scratch, result->line[i], san);
+    make_move(scratch, result->line[i], &undo);
+    printf(" %s", san);
+  }
+
+  free_board(scratch);
+}
+
+// Reads one FEN per line and writes one line per FEN:
+//   mate N MOVES... (nodes, seconds)
+//   none N (nodes, seconds)      no mate in N moves or fewer
+//   unknown (nodes, seconds)     the node limit ran out
+//   invalid                      the FEN could not be read
+int solve_file(FILE *in, const mate_options_t *options) {
+  mate_solver_t *solver = create_mate_solver(options->hash_megabytes);
+  board_t *board = create_board();
+
+  if (solver == NULL || board == NULL) {
+    fprintf(stderr, "mate: out of memory\n");
+    return 1;
+  }
+
+  board->stats = options->stats;
+
+  char line[256];
+  long positions = 0, mates = 0;
+  double seconds = 0;
+
+  while (fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (line[0] == '\0' || line[0] == '#') {
+      continue;
+    }
+
+    piece_color_t color;
+    mate_result_t result;
+
+    if (load_fen(board, line, &color) == NULL ||
+        !solve_mate(solver, board, options->moves, options->nodes, &result)) {
+      printf("invalid\n");
+      continue;
+    }
+
+    positions++;
+    seconds += result.seconds;
+
+    if (result.status == MATE_FOUND) {
+      mates++;
+      printf("mate %d", result.moves);
+      print_line(board, &result);
+    } else if (result.status == MATE_NONE) {
+      printf("none %d", options->moves);
+    } else {
+      printf("unknown");
+    }
+
+    printf(" (%llu nodes, %.3f s)\n", result.nodes, result.seconds);
+    fflush(stdout);
+  }
+
+  fprintf(stderr, "%ld mates in %ld positions, %.2f s\n", mates, positions,
+          seconds);
+
+  if (options->stats != NULL) {
+    stats_print(stderr, options->stats);
+  }
+
+  free_board(board);
+  free_mate_solver(solver);
+  return 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--moves N] [--nodes N] [--hash MB] [--stats] [FILE]\n"
+          "Reads FENs from FILE or standard input.\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  mate_options_t options = {.moves = 5, .hash_megabytes = 64};
+  stats_t stats = {0};
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--moves") == 0 && i + 1 < argc) {
+      options.moves = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+      options.nodes = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+      options.hash_megabytes = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options.stats = &stats;
+    } else if (argv[i][0] != '-' && path == NULL) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.moves < 1 || options.moves > MAX_MATE_MOVES) {
+    fprintf(stderr, "mate: --moves must be between 1 and %d\n",
+            MAX_MATE_MOVES);
+    return 1;
+  }
+
+  FILE *in = path != NULL ? fopen(path, "r") : stdin;
+
+  if (in == NULL) {
+    fprintf(stderr, "mate: could not open %s\n", path);
+    return 1;
+  }
+
+  int status = solve_file(in, &options);
+
+  if (in != stdin) {
+    fclose(in);
+  }
+
+  return status;
+}
@@ -1,6 +1,10 @@
-#include "can_move.h"
+#include "board.h"
 #include "legal_moves.h"
+#include "move_piece.h"
+#include "nnue.h"
+#include "stats.h"
 #include "types.h"
+#include "zobrist.h"
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,17 +16,178 @@ void move_to(piece_t *piece, square_t *square) {
   piece->square = square;
 }
 
-bool castle(board_t *board, castle_t type, piece_color_t color) {
+void make_move(board_t *board, move_t move, undo_t *undo) {
+  square_t *from = &board->squares[move.from_rank][move.from_file];
+  square_t *to = &board->squares[move.to_rank][move.to_file];
+  piece_t *piece = from->piece;
+  int rights = castling_rights(board);
+
+  undo->captured = to->piece;
+  undo->enpassantable_pawn = board->enpassantable_pawn;
+  undo->fifty_move_rule_counter = board->fifty_move_rule_counter;
+  undo->hash = board->hash;
+  undo->material_key = board->material_key;
+  undo->pawn_key = board->pawn_key;
+  undo->checkers = board->checkers;
+  undo->had_moved = piece->has_moved;
+  undo->type = piece->type;
+
+  if (board->enpassantable_pawn != NULL) {
+    board->hash ^= enpassant_key(board->enpassantable_pawn->square->file);
+  }
+
+  if (piece->type == PAWN && to->piece == NULL && to->file != from->file) {
+    undo->captured = board->enpassantable_pawn;
+  }
+
+  if (undo->captured != NULL) {
+    square_t *square = undo->captured->square;
+    undo->captured_square = square;
+    board->hash ^= piece_key(undo->captured->type, undo->captured->color,
+                             square->rank, square->file);
+
+    if (undo->captured->type == PAWN) {
+      board->pawn_key ^= piece_key(PAWN, undo->captured->color, square->rank,
+                                   square->file);
+    }
+
+    remove_material(board, undo->captured->type, undo->captured->color);
+    square->piece = NULL;
+    undo->captured->square = NULL;
+  }
+
+  board->enpassantable_pawn = NULL;
+
+  // Like the FEN, only remember a double-pushed pawn when an enemy pawn is
+  // beside it and could take it en passant.
+  if (piece->type == PAWN && abs(to->rank - from->rank) == 2) {
+    for (int df = -1; df <= 1; df += 2) {
+      if (to->file + df < 0 || to->file + df > 7) {
+        continue;
+      }
+
+      piece_t *neighbour = board->squares[to->rank][to->file + df].piece;
+
+      if (neighbour != NULL && neighbour->type == PAWN &&
+          neighbour->color != piece->color) {
+        board->enpassantable_pawn = piece;
+        board->hash ^= enpassant_key(to->file);
+        break;
+      }
+    }
+  }
+
+  piece_t *rook = NULL;
+
+  if (piece->type == KING && abs(to->file - from->file) == 2) {
+    int rook_file = to->file == 6 ? 7 : 0;
+    int rook_to_file = to->file == 6 ? 5 : 3;
+    rook = board->squares[from->rank][rook_file].piece;
+
+    board->hash ^= piece_key(ROOK, rook->color, from->rank, rook_file) ^
+                   piece_key(ROOK, rook->color, from->rank, rook_to_file);
+    move_to(rook, &board->squares[from->rank][rook_to_file]);
+  }
+
+  if (piece->type == PAWN || undo->captured != NULL) {
+    board->fifty_move_rule_counter = 0;
+  } else {
+    board->fifty_move_rule_counter++;
+  }
+
+  board->hash ^= piece_key(piece->type, piece->color, from->rank, from->file);
+
+  if (piece->type == PAWN) {
+    board->pawn_key ^= piece_key(PAWN, piece->color, from->rank, from->file);
+  }
+
+  if (piece->type == PAWN && (to->rank == 0 || to->rank == 7)) {
+    remove_material(board, PAWN, piece->color);
+    add_material(board, move.promotion, piece->color);
+    piece->type = move.promotion;
+  }
+
+  board->hash ^= piece_key(piece->type, piece->color, to->rank, to->file);
+
+  if (piece->type == PAWN) {
+    board->pawn_key ^= piece_key(PAWN, piece->color, to->rank, to->file);
+  }
+  move_to(piece, to);
+
+  board->hash ^= castling_key(rights) ^ castling_key(castling_rights(board));
+  board->hash ^= side_key();
+  board->side_to_move = piece->color == WHITE ? BLACK : WHITE;
+
+  square_t *vacated = NULL;
+
+  if (undo->captured != NULL && undo->captured_square != to) {
+    vacated = undo->captured_square;
+  }
+
+  board->checkers = checkers_after_move(board, piece, from, vacated, rook);
+
+  if (board->network != NULL) {
+    nnue_update_move(board, move, undo, piece->color, false);
+  }
+}
+
+void unmake_move(board_t *board, move_t move, undo_t *undo) {
+  square_t *from = &board->squares[move.from_rank][move.from_file];
+  square_t *to = &board->squares[move.to_rank][move.to_file];
+  piece_t *piece = to->piece;
+
+  board->piece_counts[piece->color][piece->type]--;
+  board->piece_counts[piece->color][undo->type]++;
+  piece->type = undo->type;
+  move_to(piece, from);
+  piece->has_moved = undo->had_moved;
+
+  if (piece->type == KING && abs(to->file - from->file) == 2) {
+    int rook_file = to->file == 6 ? 7 : 0;
+    int rook_to_file = to->file == 6 ? 5 : 3;
+    piece_t *rook = board->squares[from->rank][rook_to_file].piece;
+
+    move_to(rook, &board->squares[from->rank][rook_file]);
+    rook->has_moved = false;
+  }
+
+  if (undo->captured != NULL) {
+    undo->captured->square = undo->captured_square;
+    undo->captured_square->piece = undo->captured;
+    board->piece_counts[undo->captured->color][undo->captured->type]++;
+  }
+
+  board->enpassantable_pawn = undo->enpassantable_pawn;
+  board->fifty_move_rule_counter = undo->fifty_move_rule_counter;
+  board->hash = undo->hash;
+  board->material_key = undo->material_key;
+  board->pawn_key = undo->pawn_key;
+  board->checkers = undo->checkers;
+  board->side_to_move = piece->color;
+
+  if (board->network != NULL) {
+    nnue_update_move(board, move, undo, piece->color, true);
+  }
+}
+
+// Checks whether color may castle and, if so, fills in the king's move.
+bool castle_move(board_t *board, castle_t type, piece_color_t color,
+                 move_t *move) {
   int rank = color == WHITE ? 0 : 7;
 
   piece_t *king = board->squares[rank][4].piece;
 
-  if (king == NULL || king->has_moved) {
+  if (king == NULL || king->type != KING || king->color != color ||
+      king->has_moved) {
     return false;
   }
 
   piece_color_t attacker = color == WHITE ? BLACK : WHITE;
 
+  if (is_in_check(board, color)) {
+    return false;
+  }
+
   if (type == SHORT) {
     piece_t *rook = board->squares[rank][7].piece;
 
@@ -37,8 +202,7 @@ bool castle(board_t *board, castle_t type, piece_color_t color) {
       return false;
     }
 
-    move_to(king, &board->squares[rank][6]);
-    move_to(rook, &board->squares[rank][5]);
+    *move = (move_t){rank, 4, rank, 6, PAWN};
     return true;
   }
 
@@ -56,8 +220,19 @@ bool castle(board_t *board, castle_t type, piece_color_t color) {
     return false;
   }
 
-  move_to(king, &board->squares[rank][2]);
-  move_to(rook, &board->squares[rank][3]);
+  *move = (move_t){rank, 4, rank, 2, PAWN};
+  return true;
+}
+
+bool castle(board_t *board, castle_t type, piece_color_t color) {
+  move_t move;
+
+  if (!castle_move(board, type, color, &move)) {
+    return false;
+  }
+
+  undo_t undo;
+  make_move(board, move, &undo);
   return true;
 }
 
@@ -71,66 +246,29 @@ bool move_piece(board_t *board, piece_t *piece, square_t *square,
     return false;
   }
 
-  if (piece->type == PAWN && board->enpassantable_pawn != NULL &&
-      board->enpassantable_pawn->square->rank ==
-          square->rank - (piece->color == WHITE ? 1 : -1) &&
-      board->enpassantable_pawn->square->file == square->file) {
-    move_to(piece, square);
-    board->enpassantable_pawn->square->piece = NULL;
-    free(board->enpassantable_pawn);
-    board->enpassantable_pawn = NULL;
-    return true;
-  }
+  move_t move = {piece->square->rank, piece->square->file, square->rank,
+                 square->file, PAWN};
 
-  if (piece->type == PAWN && !piece->has_moved &&
-      (piece->color == WHITE ? square->rank == 3 : square->rank == 4)) {
-    piece_t *left_piece =
-        piece->square->file != 0
-            ? board->squares[square->rank][square->file - 1].piece
-            : NULL;
-    piece_t *right_piece =
-        piece->square->file != 7
-            ? board->squares[square->rank][square->file + 1].piece
-            : NULL;
-    if ((left_piece != NULL && left_piece->type == PAWN &&
-         left_piece->color != piece->color) ||
-        (right_piece != NULL && right_piece->type == PAWN &&
-         right_piece->color != piece->color)) {
-      board->enpassantable_pawn = piece;
-    } else {
-      board->enpassantable_pawn = NULL;
-    }
-  } else {
-    board->enpassantable_pawn = NULL;
+  if (piece->type == PAWN && (square->rank == 0 || square->rank == 7)) {
+    move.promotion = promotion_type;
   }
 
-  if (piece->type == PAWN && ((piece->color == WHITE && square->rank == 7) ||
-                              (piece->color == BLACK && square->rank == 0))) {
-    piece->type = promotion_type;
-  }
-
-  if (square->piece != NULL) {
-    free(square->piece);
-  }
-
-  if (piece->type == PAWN || square->piece != NULL) {
-    board->fifty_move_rule_counter = 0;
-  } else {
-    board->fifty_move_rule_counter++;
-  }
-
-  move_to(piece, square);
+  undo_t undo;
+  make_move(board, move, &undo);
 
   return true;
 }
 
-bool move_from_san(board_t *board, char *move, piece_color_t color) {
-  if (strcmp(move, "O-O") == 0) {
-    return castle(board, SHORT, color);
+// Parses a SAN move for color and checks that it is legal, without playing
+// it. Trailing check and annotation marks are ignored.
+bool san_to_move(board_t *board, const char *move, piece_color_t color,
+                 move_t *result) {
+  if (strncmp(move, "O-O-O", 5) == 0) {
+    return castle_move(board, LONG, color, result);
   }
 
-  if (strcmp(move, "O-O-O") == 0) {
-    return castle(board, LONG, color);
+  if (strncmp(move, "O-O", 3) == 0) {
+    return castle_move(board, SHORT, color, result);
   }
 
   piece_type_t piece_type;
@@ -170,8 +308,7 @@ bool move_from_san(board_t *board, char *move, piece_color_t color) {
     i++;
   }
 
-  if (move[i] >= '1' && move[i] <= '8' &&
-      !(move[i + 1] >= 'a' && move[i + 1] <= 'h')) {
+  if (move[i] >= '1' && move[i] <= '8') {
     piece_rank = move[i] - '1';
     i++;
   }
@@ -189,6 +326,20 @@ bool move_from_san(board_t *board, char *move, piece_color_t color) {
     return false;
   }
 
+  // Fully disambiguated moves such as Qh4xe1 name the origin square too.
+  if (move[i] == 'x') {
+    i++;
+  }
+
+  if (move[i] >= 'a' && move[i] <= 'h' && move[i + 1] >= '1' &&
+      move[i + 1] <= '8') {
+    piece_file = dest_file;
+    piece_rank = dest_rank;
+    dest_file = move[i] - 'a';
+    dest_rank = move[i + 1] - '1';
+    i += 2;
+  }
+
   if (move[i] == '=') {
     switch (move[i + 1]) {
     case 'Q':
@@ -225,7 +376,7 @@ bool move_from_san(board_t *board, char *move, piece_color_t color) {
         continue;
       }
 
-      if (can_move(board, piece, dest_square)) {
+      if (is_legal_move(board, piece, dest_square)) {
         if (final_piece != NULL) {
           return false;
         }
@@ -238,5 +389,122 @@ bool move_from_san(board_t *board, char *move, piece_color_t color) {
     return false;
   }
 
-  return move_piece(board, final_piece, dest_square, promotion_type);
+  *result = (move_t){final_piece->square->rank, final_piece->square->file,
+                     dest_rank, dest_file, PAWN};
+
+  if (piece_type == PAWN && (dest_rank == 0 || dest_rank == 7)) {
+    result->promotion = promotion_type;
+  }
+
+  return true;
+}
+
+bool move_from_san(board_t *board, char *move, piece_color_t color) {
+  STATS_ENTER();
+
+  move_t parsed;
+
+  if (!san_to_move(board, move, color, &parsed)) {
+    return STATS_RETURN(STAT_MOVE_FROM_SAN, false);
+  }
+
+  undo_t undo;
+  make_move(board, parsed, &undo);
+
+  return STATS_RETURN(STAT_MOVE_FROM_SAN, true);
+}
+
+// Writes the SAN for a legal move, with disambiguation and check marks, into
+// san (at least 10 bytes).
+void move_to_san(board_t *board, move_t move, char *san) {
+  square_t *from = &board->squares[move.from_rank][move.from_file];
+  square_t *to = &board->squares[move.to_rank][move.to_file];
+  piece_t *piece = from->piece;
+  int n = 0;
+
+  if (piece->type == KING && abs(move.to_file - move.from_file) == 2) {
+    strcpy(san, move.to_file == 6 ? "O-O" : "O-O-O");
+    n = strlen(san);
+  } else {
+    bool capture = to->piece != NULL ||
+                   (piece->type == PAWN && move.to_file != move.from_file);
+
+    if (piece->type == PAWN) {
+      if (capture) {
+        san[n++] = 'a' + move.from_file;
+      }
+    } else {
+      san[n++] = "PNBRQK"[piece->type];
+
+      bool ambiguous = false, same_file = false, same_rank = false;
+
+      for (int i = 0; i < board->piece_count; ++i) {
+        piece_t *other = &board->pieces[i];
+
+        if (other == piece || other->square == NULL ||
+            other->type != piece->type || other->color != piece->color ||
+            !is_legal_move(board, other, to)) {
+          continue;
+        }
+
+        ambiguous = true;
+        same_file = same_file || other->square->file == move.from_file;
+        same_rank = same_rank || other->square->rank == move.from_rank;
+      }
+
+      if (ambiguous && (!same_file || same_rank)) {
+        san[n++] = 'a' + move.from_file;
+      }
+
+      if (ambiguous && same_file) {
+        san[n++] = '1' + move.from_rank;
+      }
+    }
+
+    if (capture) {
+      san[n++] = 'x';
+    }
+
+    san[n++] = 'a' + move.to_file;
+    san[n++] = '1' + move.to_rank;
+
+    if (piece->type == PAWN && (move.to_rank == 0 || move.to_rank == 7)) {
+      san[n++] = '=';
+      san[n++] = "PNBRQK"[move.promotion];
+    }
+  }
+
+  undo_t undo;
+  make_move(board, move, &undo);
+
+  if (board->checkers != 0) {
+    san[n++] = has_legal_move(board, board->side_to_move) ? '+' : '#';
+  }
+
+  unmake_move(board, move, &undo);
+  san[n] = '\0';
+}
+
+// Packs a move into 16 bits: from square (6), to square (6), promotion piece
+// (2, knight to queen) and a promotion flag.
+unsigned short encode_move(move_t move) {
+  unsigned short code = (move.from_rank * 8 + move.from_file) |
+                        (move.to_rank * 8 + move.to_file) << 6;
+
+  if (move.promotion != PAWN) {
+    code |= (move.promotion - KNIGHT) << 12 | 1 << 14;
+  }
+
+  return code;
+}
+
+move_t decode_move(unsigned short code) {
+  move_t move = {(code >> 3) & 7, code & 7, (code >> 9) & 7, (code >> 6) & 7,
+                 PAWN};
+
+  if (code & 1 << 14) {
+    move.promotion = KNIGHT + ((code >> 12) & 3);
+  }
+
+  return move;
 }
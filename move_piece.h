@@ -1,8 +1,20 @@
 #include "types.h"
 
 #pragma once
+#pragma GCC visibility push(default)
 
-bool castle(board_t *board, castle_t type, bool white_to_move);
+void make_move(board_t *board, move_t move, undo_t *undo);
+void unmake_move(board_t *board, move_t move, undo_t *undo);
+bool castle_move(board_t *board, castle_t type, piece_color_t color,
+                 move_t *move);
+bool castle(board_t *board, castle_t type, piece_color_t color);
 bool move_piece(board_t *board, piece_t *piece, square_t *square,
                 piece_type_t promotion_type);
-bool move_from_san(board_t *board, char *move, bool white_to_move);
+bool san_to_move(board_t *board, const char *move, piece_color_t color,
+                 move_t *result);
+bool move_from_san(board_t *board, char *move, piece_color_t color);
+void move_to_san(board_t *board, move_t move, char *san);
+unsigned short encode_move(move_t move);
+move_t decode_move(unsigned short code);
+
+#pragma GCC visibility pop
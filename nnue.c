@@ -0,0 +1,378 @@
+#include "nnue.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NNUE_AVX2
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define NNUE_SSE4
+#endif
+
+// A small quantised network: 768 piece-square inputs per perspective feed a
+// NNUE_HIDDEN accumulator, the two accumulators (side to move first) are
+// clipped to [0, NNUE_QA] and feed NNUE_L2 clipped hidden units and a single
+// output scaled to centipawns.
+#define NNUE_INPUTS 768
+#define NNUE_L2 32
+#define NNUE_QA 127
+#define NNUE_L2_SHIFT 4
+#define NNUE_MAGIC "TCNN"
+#define NNUE_VERSION 1
+
+struct NnueNetwork {
+  short l1_weights[NNUE_INPUTS][NNUE_HIDDEN];
+  short l1_bias[NNUE_HIDDEN];
+  signed char l2_weights[NNUE_L2][2 * NNUE_HIDDEN];
+  int l2_bias[NNUE_L2];
+  signed char l3_weights[NNUE_L2];
+  int l3_bias;
+  int output_scale;
+};
+
+// The file is the header below followed by the fields of the network in
+// order, in the host's byte order.
+typedef struct NetworkHeader {
+  char magic[4];
+  unsigned int version;
+  unsigned int inputs;
+  unsigned int hidden;
+  unsigned int l2;
+} network_header_t;
+
+nnue_network_t *allocate_network(void) {
+  size_t size = (sizeof(nnue_network_t) + 63) / 64 * 64;
+  nnue_network_t *network = aligned_alloc(64, size);
+
+  if (network != NULL) {
+    memset(network, 0, size);
+  }
+
+  return network;
+}
+
+void free_network(nnue_network_t *network) { free(network); }
+
+nnue_network_t *load_network(const char *path) {
+  FILE *file = fopen(path, "rb");
+
+  if (file == NULL) {
+    return NULL;
+  }
+
+  network_header_t header;
+  nnue_network_t *network = allocate_network();
+  bool ok = network != NULL && fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, NNUE_MAGIC, 4) == 0 &&
+            header.version == NNUE_VERSION && header.inputs == NNUE_INPUTS &&
+            header.hidden == NNUE_HIDDEN && header.l2 == NNUE_L2;
+
+  ok = ok && fread(network, sizeof(nnue_network_t), 1, file) == 1;
+  fclose(file);
+
+  if (!ok) {
+    free(network);
+    return NULL;
+  }
+
+  return network;
+}
+
+bool save_network(const nnue_network_t *network, const char *path) {
+  FILE *file = fopen(path, "wb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  network_header_t header = {.version = NNUE_VERSION,
+                             .inputs = NNUE_INPUTS,
+                             .hidden = NNUE_HIDDEN,
+                             .l2 = NNUE_L2};
+  memcpy(header.magic, NNUE_MAGIC, 4);
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(network, sizeof(nnue_network_t), 1, file) == 1;
+
+  return fclose(file) == 0 && ok;
+}
+
+// Builds a network that counts material, as a starting point before any
+// training and as a reference for checking the kernels.
+nnue_network_t *create_material_network(void) {
+  nnue_network_t *network = allocate_network();
+  const int values[6] = {10, 32, 33, 50, 90, 0};
+
+  if (network == NULL) {
+    return NULL;
+  }
+
+  // Unit c * 6 + type counts pieces of that type, own pieces first, eight
+  // per piece.
+  for (int piece = 0; piece < 12; ++piece) {
+    for (int square = 0; square < 64; ++square) {
+      network->l1_weights[piece * 64 + square][piece] = 8;
+    }
+  }
+
+  for (int type = 0; type < 6; ++type) {
+    network->l2_weights[0][type] = values[type];
+    network->l2_weights[0][6 + type] = -values[type];
+    network->l2_weights[1][type] = -values[type];
+    network->l2_weights[1][6 + type] = values[type];
+  }
+
+  network->l3_weights[0] = 64;
+  network->l3_weights[1] = -64;
+  network->output_scale = 320;
+  return network;
+}
+
+int feature_index(piece_type_t type, piece_color_t color, int square,
+                  piece_color_t perspective) {
+  if (perspective == BLACK) {
+    return ((1 - color) * 6 + type) * 64 + (square ^ 56);
+  }
+
+  return (color * 6 + type) * 64 + square;
+}
+
+// Adds the added rows to and subtracts the removed rows from acc in a single
+// pass.
+void update_accumulator(short *acc, const short **added, int added_count,
+                        const short **removed, int removed_count) {
+#if defined(NNUE_AVX2)
+  for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+    __m256i sum = _mm256_loadu_si256((const __m256i *)(acc + i));
+
+    for (int j = 0; j < added_count; ++j) {
+      sum = _mm256_add_epi16(
+          sum, _mm256_load_si256((const __m256i *)(added[j] + i)));
+    }
+
+    for (int j = 0; j < removed_count; ++j) {
+      sum = _mm256_sub_epi16(
+          sum, _mm256_load_si256((const __m256i *)(removed[j] + i)));
+    }
+
+    _mm256_storeu_si256((__m256i *)(acc + i), sum);
+  }
+#elif defined(NNUE_SSE4)
+  for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+    __m128i sum = _mm_loadu_si128((const __m128i *)(acc + i));
+
+    for (int j = 0; j < added_count; ++j) {
+      sum = _mm_add_epi16(sum,
+                          _mm_load_si128((const __m128i *)(added[j] + i)));
+    }
+
+    for (int j = 0; j < removed_count; ++j) {
+      sum = _mm_sub_epi16(sum,
+                          _mm_load_si128((const __m128i *)(removed[j] + i)));
+    }
+
+    _mm_storeu_si128((__m128i *)(acc + i), sum);
+  }
+#else
+  // Row by row, so that the compiler can vectorise each loop.
+  for (int j = 0; j < added_count; ++j) {
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+      acc[i] += added[j][i];
+    }
+  }
+
+  for (int j = 0; j < removed_count; ++j) {
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+      acc[i] -= removed[j][i];
+    }
+  }
+#endif
+}
+
+void nnue_refresh(board_t *board) {
+  const nnue_network_t *network = board->network;
+
+  for (int perspective = WHITE; perspective <= BLACK; ++perspective) {
+    short *acc = board->accumulator.values[perspective];
+    memcpy(acc, network->l1_bias, sizeof(network->l1_bias));
+
+    for (int i = 0; i < board->piece_count; ++i) {
+      piece_t *piece = &board->pieces[i];
+
+      if (piece->square == NULL) {
+        continue;
+      }
+
+      const short *row =
+          network->l1_weights[feature_index(
+              piece->type, piece->color,
+              piece->square->rank * 8 + piece->square->file, perspective)];
+      update_accumulator(acc, &row, 1, NULL, 0);
+    }
+  }
+}
+
+void nnue_attach(board_t *board, const nnue_network_t *network) {
+  board->network = network;
+
+  if (network != NULL) {
+    nnue_refresh(board);
+  }
+}
+
+// Applies the feature changes of a move made by color, or reverts them when
+// undoing. Everything needed is in the move and its undo record.
+void nnue_update_move(board_t *board, move_t move, const undo_t *undo,
+                      piece_color_t color, bool undoing) {
+  const nnue_network_t *network = board->network;
+  int from = move.from_rank * 8 + move.from_file;
+  int to = move.to_rank * 8 + move.to_file;
+  piece_type_t type = undo->type;
+
+  if (type == PAWN && (move.to_rank == 0 || move.to_rank == 7)) {
+    type = move.promotion;
+  }
+
+  for (int perspective = WHITE; perspective <= BLACK; ++perspective) {
+    const short *added[2], *removed[3];
+    int added_count = 0, removed_count = 0;
+
+    added[added_count++] =
+        network->l1_weights[feature_index(type, color, to, perspective)];
+    removed[removed_count++] = network->l1_weights[feature_index(
+        undo->type, color, from, perspective)];
+
+    if (undo->captured != NULL) {
+      int square =
+          undo->captured_square->rank * 8 + undo->captured_square->file;
+      removed[removed_count++] = network->l1_weights[feature_index(
+          undo->captured->type, undo->captured->color, square, perspective)];
+    }
+
+    if (undo->type == KING && abs(move.to_file - move.from_file) == 2) {
+      int rank = move.from_rank * 8;
+      int rook_from = rank + (move.to_file == 6 ? 7 : 0);
+      int rook_to = rank + (move.to_file == 6 ? 5 : 3);
+
+      added[added_count++] =
+          network->l1_weights[feature_index(ROOK, color, rook_to, perspective)];
+      removed[removed_count++] = network->l1_weights[feature_index(
+          ROOK, color, rook_from, perspective)];
+    }
+
+    short *acc = board->accumulator.values[perspective];
+
+    if (undoing) {
+      update_accumulator(acc, removed, removed_count, added, added_count);
+    } else {
+      update_accumulator(acc, added, added_count, removed, removed_count);
+    }
+  }
+}
+
+// Clips an accumulator to [0, NNUE_QA] as bytes.
+void clip_accumulator(const short *acc, unsigned char *out) {
+#if defined(NNUE_AVX2)
+  const __m256i limit = _mm256_set1_epi8(NNUE_QA);
+
+  for (int i = 0; i < NNUE_HIDDEN; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(acc + i + 16));
+    // packus works within 128-bit lanes, so the quadwords are put back in
+    // order afterwards.
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+    _mm256_store_si256((__m256i *)(out + i), _mm256_min_epu8(packed, limit));
+  }
+#elif defined(NNUE_SSE4)
+  const __m128i limit = _mm_set1_epi8(NNUE_QA);
+
+  for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(acc + i + 8));
+    _mm_store_si128((__m128i *)(out + i),
+                    _mm_min_epu8(_mm_packus_epi16(a, b), limit));
+  }
+#else
+  for (int i = 0; i < NNUE_HIDDEN; ++i) {
+    out[i] = acc[i] < 0 ? 0 : acc[i] > NNUE_QA ? NNUE_QA : acc[i];
+  }
+#endif
+}
+
+// Dot product of clipped inputs with one row of second-layer weights. Inputs
+// are at most NNUE_QA, so pairwise products cannot saturate 16 bits.
+int dot_product(const unsigned char *input, const signed char *weights) {
+#if defined(NNUE_AVX2)
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i sum = _mm256_setzero_si256();
+
+  for (int i = 0; i < 2 * NNUE_HIDDEN; i += 32) {
+    __m256i products = _mm256_maddubs_epi16(
+        _mm256_load_si256((const __m256i *)(input + i)),
+        _mm256_load_si256((const __m256i *)(weights + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+  }
+
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                               _mm256_extracti128_si256(sum, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+  return _mm_cvtsi128_si32(half);
+#elif defined(NNUE_SSE4)
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i sum = _mm_setzero_si128();
+
+  for (int i = 0; i < 2 * NNUE_HIDDEN; i += 16) {
+    __m128i products =
+        _mm_maddubs_epi16(_mm_load_si128((const __m128i *)(input + i)),
+                          _mm_load_si128((const __m128i *)(weights + i)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+  }
+
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return _mm_cvtsi128_si32(sum);
+#else
+  int sum = 0;
+
+  for (int i = 0; i < 2 * NNUE_HIDDEN; ++i) {
+    sum += input[i] * weights[i];
+  }
+
+  return sum;
+#endif
+}
+
+// Returns the evaluation in centipawns from the side to move's point of view.
+int nnue_evaluate(const board_t *board) {
+  const nnue_network_t *network = board->network;
+  _Alignas(32) unsigned char input[2 * NNUE_HIDDEN];
+
+  clip_accumulator(board->accumulator.values[board->side_to_move], input);
+  clip_accumulator(board->accumulator.values[1 - board->side_to_move],
+                   input + NNUE_HIDDEN);
+
+  int output = network->l3_bias;
+
+  for (int i = 0; i < NNUE_L2; ++i) {
+    int sum = network->l2_bias[i] + dot_product(input, network->l2_weights[i]);
+    int hidden = sum < 0 ? 0 : sum >> NNUE_L2_SHIFT;
+    output += (hidden > NNUE_QA ? NNUE_QA : hidden) * network->l3_weights[i];
+  }
+
+  return output * network->output_scale / 1024;
+}
+
+const char *nnue_kernel_name(void) {
+#if defined(NNUE_AVX2)
+  return "avx2";
+#elif defined(NNUE_SSE4)
+  return "sse4.1";
+#else
+  return "scalar";
+#endif
+}
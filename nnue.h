@@ -0,0 +1,14 @@
+#include "types.h"
+
+#pragma once
+
+nnue_network_t *load_network(const char *path);
+bool save_network(const nnue_network_t *network, const char *path);
+nnue_network_t *create_material_network(void);
+void free_network(nnue_network_t *network);
+void nnue_attach(board_t *board, const nnue_network_t *network);
+void nnue_refresh(board_t *board);
+void nnue_update_move(board_t *board, move_t move, const undo_t *undo,
+                      piece_color_t color, bool undoing);
+int nnue_evaluate(const board_t *board);
+const char *nnue_kernel_name(void);
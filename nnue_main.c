@@ -0,0 +1,193 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "nnue.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_GAMES 200
+#define BENCH_PLIES 120
+
+double now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+int evaluate_fen(const char *path, const char *fen) {
+  nnue_network_t *network = load_network(path);
+  board_t *board = create_board();
+  piece_color_t color;
+
+  if (network == NULL || board == NULL) {
+    fprintf(stderr, "nnue: could not load %s\n", path);
+    return 1;
+  }
+
+  nnue_attach(board, network);
+
+  if (load_fen(board, fen, &color) == NULL) {
+    fprintf(stderr, "nnue: invalid FEN: %s\n", fen);
+    return 1;
+  }
+
+  printf("%d cp (side to move), kernels %s\n", nnue_evaluate(board),
+         nnue_kernel_name());
+
+  free_board(board);
+  free_network(network);
+  return 0;
+}
+
+// Plays random games, checking after every move and unmove that the
+// incrementally updated accumulator matches a full refresh, then times
+// make/unmake with and without the network and the evaluation itself.
+int bench_network(const char *path) {
+  nnue_network_t *network = load_network(path);
+  board_t *board = create_board();
+  board_t *scratch = create_board();
+
+  if (network == NULL || board == NULL || scratch == NULL) {
+    fprintf(stderr, "nnue: could not load %s\n", path);
+    return 1;
+  }
+
+  static move_t games[BENCH_GAMES][BENCH_PLIES];
+  static int lengths[BENCH_GAMES];
+  piece_color_t color;
+  long mismatches = 0;
+  srand(1);
+
+  for (int game = 0; game < BENCH_GAMES; ++game) {
+    nnue_attach(board, network);
+    load_fen(board, START_FEN, &color);
+    undo_t undos[BENCH_PLIES];
+    int ply = 0;
+
+    for (; ply < BENCH_PLIES; ++ply) {
+      move_list_t moves;
+      generate_legal_moves(board, board->side_to_move, &moves);
+
+      if (moves.length == 0) {
+        break;
+      }
+
+      games[game][ply] = moves.moves[rand() % moves.length];
+      make_move(board, games[game][ply], &undos[ply]);
+
+      copy_board(scratch, board);
+      nnue_refresh(scratch);
+      mismatches += memcmp(&scratch->accumulator, &board->accumulator,
+                           sizeof(accumulator_t)) != 0;
+    }
+
+    lengths[game] = ply;
+
+    while (ply-- > 0) {
+      unmake_move(board, games[game][ply], &undos[ply]);
+
+      copy_board(scratch, board);
+      nnue_refresh(scratch);
+      mismatches += memcmp(&scratch->accumulator, &board->accumulator,
+                           sizeof(accumulator_t)) != 0;
+    }
+  }
+
+  double timings[2];
+  long moves_played = 0;
+
+  for (int pass = 0; pass < 2; ++pass) {
+    nnue_attach(board, pass == 0 ? NULL : network);
+    load_fen(board, START_FEN, &color);
+    moves_played = 0;
+    double start = now_ns();
+
+    for (int game = 0; game < BENCH_GAMES; ++game) {
+      undo_t undos[BENCH_PLIES];
+
+      for (int ply = 0; ply < lengths[game]; ++ply) {
+        make_move(board, games[game][ply], &undos[ply]);
+      }
+
+      for (int ply = lengths[game] - 1; ply >= 0; --ply) {
+        unmake_move(board, games[game][ply], &undos[ply]);
+      }
+
+      moves_played += 2 * lengths[game];
+    }
+
+    timings[pass] = (now_ns() - start) / moves_played;
+  }
+
+  long evaluations = 0;
+  volatile int sink = 0;
+  double start = now_ns();
+
+  for (int game = 0; game < BENCH_GAMES; ++game) {
+    undo_t undos[BENCH_PLIES];
+
+    for (int ply = 0; ply < lengths[game]; ++ply) {
+      make_move(board, games[game][ply], &undos[ply]);
+      sink += nnue_evaluate(board);
+      evaluations++;
+    }
+
+    for (int ply = lengths[game] - 1; ply >= 0; --ply) {
+      unmake_move(board, games[game][ply], &undos[ply]);
+    }
+  }
+
+  double evaluate_ns =
+      (now_ns() - start) / evaluations - timings[1] / 2;
+  (void)sink;
+
+  printf("kernels: %s\n", nnue_kernel_name());
+  printf("accumulator mismatches: %ld\n", mismatches);
+  printf("make/unmake: %.1f ns without network, %.1f ns with (%+.1f ns)\n",
+         timings[0], timings[1], timings[1] - timings[0]);
+  printf("evaluate: %.1f ns\n", evaluate_ns);
+
+  free_board(board);
+  free_board(scratch);
+  free_network(network);
+  return mismatches == 0 ? 0 : 1;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s init NETWORK\n"
+          "       %s eval NETWORK [FEN]\n"
+          "       %s bench NETWORK\n",
+          program, program, program);
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "init") == 0) {
+    nnue_network_t *network = create_material_network();
+
+    if (network == NULL || !save_network(network, argv[2])) {
+      fprintf(stderr, "nnue: could not write %s\n", argv[2]);
+      return 1;
+    }
+
+    free_network(network);
+    return 0;
+  }
+
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "eval") == 0) {
+    return evaluate_fen(argv[2], argc == 4 ? argv[3] : START_FEN);
+  }
+
+  if (argc == 3 && strcmp(argv[1], "bench") == 0) {
+    return bench_network(argv[2]);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
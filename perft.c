@@ -0,0 +1,236 @@
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "perft.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Subtrees at or below this depth are counted by a single task.
+#define PERFT_SPLIT_DEPTH 4
+
+// Entries are written without locks: check holds key ^ data, so an entry torn
+// by a concurrent write simply fails to match its key.
+typedef struct PerftEntry {
+  _Atomic unsigned long long check;
+  _Atomic unsigned long long data;
+} perft_entry_t;
+
+struct PerftTable {
+  perft_entry_t *entries;
+  size_t mask;
+};
+
+perft_table_t *create_perft_table(size_t megabytes) {
+  size_t count = 1;
+
+  while (count * 2 * sizeof(perft_entry_t) <= megabytes * 1024 * 1024) {
+    count *= 2;
+  }
+
+  perft_table_t *table = malloc(sizeof(perft_table_t));
+
+  if (!table) {
+    return NULL;
+  }
+
+  table->entries = calloc(count, sizeof(perft_entry_t));
+
+  if (!table->entries) {
+    free(table);
+    return NULL;
+  }
+
+  table->mask = count - 1;
+  return table;
+}
+
+void free_perft_table(perft_table_t *table) {
+  free(table->entries);
+  free(table);
+}
+
+bool probe_perft_table(perft_table_t *table, unsigned long long hash,
+                       int depth, unsigned long long *nodes) {
+  perft_entry_t *entry = &table->entries[hash & table->mask];
+  unsigned long long data =
+      atomic_load_explicit(&entry->data, memory_order_relaxed);
+  unsigned long long check =
+      atomic_load_explicit(&entry->check, memory_order_relaxed);
+
+  if ((check ^ data) != hash || (int)(data & 0xff) != depth) {
+    return false;
+  }
+
+  *nodes = data >> 8;
+  return true;
+}
+
+void store_perft_table(perft_table_t *table, unsigned long long hash,
+                       int depth, unsigned long long nodes) {
+  perft_entry_t *entry = &table->entries[hash & table->mask];
+  unsigned long long data = nodes << 8 | depth;
+
+  atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+  atomic_store_explicit(&entry->check, hash ^ data, memory_order_relaxed);
+}
+
+unsigned long long perft(board_t *board, piece_color_t color, int depth,
+                         perft_table_t *table) {
+  if (depth == 0) {
+    return 1;
+  }
+
+  move_list_t moves;
+  generate_legal_moves(board, color, &moves);
+
+  if (depth == 1) {
+    return moves.length;
+  }
+
+  unsigned long long nodes;
+
+  if (table != NULL && probe_perft_table(table, board->hash, depth, &nodes)) {
+    return nodes;
+  }
+
+  nodes = 0;
+  piece_color_t opposite_color = color == WHITE ? BLACK : WHITE;
+
+  for (int i = 0; i < moves.length; ++i) {
+    undo_t undo;
+    make_move(board, moves.moves[i], &undo);
+    nodes += perft(board, opposite_color, depth - 1, table);
+    unmake_move(board, moves.moves[i], &undo);
+  }
+
+  if (table != NULL) {
+    store_perft_table(table, board->hash, depth, nodes);
+  }
+
+  return nodes;
+}
+
+typedef struct PerftJob {
+  perft_table_t *table;
+  _Atomic unsigned long long *root_nodes;
+} perft_job_t;
+
+typedef struct PerftTask {
+  perft_job_t *job;
+  board_t board;
+  piece_color_t color;
+  int depth;
+  int root;
+} perft_task_t;
+
+void run_perft_task(thread_pool_t *pool, int worker, void *arg);
+
+// Queues one task per legal move, each on its own copy of the board.
+void split_perft_task(thread_pool_t *pool, int worker, perft_task_t *task,
+                      move_list_t *moves, bool root) {
+  for (int i = 0; i < moves->length; ++i) {
+    perft_task_t *child = malloc(sizeof(perft_task_t));
+
+    piece_color_t opposite_color = task->color == WHITE ? BLACK : WHITE;
+    int root_index = root ? i : task->root;
+    undo_t undo;
+
+    if (!child) {
+      make_move(&task->board, moves->moves[i], &undo);
+      atomic_fetch_add(&task->job->root_nodes[root_index],
+                       perft(&task->board, opposite_color, task->depth - 1,
+                             task->job->table));
+      unmake_move(&task->board, moves->moves[i], &undo);
+      continue;
+    }
+
+    copy_board(&child->board, &task->board);
+    make_move(&child->board, moves->moves[i], &undo);
+    child->job = task->job;
+    child->color = opposite_color;
+    child->depth = task->depth - 1;
+    child->root = root_index;
+    thread_pool_submit(pool, worker, run_perft_task, child);
+  }
+}
+
+void run_perft_task(thread_pool_t *pool, int worker, void *arg) {
+  perft_task_t *task = arg;
+
+  if (task->depth <= PERFT_SPLIT_DEPTH) {
+    atomic_fetch_add(&task->job->root_nodes[task->root],
+                     perft(&task->board, task->color, task->depth,
+                           task->job->table));
+    free(task);
+    return;
+  }
+
+  move_list_t moves;
+  generate_legal_moves(&task->board, task->color, &moves);
+  split_perft_task(pool, worker, task, &moves, false);
+  free(task);
+}
+
+// Counts the same nodes as perft, spreading root moves and, below them, any
+// subtree deeper than PERFT_SPLIT_DEPTH across a work-stealing pool. When
+// root_moves and root_nodes are given they receive the per-move breakdown.
+unsigned long long parallel_perft(board_t *board, piece_color_t color,
+                                  int depth, perft_table_t *table,
+                                  int threads, move_list_t *root_moves,
+                                  unsigned long long *root_nodes) {
+  move_list_t moves;
+  generate_legal_moves(board, color, &moves);
+
+  if (root_moves != NULL) {
+    *root_moves = moves;
+  }
+
+  if (depth <= 1) {
+    for (int i = 0; root_nodes != NULL && i < moves.length; ++i) {
+      root_nodes[i] = depth == 1;
+    }
+    return depth == 1 ? (unsigned long long)moves.length : 1;
+  }
+
+  thread_pool_t *pool = create_thread_pool(threads);
+  _Atomic unsigned long long *counts =
+      calloc(moves.length, sizeof(_Atomic unsigned long long));
+  perft_task_t *root = malloc(sizeof(perft_task_t));
+
+  if (pool == NULL || counts == NULL || root == NULL) {
+    if (pool != NULL) {
+      free_thread_pool(pool);
+    }
+    free(counts);
+    free(root);
+    return perft(board, color, depth, table);
+  }
+
+  perft_job_t job = {table, counts};
+  copy_board(&root->board, board);
+  root->job = &job;
+  root->color = color;
+  root->depth = depth;
+  root->root = 0;
+
+  split_perft_task(pool, -1, root, &moves, true);
+  thread_pool_wait(pool);
+  free_thread_pool(pool);
+  free(root);
+
+  unsigned long long nodes = 0;
+
+  for (int i = 0; i < moves.length; ++i) {
+    nodes += counts[i];
+
+    if (root_nodes != NULL) {
+      root_nodes[i] = counts[i];
+    }
+  }
+
+  free(counts);
+  return nodes;
+}
@@ -0,0 +1,14 @@
+#include "types.h"
+
+#pragma once
+
+typedef struct PerftTable perft_table_t;
+
+perft_table_t *create_perft_table(size_t megabytes);
+void free_perft_table(perft_table_t *table);
+unsigned long long perft(board_t *board, piece_color_t color, int depth,
+                         perft_table_t *table);
+unsigned long long parallel_perft(board_t *board, piece_color_t color,
+                                  int depth, perft_table_t *table,
+                                  int threads, move_list_t *root_moves,
+                                  unsigned long long *root_nodes);
@@ -0,0 +1,296 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "perft.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct PerftSuiteEntry {
+  const char *fen;
+  int max_depth;
+  unsigned long long nodes[8];
+} perft_suite_entry_t;
+
+// Published node counts for the standard perft positions, indexed by depth.
+perft_suite_entry_t perft_suite[] = {
+    {START_FEN,
+     7,
+     {1, 20, 400, 8902, 197281, 4865609, 119060324, 3195901860ULL}},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+     6,
+     {1, 48, 2039, 97862, 4085603, 193690690, 8031647685ULL}},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+     7,
+     {1, 14, 191, 2812, 43238, 674624, 11030083, 178633661}},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+     6,
+     {1, 6, 264, 9467, 422333, 15833292, 706045033}},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+     5,
+     {1, 44, 1486, 62379, 2103487, 89941194}},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 "
+     "10",
+     6,
+     {1, 46, 2079, 89890, 3894594, 164075551, 6923051137ULL}},
+};
+
+#define SUITE_SIZE (int)(sizeof(perft_suite) / sizeof(perft_suite[0]))
+// The hash table stores depths in 8 bits.
+#define MAX_PERFT_DEPTH 255
+
+typedef struct PerftOptions {
+  int threads;
+  size_t hash_megabytes;
+  bool serial;
+  bool divide;
+  // Counts for the boards perft runs on, or NULL without --stats.
+  stats_t *stats;
+} perft_options_t;
+
+double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Counts the nodes below each root move one move after another, as
+// parallel_perft does across threads.
+unsigned long long divided_perft(board_t *board, piece_color_t color,
+                                 int depth, perft_table_t *table,
+                                 move_list_t *moves,
+                                 unsigned long long *root_nodes) {
+  piece_color_t opposite_color = color == WHITE ? BLACK : WHITE;
+  unsigned long long nodes = 0;
+  generate_legal_moves(board, color, moves);
+
+  for (int i = 0; i < moves->length; ++i) {
+    undo_t undo;
+    make_move(board, moves->moves[i], &undo);
+    root_nodes[i] =
+        depth > 0 ? perft(board, opposite_color, depth - 1, table) : 0;
+    unmake_move(board, moves->moves[i], &undo);
+    nodes += root_nodes[i];
+  }
+
+  return depth > 0 ? nodes : 1;
+}
+
+// Runs one perft with a fresh hash table, returning the node count and
+// storing the elapsed time in seconds.
+unsigned long long timed_perft(board_t *board, piece_color_t color, int depth,
+                               perft_options_t *options, int threads,
+                               double *seconds) {
+  perft_table_t *table = NULL;
+
+  if (options->hash_megabytes > 0) {
+    table = create_perft_table(options->hash_megabytes);
+  }
+
+  move_list_t moves;
+  unsigned long long root_nodes[256];
+  unsigned long long nodes;
+  double start = now_seconds();
+
+  if (options->serial && options->divide) {
+    nodes = divided_perft(board, color, depth, table, &moves, root_nodes);
+  } else if (options->serial) {
+    nodes = perft(board, color, depth, table);
+  } else {
+    nodes = parallel_perft(board, color, depth, table, threads, &moves,
+                           root_nodes);
+  }
+
+  *seconds = now_seconds() - start;
+
+  if (options->divide) {
+    for (int i = 0; i < moves.length; ++i) {
+      move_t move = moves.moves[i];
+      const char promotions[] = "pnbrqk";
+
+      printf("%c%d%c%d", 'a' + move.from_file, move.from_rank + 1,
+             'a' + move.to_file, move.to_rank + 1);
+
+      if (move.promotion != PAWN) {
+        printf("%c", promotions[move.promotion]);
+      }
+
+      printf(": %llu\n", root_nodes[i]);
+    }
+  }
+
+  if (table != NULL) {
+    free_perft_table(table);
+  }
+
+  return nodes;
+}
+
+bool run_suite(int depth, perft_options_t *options) {
+  board_t *board = create_board();
+  bool passed = true;
+
+  if (board == NULL) {
+    return false;
+  }
+
+  board->stats = options->stats;
+
+  for (int i = 0; i < SUITE_SIZE; ++i) {
+    piece_color_t color;
+    load_fen(board, perft_suite[i].fen, &color);
+
+    int max_depth =
+        depth < perft_suite[i].max_depth ? depth : perft_suite[i].max_depth;
+
+    for (int d = 1; d <= max_depth; ++d) {
+      double seconds;
+      unsigned long long nodes =
+          timed_perft(board, color, d, options, options->threads, &seconds);
+      bool ok = nodes == perft_suite[i].nodes[d];
+
+      printf("%s position %d depth %d: %llu nodes (expected %llu) %.3fs\n",
+             ok ? "ok  " : "FAIL", i + 1, d, nodes, perft_suite[i].nodes[d],
+             seconds);
+      passed = passed && ok;
+    }
+  }
+
+  free_board(board);
+  return passed;
+}
+
+// Reports the speedup of 1, 2, 4, ... threads up to options->threads.
+void run_scaling(board_t *board, piece_color_t color, int depth,
+                 perft_options_t *options) {
+  double base_seconds = 0;
+  int max_threads = options->threads > 0 ? options->threads
+                                         : default_thread_count();
+
+  int threads = 1;
+
+  while (true) {
+    double seconds;
+    unsigned long long nodes =
+        timed_perft(board, color, depth, options, threads, &seconds);
+
+    if (threads == 1) {
+      base_seconds = seconds;
+    }
+
+    printf("threads %2d: %llu nodes %.3fs %.0f nodes/s speedup %.2fx\n",
+           threads, nodes, seconds, nodes / seconds, base_seconds / seconds);
+
+    if (threads == max_threads) {
+      break;
+    }
+
+    threads = threads * 2 < max_threads ? threads * 2 : max_threads;
+  }
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--threads N] [--hash MB] [--serial] [--divide] "
+          "[--scaling] [--suite] [--stats] [depth] [fen]\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  perft_options_t options = {0, 64, false, false, NULL};
+  stats_t stats = {0};
+  bool suite = false;
+  bool scaling = false;
+  int depth = 5;
+  const char *fen = START_FEN;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      options.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+      options.hash_megabytes = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--serial") == 0) {
+      options.serial = true;
+    } else if (strcmp(argv[i], "--divide") == 0) {
+      options.divide = true;
+    } else if (strcmp(argv[i], "--scaling") == 0) {
+      scaling = true;
+    } else if (strcmp(argv[i], "--suite") == 0) {
+      suite = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options.stats = &stats;
+    } else if (argv[i][0] >= '0' && argv[i][0] <= '9' &&
+               strchr(argv[i], '/') == NULL) {
+      // A FEN always has slashes, so anything else starting with a digit
+      // must be the depth.
+      char *end;
+      errno = 0;
+      long value = strtol(argv[i], &end, 10);
+
+      if (*end != '\0' || errno != 0 || value > MAX_PERFT_DEPTH) {
+        fprintf(stderr, "perft: invalid depth: %s\n", argv[i]);
+        return 1;
+      }
+
+      depth = (int)value;
+    } else if (argv[i][0] != '-') {
+      fen = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (suite) {
+    bool passed = run_suite(depth, &options);
+
+    if (options.stats != NULL) {
+      stats_print(stdout, options.stats);
+    }
+
+    return passed ? 0 : 1;
+  }
+
+  board_t *board = create_board();
+  piece_color_t color;
+
+  if (board == NULL) {
+    return 1;
+  }
+
+  if (load_fen(board, fen, &color) == NULL) {
+    fprintf(stderr, "perft: invalid FEN: %s\n", fen);
+    free_board(board);
+    return 1;
+  }
+
+  board->stats = options.stats;
+
+  if (scaling) {
+    options.serial = false;
+    options.divide = false;
+    run_scaling(board, color, depth, &options);
+  } else {
+    double seconds;
+    unsigned long long nodes = timed_perft(board, color, depth, &options,
+                                           options.threads, &seconds);
+
+    printf("depth %d: %llu nodes %.3fs %.0f nodes/s\n", depth, nodes,
+           seconds, nodes / seconds);
+  }
+
+  if (options.stats != NULL) {
+    stats_print(stdout, options.stats);
+  }
+
+  free_board(board);
+  return 0;
+}
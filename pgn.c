@@ -0,0 +1,499 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pgn.h"
+#include "archive.h"
+#include "board.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PGN_LINE_WIDTH 79
+
+typedef struct MovetextState {
+  int comment_depth;
+  int variation_depth;
+  bool seen;
+  bool failed;
+  game_result_t result;
+  piece_color_t color;
+  size_t ply_count;
+} movetext_state_t;
+
+pgn_reader_t *create_pgn_reader(FILE *file) {
+  pgn_reader_t *reader = calloc(1, sizeof(pgn_reader_t));
+
+  if (reader == NULL) {
+    return NULL;
+  }
+
+  reader->file = file;
+  reader->board = create_board();
+  reader->tags_capacity = 1024;
+  reader->tags = malloc(reader->tags_capacity);
+  reader->moves_capacity = 1024;
+  reader->moves = malloc(reader->moves_capacity);
+
+  if (reader->board == NULL || reader->tags == NULL || reader->moves == NULL) {
+    free_pgn_reader(reader);
+    return NULL;
+  }
+
+  return reader;
+}
+
+void free_pgn_reader(pgn_reader_t *reader) {
+  if (reader->board != NULL) {
+    free_board(reader->board);
+  }
+
+  free(reader->line);
+  free(reader->tags);
+  free(reader->moves);
+  free(reader);
+}
+
+bool next_line(pgn_reader_t *reader) {
+  if (reader->line_pending) {
+    reader->line_pending = false;
+    return true;
+  }
+
+  ssize_t length = getline(&reader->line, &reader->line_capacity, reader->file);
+
+  if (length < 0) {
+    return false;
+  }
+
+  while (length > 0 && (reader->line[length - 1] == '\n' ||
+                        reader->line[length - 1] == '\r')) {
+    reader->line[--length] = '\0';
+  }
+
+  return true;
+}
+
+bool is_blank(const char *line) { return line[strspn(line, " \t")] == '\0'; }
+
+bool append_tag_string(pgn_reader_t *reader, const char *str, size_t length) {
+  if (reader->tags_length + length + 1 > reader->tags_capacity) {
+    size_t capacity = 2 * (reader->tags_length + length + 1);
+    char *tags = realloc(reader->tags, capacity);
+
+    if (tags == NULL) {
+      return false;
+    }
+
+    reader->tags = tags;
+    reader->tags_capacity = capacity;
+  }
+
+  memcpy(reader->tags + reader->tags_length, str, length);
+  reader->tags[reader->tags_length + length] = '\0';
+  reader->tags_length += length + 1;
+  return true;
+}
+
+game_result_t parse_result(const char *result) {
+  if (strcmp(result, "1-0") == 0) {
+    return WHITE_WINS;
+  }
+
+  if (strcmp(result, "0-1") == 0) {
+    return BLACK_WINS;
+  }
+
+  if (strcmp(result, "1/2-1/2") == 0) {
+    return DRAWN;
+  }
+
+  return RESULT_UNKNOWN;
+}
+
+const char *result_string(game_result_t result) {
+  switch (result) {
+  case WHITE_WINS:
+    return "1-0";
+  case BLACK_WINS:
+    return "0-1";
+  case DRAWN:
+    return "1/2-1/2";
+  default:
+    return "*";
+  }
+}
+
+// Parses a tag pair line such as [Event "Casual game"]. SetUp and FEN are kept
+// out of the tag block since the archive stores the start position itself.
+bool parse_tag(pgn_reader_t *reader, const char *line,
+               game_result_t *result) {
+  const char *name = line + 1 + strspn(line + 1, " \t");
+  size_t name_length = strcspn(name, " \t\"]");
+  const char *quote = strchr(name + name_length, '"');
+
+  if (name_length == 0 || quote == NULL) {
+    return false;
+  }
+
+  char value[256];
+  size_t value_length = 0;
+
+  for (const char *c = quote + 1; *c != '"'; ++c) {
+    if (*c == '\0' || value_length + 1 >= sizeof(value)) {
+      return false;
+    }
+
+    if (*c == '\\' && (c[1] == '"' || c[1] == '\\')) {
+      c++;
+    }
+
+    value[value_length++] = *c;
+  }
+
+  value[value_length] = '\0';
+
+  if (name_length == 5 && strncmp(name, "SetUp", 5) == 0) {
+    return true;
+  }
+
+  if (name_length == 3 && strncmp(name, "FEN", 3) == 0) {
+    if (value_length >= sizeof(reader->fen)) {
+      return false;
+    }
+
+    memcpy(reader->fen, value, value_length + 1);
+    return true;
+  }
+
+  if (name_length == 6 && strncmp(name, "Result", 6) == 0) {
+    *result = parse_result(value);
+  }
+
+  return append_tag_string(reader, name, name_length) &&
+         append_tag_string(reader, value, value_length);
+}
+
+bool append_move(pgn_reader_t *reader, size_t ply, move_t move) {
+  if (ply >= 0xffff) {
+    return false;
+  }
+
+  if (2 * ply + 2 > reader->moves_capacity) {
+    size_t capacity = 2 * reader->moves_capacity;
+    unsigned char *moves = realloc(reader->moves, capacity);
+
+    if (moves == NULL) {
+      return false;
+    }
+
+    reader->moves = moves;
+    reader->moves_capacity = capacity;
+  }
+
+  unsigned short code = encode_move(move);
+  reader->moves[2 * ply] = code;
+  reader->moves[2 * ply + 1] = code >> 8;
+  return true;
+}
+
+void play_token(pgn_reader_t *reader, movetext_state_t *state, char *token) {
+  game_result_t result = parse_result(token);
+
+  if (result != RESULT_UNKNOWN || strcmp(token, "*") == 0) {
+    state->result = result;
+    return;
+  }
+
+  // Move numbers may be attached to the move, as in 12.e4 or 12...Nf6.
+  token += strspn(token, "0123456789");
+  token += strspn(token, ".");
+
+  if (*token == '\0' || state->failed) {
+    return;
+  }
+
+  if (strncmp(token, "0-0", 3) == 0) {
+    token[0] = token[2] = 'O';
+
+    if (strncmp(token + 3, "-0", 2) == 0) {
+      token[4] = 'O';
+    }
+  }
+
+  move_t move;
+
+  if (!san_to_move(reader->board, token, state->color, &move) ||
+      !append_move(reader, state->ply_count, move)) {
+    state->failed = true;
+    return;
+  }
+
+  undo_t undo;
+  make_move(reader->board, move, &undo);
+  state->color = state->color == WHITE ? BLACK : WHITE;
+  state->ply_count++;
+}
+
+void parse_movetext(pgn_reader_t *reader, movetext_state_t *state,
+                    char *line) {
+  char *c = line;
+
+  while (*c != '\0') {
+    if (state->comment_depth > 0) {
+      char *end = strchr(c, '}');
+
+      if (end == NULL) {
+        return;
+      }
+
+      state->comment_depth = 0;
+      c = end + 1;
+    } else if (*c == '{') {
+      state->comment_depth = 1;
+      c++;
+    } else if (*c == ';') {
+      return;
+    } else if (*c == '(') {
+      state->variation_depth++;
+      c++;
+    } else if (*c == ')') {
+      state->variation_depth -= state->variation_depth > 0;
+      c++;
+    } else if (*c == ' ' || *c == '\t' || state->variation_depth > 0) {
+      c++;
+    } else {
+      size_t length = strcspn(c, " \t{};()");
+      char saved = c[length];
+      c[length] = '\0';
+      state->seen = true;
+
+      if (*c != '$') {
+        play_token(reader, state, c);
+      }
+
+      c[length] = saved;
+      c += length;
+    }
+  }
+}
+
+// Reads the next game into game, whose pointers stay valid until the next
+// call. Returns 1 for a game, 0 at the end of the file and -1 for a game that
+// could not be replayed, which is skipped.
+int read_pgn_game(pgn_reader_t *reader, archive_game_t *game) {
+  do {
+    if (!next_line(reader)) {
+      return 0;
+    }
+  } while (is_blank(reader->line) || reader->line[0] == '%');
+
+  movetext_state_t state = {0};
+  game_result_t tag_result = RESULT_UNKNOWN;
+  bool in_tags = true;
+
+  reader->tags_length = 0;
+  reader->fen[0] = '\0';
+
+  do {
+    char *line = reader->line;
+
+    if (in_tags && line[0] == '[') {
+      state.failed = state.failed || !parse_tag(reader, line, &tag_result);
+      continue;
+    }
+
+    if (in_tags) {
+      in_tags = false;
+      state.failed = state.failed ||
+                     load_fen(reader->board,
+                              reader->fen[0] != '\0' ? reader->fen : START_FEN,
+                              &state.color) == NULL;
+    }
+
+    bool between_games =
+        state.comment_depth == 0 && state.variation_depth == 0;
+
+    if (between_games && is_blank(line) && state.seen) {
+      break;
+    }
+
+    if (between_games && line[0] == '[') {
+      reader->line_pending = true;
+      break;
+    }
+
+    if (line[0] != '%') {
+      parse_movetext(reader, &state, line);
+    }
+  } while (next_line(reader));
+
+  if (state.failed) {
+    return -1;
+  }
+
+  game->tags = reader->tags;
+  game->tags_length = reader->tags_length;
+  game->fen = reader->fen;
+  game->fen_length = strlen(reader->fen);
+  game->result = tag_result != RESULT_UNKNOWN ? tag_result : state.result;
+  game->moves = reader->moves;
+  game->ply_count = state.ply_count;
+  return 1;
+}
+
+// Emits text, starting a new line when it would pass PGN_LINE_WIDTH.
+void write_token(FILE *file, const char *token, int *column) {
+  int length = strlen(token);
+
+  if (*column > 0 && *column + 1 + length > PGN_LINE_WIDTH) {
+    fputc('\n', file);
+    *column = 0;
+  }
+
+  if (*column > 0) {
+    fputc(' ', file);
+    (*column)++;
+  }
+
+  fputs(token, file);
+  *column += length;
+}
+
+void write_tag(FILE *file, const char *name, const char *value) {
+  fprintf(file, "[%s \"", name);
+
+  for (const char *c = value; *c != '\0'; ++c) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', file);
+    }
+
+    fputc(*c, file);
+  }
+
+  fputs("\"]\n", file);
+}
+
+// Archived moves come from a file and are checked before being played.
+bool legal_archive_move(board_t *board, move_t move) {
+  piece_t *piece = board->squares[move.from_rank][move.from_file].piece;
+
+  if (piece == NULL || piece->color != board->side_to_move) {
+    return false;
+  }
+
+  if (piece->type == KING && abs(move.to_file - move.from_file) == 2) {
+    move_t castling;
+    return castle_move(board, move.to_file == 6 ? SHORT : LONG, piece->color,
+                       &castling) &&
+           castling.to_rank == move.to_rank;
+  }
+
+  bool promotes =
+      piece->type == PAWN && (move.to_rank == 0 || move.to_rank == 7);
+
+  return promotes == (move.promotion != PAWN) &&
+         is_legal_move(board, piece,
+                       &board->squares[move.to_rank][move.to_file]);
+}
+
+bool write_pgn_game(FILE *file, board_t *board, const archive_game_t *game) {
+  return write_annotated_pgn_game(file, board, game, NULL);
+}
+
+// As write_pgn_game, adding annotations[ply] (when not NULL) to each move: a
+// suffix such as "?!" after the SAN and a comment in braces after the move.
+bool write_annotated_pgn_game(FILE *file, board_t *board,
+                              const archive_game_t *game,
+                              const pgn_annotation_t *annotations) {
+  piece_color_t color;
+
+  if (!archive_start(board, game, &color)) {
+    return false;
+  }
+
+  const char *tag = game->tags;
+  const char *end = game->tags + game->tags_length;
+
+  while (tag < end) {
+    const char *value = tag + strlen(tag) + 1;
+    write_tag(file, tag, value);
+    tag = value + strlen(value) + 1;
+  }
+
+  if (archive_tag(game, "Result") == NULL) {
+    write_tag(file, "Result", result_string(game->result));
+  }
+
+  int move_number = 1;
+
+  if (game->fen_length > 0) {
+    char fen[128];
+    memcpy(fen, game->fen, game->fen_length);
+    fen[game->fen_length] = '\0';
+
+    char *fullmove = strrchr(fen, ' ');
+
+    if (fullmove != NULL && atoi(fullmove + 1) > 0) {
+      move_number = atoi(fullmove + 1);
+    }
+
+    write_tag(file, "SetUp", "1");
+    write_tag(file, "FEN", fen);
+  }
+
+  fputc('\n', file);
+
+  int column = 0;
+  bool ok = true;
+
+  for (size_t ply = 0; ply < game->ply_count; ++ply) {
+    move_t move = archive_move(game, ply);
+
+    if (!legal_archive_move(board, move)) {
+      ok = false;
+      break;
+    }
+
+    char token[24];
+    const pgn_annotation_t *annotation =
+        annotations != NULL ? &annotations[ply] : NULL;
+
+    // Black's moves are numbered again after a comment.
+    if (color == WHITE || ply == 0 || annotations != NULL) {
+      snprintf(token, sizeof(token), color == WHITE ? "%d." : "%d...",
+               move_number);
+      write_token(file, token, &column);
+    }
+
+    move_to_san(board, move, token);
+
+    if (annotation != NULL && annotation->suffix[0] != '\0') {
+      strncat(token, annotation->suffix, sizeof(token) - strlen(token) - 1);
+    }
+
+    write_token(file, token, &column);
+
+    if (annotation != NULL && annotation->comment[0] != '\0') {
+      char comment[sizeof(annotation->comment) + 2];
+      snprintf(comment, sizeof(comment), "{%s}", annotation->comment);
+      write_token(file, comment, &column);
+    }
+
+    undo_t undo;
+    make_move(board, move, &undo);
+
+    if (color == BLACK) {
+      move_number++;
+    }
+
+    color = color == WHITE ? BLACK : WHITE;
+  }
+
+  write_token(file, result_string(game->result), &column);
+  fputs("\n\n", file);
+
+  return ok;
+}
@@ -0,0 +1,36 @@
+#include "archive.h"
+#include "types.h"
+#include <stdio.h>
+
+#pragma once
+
+typedef struct PgnReader {
+  FILE *file;
+  board_t *board;
+  char *line;
+  size_t line_capacity;
+  bool line_pending;
+  char *tags;
+  size_t tags_length;
+  size_t tags_capacity;
+  char fen[128];
+  unsigned char *moves;
+  size_t moves_capacity;
+} pgn_reader_t;
+
+// Marks and comments added to a move by write_annotated_pgn_game; empty
+// strings add nothing.
+typedef struct PgnAnnotation {
+  char suffix[4];
+  char comment[64];
+} pgn_annotation_t;
+
+pgn_reader_t *create_pgn_reader(FILE *file);
+void free_pgn_reader(pgn_reader_t *reader);
+int read_pgn_game(pgn_reader_t *reader, archive_game_t *game);
+const char *result_string(game_result_t result);
+bool legal_archive_move(board_t *board, move_t move);
+bool write_pgn_game(FILE *file, board_t *board, const archive_game_t *game);
+bool write_annotated_pgn_game(FILE *file, board_t *board,
+                              const archive_game_t *game,
+                              const pgn_annotation_t *annotations);
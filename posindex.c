@@ -0,0 +1,509 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "posindex.h"
+#include "archive.h"
+#include "board.h"
+#include "move_piece.h"
+#include "pgn.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The index file is a 16-byte header ("TCPI", u32 version, u64 entry count)
+// followed by the entries sorted by key, game and ply, in native byte order
+// so that it can be searched in place once mapped.
+#define POSITION_INDEX_MAGIC "TCPI"
+#define POSITION_INDEX_VERSION 1
+#define GAMES_PER_TASK 256
+#define MERGE_BUFFER_ENTRIES 8192
+
+typedef struct PositionIndexHeader {
+  char magic[4];
+  unsigned int version;
+  unsigned long long count;
+} position_index_header_t;
+
+// Each worker fills its own buffer; a full buffer is sorted and written out
+// as a run, and the runs are merged into the index once every game is done.
+typedef struct IndexBuild {
+  archive_t *archive;
+  const char *index_path;
+  position_entry_t **buffers;
+  size_t *lengths;
+  board_t **boards;
+  size_t capacity;
+  pthread_mutex_t lock;
+  char **runs;
+  size_t run_count;
+  size_t run_capacity;
+  atomic_bool failed;
+} index_build_t;
+
+typedef struct IndexTask {
+  index_build_t *build;
+  size_t first;
+  size_t last;
+} index_task_t;
+
+typedef struct RunReader {
+  FILE *file;
+  position_entry_t *buffer;
+  size_t length;
+  size_t position;
+} run_reader_t;
+
+int compare_entries(const void *a, const void *b) {
+  const position_entry_t *x = a, *y = b;
+
+  if (x->key != y->key) {
+    return x->key < y->key ? -1 : 1;
+  }
+
+  if (POSITION_GAME(x) != POSITION_GAME(y)) {
+    return POSITION_GAME(x) < POSITION_GAME(y) ? -1 : 1;
+  }
+
+  return (x->ply > y->ply) - (x->ply < y->ply);
+}
+
+void flush_run(index_build_t *build, int worker) {
+  size_t length = build->lengths[worker];
+
+  if (length == 0) {
+    return;
+  }
+
+  qsort(build->buffers[worker], length, sizeof(position_entry_t),
+        compare_entries);
+  build->lengths[worker] = 0;
+
+  char *name = malloc(strlen(build->index_path) + 32);
+
+  pthread_mutex_lock(&build->lock);
+
+  if (name != NULL && build->run_count == build->run_capacity) {
+    size_t capacity = build->run_capacity == 0 ? 16 : 2 * build->run_capacity;
+    char **runs = realloc(build->runs, capacity * sizeof(char *));
+
+    if (runs != NULL) {
+      build->runs = runs;
+      build->run_capacity = capacity;
+    }
+  }
+
+  if (name == NULL || build->run_count == build->run_capacity) {
+    pthread_mutex_unlock(&build->lock);
+    free(name);
+    atomic_store(&build->failed, true);
+    return;
+  }
+
+  sprintf(name, "%s.run%zu", build->index_path, build->run_count);
+  build->runs[build->run_count++] = name;
+  pthread_mutex_unlock(&build->lock);
+
+  FILE *file = fopen(name, "wb");
+
+  if (file == NULL ||
+      fwrite(build->buffers[worker], sizeof(position_entry_t), length, file) !=
+          length) {
+    atomic_store(&build->failed, true);
+  }
+
+  if (file != NULL && fclose(file) != 0) {
+    atomic_store(&build->failed, true);
+  }
+}
+
+// Replays game on board to check every move, leaving board at its start.
+bool valid_archive_game(board_t *board, const archive_game_t *game) {
+  piece_color_t color;
+
+  for (size_t ply = 0; ply < game->ply_count; ++ply) {
+    move_t move = archive_move(game, ply);
+    undo_t undo;
+
+    if (!legal_archive_move(board, move)) {
+      return false;
+    }
+
+    make_move(board, move, &undo);
+  }
+
+  return archive_start(board, game, &color);
+}
+
+// Replays a range of games, recording the position before every move and
+// the final position of each game. A game with an illegal move is left out.
+// Its entries are taken back from the buffer, which is flushed beforehand if
+// the game might not fit; a game longer than the whole buffer is checked
+// before it is recorded.
+void run_index_task(thread_pool_t *pool, int worker, void *arg) {
+  (void)pool;
+
+  index_task_t *task = arg;
+  index_build_t *build = task->build;
+  board_t *board = build->boards[worker];
+
+  for (size_t i = task->first; i < task->last; ++i) {
+    archive_game_t game;
+    piece_color_t color;
+
+    if (!archive_game(build->archive, i, &game) ||
+        !archive_start(board, &game, &color)) {
+      continue;
+    }
+
+    if (build->lengths[worker] + game.ply_count + 1 > build->capacity) {
+      flush_run(build, worker);
+    }
+
+    if (game.ply_count + 1 > build->capacity &&
+        !valid_archive_game(board, &game)) {
+      fprintf(stderr, "posindex: skipping corrupt game %zu\n", i);
+      continue;
+    }
+
+    unsigned int game_info = (unsigned int)i | (unsigned int)game.result << 30;
+    size_t start = build->lengths[worker];
+
+    for (size_t ply = 0; ply <= game.ply_count; ++ply) {
+      if (build->lengths[worker] == build->capacity) {
+        flush_run(build, worker);
+      }
+
+      position_entry_t *entry =
+          &build->buffers[worker][build->lengths[worker]++];
+      entry->key = board->hash;
+      entry->game = game_info;
+      entry->ply = ply;
+      entry->move = 0;
+
+      if (ply == game.ply_count) {
+        break;
+      }
+
+      move_t move = archive_move(&game, ply);
+
+      if (!legal_archive_move(board, move)) {
+        fprintf(stderr, "posindex: skipping corrupt game %zu\n", i);
+        build->lengths[worker] = start;
+        break;
+      }
+
+      entry->move = encode_move(move);
+
+      undo_t undo;
+      make_move(board, move, &undo);
+    }
+  }
+
+  free(task);
+}
+
+bool refill_run(run_reader_t *run) {
+  run->length =
+      fread(run->buffer, sizeof(position_entry_t), MERGE_BUFFER_ENTRIES,
+            run->file);
+  run->position = 0;
+  return run->length > 0;
+}
+
+bool run_less(run_reader_t *runs, int a, int b) {
+  return compare_entries(&runs[a].buffer[runs[a].position],
+                         &runs[b].buffer[runs[b].position]) < 0;
+}
+
+void sift_down(run_reader_t *runs, int *heap, int size, int i) {
+  while (true) {
+    int smallest = i;
+    int left = 2 * i + 1, right = 2 * i + 2;
+
+    if (left < size && run_less(runs, heap[left], heap[smallest])) {
+      smallest = left;
+    }
+
+    if (right < size && run_less(runs, heap[right], heap[smallest])) {
+      smallest = right;
+    }
+
+    if (smallest == i) {
+      return;
+    }
+
+    int swap = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = swap;
+    i = smallest;
+  }
+}
+
+// Merges the sorted runs into the index through a heap of run heads. The
+// index is written under a temporary name and renamed once complete.
+bool merge_runs(index_build_t *build) {
+  int count = build->run_count;
+  run_reader_t *runs = calloc(count + 1, sizeof(run_reader_t));
+  int *heap = malloc((count + 1) * sizeof(int));
+  char *temp_path = malloc(strlen(build->index_path) + 8);
+  bool ok = runs != NULL && heap != NULL && temp_path != NULL;
+  int size = 0;
+
+  for (int i = 0; ok && i < count; ++i) {
+    runs[i].file = fopen(build->runs[i], "rb");
+    runs[i].buffer = malloc(MERGE_BUFFER_ENTRIES * sizeof(position_entry_t));
+    ok = runs[i].file != NULL && runs[i].buffer != NULL;
+
+    if (ok && refill_run(&runs[i])) {
+      heap[size++] = i;
+    }
+  }
+
+  FILE *output = NULL;
+
+  if (ok) {
+    sprintf(temp_path, "%s.tmp", build->index_path);
+    output = fopen(temp_path, "wb");
+    ok = output != NULL;
+  }
+
+  position_index_header_t header = {.version = POSITION_INDEX_VERSION};
+  memcpy(header.magic, POSITION_INDEX_MAGIC, 4);
+
+  if (ok) {
+    setvbuf(output, NULL, _IOFBF, 1 << 20);
+    ok = fwrite(&header, sizeof(header), 1, output) == 1;
+  }
+
+  for (int i = size / 2 - 1; i >= 0; --i) {
+    sift_down(runs, heap, size, i);
+  }
+
+  while (ok && size > 0) {
+    run_reader_t *run = &runs[heap[0]];
+    ok = fwrite(&run->buffer[run->position], sizeof(position_entry_t), 1,
+                output) == 1;
+    header.count++;
+
+    if (++run->position == run->length && !refill_run(run)) {
+      heap[0] = heap[--size];
+    }
+
+    sift_down(runs, heap, size, 0);
+  }
+
+  if (output != NULL) {
+    ok = ok && fseek(output, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, output) == 1;
+    ok = fclose(output) == 0 && ok;
+    ok = ok && rename(temp_path, build->index_path) == 0;
+
+    if (!ok) {
+      remove(temp_path);
+    }
+  }
+
+  for (int i = 0; runs != NULL && i < count; ++i) {
+    if (runs[i].file != NULL) {
+      fclose(runs[i].file);
+    }
+
+    free(runs[i].buffer);
+  }
+
+  free(runs);
+  free(heap);
+  free(temp_path);
+  return ok;
+}
+
+void free_index_build(index_build_t *build, int threads) {
+  for (int i = 0; i < threads; ++i) {
+    free(build->buffers[i]);
+
+    if (build->boards[i] != NULL) {
+      free_board(build->boards[i]);
+    }
+  }
+
+  for (size_t i = 0; i < build->run_count; ++i) {
+    remove(build->runs[i]);
+    free(build->runs[i]);
+  }
+
+  free(build->buffers);
+  free(build->boards);
+  free(build->lengths);
+  free(build->runs);
+  pthread_mutex_destroy(&build->lock);
+}
+
+// Builds the index for every game in the archive. Workers together buffer at
+// most about megabytes of entries before spilling sorted runs to disk next
+// to the index. The workers' boards count into stats, which may be NULL.
+bool build_position_index(const char *archive_path, const char *index_path,
+                          int threads, size_t megabytes, stats_t *stats) {
+  archive_t *archive = open_archive(archive_path);
+
+  if (archive == NULL) {
+    return false;
+  }
+
+  if (archive->game_count > 0x3fffffff) {
+    close_archive(archive);
+    return false;
+  }
+
+  thread_pool_t *pool = create_thread_pool(threads);
+
+  if (pool == NULL) {
+    close_archive(archive);
+    return false;
+  }
+
+  threads = thread_pool_size(pool);
+
+  index_build_t build = {.archive = archive, .index_path = index_path};
+  build.capacity = megabytes * 1024 * 1024 / sizeof(position_entry_t) / threads;
+  build.capacity = build.capacity < 1024 ? 1024 : build.capacity;
+  build.buffers = calloc(threads, sizeof(position_entry_t *));
+  build.boards = calloc(threads, sizeof(board_t *));
+  build.lengths = calloc(threads, sizeof(size_t));
+  atomic_init(&build.failed, false);
+  pthread_mutex_init(&build.lock, NULL);
+
+  bool ok = build.buffers != NULL && build.boards != NULL &&
+            build.lengths != NULL;
+
+  for (int i = 0; ok && i < threads; ++i) {
+    build.buffers[i] = malloc(build.capacity * sizeof(position_entry_t));
+    build.boards[i] = create_board();
+    ok = build.buffers[i] != NULL && build.boards[i] != NULL;
+
+    if (ok) {
+      build.boards[i]->stats = stats;
+    }
+  }
+
+  for (size_t first = 0; ok && first < archive->game_count;
+       first += GAMES_PER_TASK) {
+    index_task_t *task = malloc(sizeof(index_task_t));
+
+    if (task == NULL) {
+      ok = false;
+      break;
+    }
+
+    task->build = &build;
+    task->first = first;
+    task->last = first + GAMES_PER_TASK < archive->game_count
+                     ? first + GAMES_PER_TASK
+                     : archive->game_count;
+    thread_pool_submit(pool, -1, run_index_task, task);
+  }
+
+  thread_pool_wait(pool);
+  free_thread_pool(pool);
+
+  for (int i = 0; ok && i < threads; ++i) {
+    flush_run(&build, i);
+  }
+
+  ok = ok && !atomic_load(&build.failed) && merge_runs(&build);
+
+  if (build.buffers != NULL && build.boards != NULL) {
+    free_index_build(&build, threads);
+  }
+
+  close_archive(archive);
+  return ok;
+}
+
+position_index_t *open_position_index(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(position_index_header_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  const position_index_header_t *header = map;
+  position_index_t *index = malloc(sizeof(position_index_t));
+
+  if (index == NULL || memcmp(header->magic, POSITION_INDEX_MAGIC, 4) != 0 ||
+      header->version != POSITION_INDEX_VERSION ||
+      sizeof(position_index_header_t) +
+              header->count * sizeof(position_entry_t) !=
+          (size_t)st.st_size) {
+    munmap(map, st.st_size);
+    free(index);
+    return NULL;
+  }
+
+  // Lookups touch a handful of pages scattered over the file.
+  posix_madvise(map, st.st_size, POSIX_MADV_RANDOM);
+
+  index->map = map;
+  index->size = st.st_size;
+  index->entries = (const position_entry_t *)(header + 1);
+  index->count = header->count;
+  return index;
+}
+
+void close_position_index(position_index_t *index) {
+  munmap(index->map, index->size);
+  free(index);
+}
+
+// Returns the first entry for key and stores how many entries have it.
+size_t find_position(const position_index_t *index, unsigned long long key,
+                     size_t *count) {
+  size_t low = 0, high = index->count;
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+
+    if (index->entries[middle].key < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  size_t first = low;
+  high = index->count;
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+
+    if (index->entries[middle].key <= key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  *count = low - first;
+  return first;
+}
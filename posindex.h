@@ -0,0 +1,30 @@
+#include "types.h"
+
+#pragma once
+
+// One position reached in one game. game holds the game's number in the
+// archive in its low 30 bits and the game_result_t in its top 2; move is the
+// encoded move played from the position, or 0 where the game ended.
+typedef struct PositionEntry {
+  unsigned long long key;
+  unsigned int game;
+  unsigned short ply;
+  unsigned short move;
+} position_entry_t;
+
+#define POSITION_GAME(entry) ((entry)->game & 0x3fffffff)
+#define POSITION_RESULT(entry) ((game_result_t)((entry)->game >> 30))
+
+typedef struct PositionIndex {
+  const position_entry_t *entries;
+  size_t count;
+  void *map;
+  size_t size;
+} position_index_t;
+
+bool build_position_index(const char *archive_path, const char *index_path,
+                          int threads, size_t megabytes, stats_t *stats);
+position_index_t *open_position_index(const char *path);
+void close_position_index(position_index_t *index);
+size_t find_position(const position_index_t *index, unsigned long long key,
+                     size_t *count);
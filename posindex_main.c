@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "board.h"
+#include "move_piece.h"
+#include "posindex.h"
+#include "stats.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOOKUP_GAMES_SHOWN 10
+
+typedef struct MoveStats {
+  unsigned short move;
+  size_t games;
+  size_t results[4];
+} move_stats_t;
+
+double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int compare_move_stats(const void *a, const void *b) {
+  const move_stats_t *x = a, *y = b;
+  return (x->games < y->games) - (x->games > y->games);
+}
+
+void print_stats_row(const char *name, move_stats_t *stats) {
+  printf("%-8s %8zu %6.1f%% %6.1f%% %6.1f%%\n", name, stats->games,
+         100.0 * stats->results[WHITE_WINS] / stats->games,
+         100.0 * stats->results[DRAWN] / stats->games,
+         100.0 * stats->results[BLACK_WINS] / stats->games);
+}
+
+// Looks up the position reached by playing sans from fen and prints how
+// often each move was played from it and how those games ended.
+int lookup(const char *index_path, const char *fen, char **sans,
+           int san_count, stats_t *stats) {
+  position_index_t *index = open_position_index(index_path);
+  board_t *board = create_board();
+  piece_color_t color;
+
+  if (index == NULL || board == NULL) {
+    fprintf(stderr, "posindex: could not open %s\n", index_path);
+    return 1;
+  }
+
+  board->stats = stats;
+
+  if (load_fen(board, fen, &color) == NULL) {
+    fprintf(stderr, "posindex: invalid FEN: %s\n", fen);
+    return 1;
+  }
+
+  for (int i = 0; i < san_count; ++i) {
+    if (!move_from_san(board, sans[i], color)) {
+      fprintf(stderr, "posindex: illegal move: %s\n", sans[i]);
+      return 1;
+    }
+
+    color = color == WHITE ? BLACK : WHITE;
+  }
+
+  double start = now_seconds();
+  size_t count;
+  size_t first = find_position(index, board->hash, &count);
+
+  move_stats_t moves[256];
+  move_stats_t total = {0};
+  int move_count = 0;
+
+  for (size_t i = first; i < first + count; ++i) {
+    const position_entry_t *entry = &index->entries[i];
+    int j = 0;
+
+    while (j < move_count && moves[j].move != entry->move) {
+      j++;
+    }
+
+    if (j == move_count) {
+      if (move_count == 256) {
+        continue;
+      }
+
+      moves[move_count++] = (move_stats_t){.move = entry->move};
+    }
+
+    moves[j].games++;
+    moves[j].results[POSITION_RESULT(entry)]++;
+    total.games++;
+    total.results[POSITION_RESULT(entry)]++;
+  }
+
+  double seconds = now_seconds() - start;
+  qsort(moves, move_count, sizeof(move_stats_t), compare_move_stats);
+
+  printf("position %016llx: %zu occurrences (%.1f us)\n", board->hash, count,
+         seconds * 1e6);
+
+  if (count == 0) {
+    close_position_index(index);
+    free_board(board);
+    return 0;
+  }
+
+  printf("%-8s %8s %7s %7s %7s\n", "move", "games", "white", "draw", "black");
+
+  for (int i = 0; i < move_count; ++i) {
+    char san[16] = "(end)";
+
+    if (moves[i].move != 0) {
+      move_to_san(board, decode_move(moves[i].move), san);
+    }
+
+    print_stats_row(san, &moves[i]);
+  }
+
+  print_stats_row("total", &total);
+
+  printf("games:");
+
+  for (size_t i = first; i < first + count && i < first + LOOKUP_GAMES_SHOWN;
+       ++i) {
+    printf(" %u@%u", POSITION_GAME(&index->entries[i]),
+           index->entries[i].ply);
+  }
+
+  printf("%s\n", count > LOOKUP_GAMES_SHOWN ? " ..." : "");
+
+  close_position_index(index);
+  free_board(board);
+  return 0;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--stats] build ARCHIVE INDEX [--threads N] "
+          "[--memory MB]\n"
+          "       %s [--stats] lookup INDEX [FEN] [SAN...]\n",
+          program, program);
+}
+
+// Runs the command given by argv with the rules engine counting into stats.
+int run_command(int argc, char **argv, stats_t *stats) {
+  if (argc >= 4 && strcmp(argv[1], "build") == 0) {
+    int threads = 0;
+    size_t megabytes = 256;
+
+    for (int i = 4; i < argc; ++i) {
+      if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+        threads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+        megabytes = strtoul(argv[++i], NULL, 10);
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+
+    double start = now_seconds();
+
+    if (!build_position_index(argv[2], argv[3], threads, megabytes, stats)) {
+      fprintf(stderr, "posindex: could not build %s from %s\n", argv[3],
+              argv[2]);
+      return 1;
+    }
+
+    position_index_t *index = open_position_index(argv[3]);
+
+    if (index == NULL) {
+      fprintf(stderr, "posindex: could not open %s\n", argv[3]);
+      return 1;
+    }
+
+    printf("indexed %zu positions in %.3fs\n", index->count,
+           now_seconds() - start);
+    close_position_index(index);
+    return 0;
+  }
+
+  if (argc >= 3 && strcmp(argv[1], "lookup") == 0) {
+    // A FEN has spaces, so it is recognised by its slashes.
+    bool has_fen = argc >= 4 && strchr(argv[3], '/') != NULL;
+    int first_san = has_fen ? 4 : 3;
+
+    return lookup(argv[2], has_fen ? argv[3] : START_FEN, argv + first_san,
+                  argc - first_san, stats);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  stats_t stats = {0};
+  bool show_stats = false;
+  int kept = 1;
+
+  // --stats may come anywhere, even among the moves of a lookup.
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+
+  argc = kept;
+  int status = run_command(argc, argv, show_stats ? &stats : NULL);
+
+  if (show_stats) {
+    stats_print(stdout, &stats);
+  }
+
+  return status;
+}
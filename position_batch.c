@@ -0,0 +1,403 @@
+#include "position_batch.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define POSITION_BATCH_AVX2
+#endif
+
+// Every kernel works on whole bitboards, shifting them one step in a
+// direction and masking off the squares that wrapped around to the other
+// edge. Squares are rank * 8 + file, so east is +1 and north +8.
+#define NOT_FILE_A 0xfefefefefefefefeULL
+#define NOT_FILE_H 0x7f7f7f7f7f7f7f7fULL
+#define NOT_FILES_AB 0xfcfcfcfcfcfcfcfcULL
+#define NOT_FILES_GH 0x3f3f3f3f3f3f3f3fULL
+
+// The shift and wrap mask of each direction, ordered as in tables.h: the
+// diagonals NE, SW, NW, SE, then E, W, N, S.
+const int slide_shifts[8] = {9, -9, 7, -7, 1, -1, 8, -8};
+const unsigned long long slide_masks[8] = {
+    NOT_FILE_A, NOT_FILE_H, NOT_FILE_H, NOT_FILE_A,
+    NOT_FILE_A, NOT_FILE_H, ~0ULL,      ~0ULL,
+};
+
+position_batch_t *create_position_batch(size_t capacity) {
+  position_batch_t *batch = calloc(1, sizeof(position_batch_t));
+
+  if (batch == NULL) {
+    return NULL;
+  }
+
+  capacity = capacity > 0 ? (capacity + POSITION_BATCH_LANES - 1) /
+                                 POSITION_BATCH_LANES * POSITION_BATCH_LANES
+                           : POSITION_BATCH_LANES;
+  size_t size = capacity * sizeof(unsigned long long);
+  batch->capacity = capacity;
+
+  for (int color = 0; color < 2; ++color) {
+    for (int type = 0; type < 6; ++type) {
+      if ((batch->pieces[color][type] = aligned_alloc(32, size)) == NULL) {
+        free_position_batch(batch);
+        return NULL;
+      }
+
+      memset(batch->pieces[color][type], 0, size);
+    }
+  }
+
+  if ((batch->black_to_move = aligned_alloc(32, size)) == NULL) {
+    free_position_batch(batch);
+    return NULL;
+  }
+
+  memset(batch->black_to_move, 0, size);
+  return batch;
+}
+
+void free_position_batch(position_batch_t *batch) {
+  for (int color = 0; color < 2; ++color) {
+    for (int type = 0; type < 6; ++type) {
+      free(batch->pieces[color][type]);
+    }
+  }
+
+  free(batch->black_to_move);
+  free(batch);
+}
+
+void clear_position_batch(position_batch_t *batch) { batch->length = 0; }
+
+// Appends board; returns false when the batch is full.
+bool add_batch_position(position_batch_t *batch, board_t *board) {
+  if (batch->length == batch->capacity) {
+    return false;
+  }
+
+  size_t i = batch->length++;
+
+  for (int color = 0; color < 2; ++color) {
+    for (int type = 0; type < 6; ++type) {
+      batch->pieces[color][type][i] = 0;
+    }
+  }
+
+  for (int j = 0; j < board->piece_count; ++j) {
+    piece_t *piece = &board->pieces[j];
+
+    if (piece->square != NULL) {
+      batch->pieces[piece->color][piece->type][i] |=
+          1ULL << (piece->square->rank * 8 + piece->square->file);
+    }
+  }
+
+  batch->black_to_move[i] = board->side_to_move == BLACK ? ~0ULL : 0;
+  return true;
+}
+
+bool batch_simd_enabled(void) {
+#if defined(POSITION_BATCH_AVX2)
+  return true;
+#else
+  return false;
+#endif
+}
+
+unsigned long long shift_bits(unsigned long long bits, int shift) {
+  return shift > 0 ? bits << shift : bits >> -shift;
+}
+
+// The squares the pieces in gen attack in direction d: a Kogge-Stone fill
+// through the empty squares, plus the first blocker.
+unsigned long long slide_attacks(unsigned long long gen,
+                                 unsigned long long empty, int d) {
+  int shift = slide_shifts[d];
+  unsigned long long mask = slide_masks[d];
+
+  empty &= mask;
+  gen |= empty & shift_bits(gen, shift);
+  empty &= shift_bits(empty, shift);
+  gen |= empty & shift_bits(gen, 2 * shift);
+  empty &= shift_bits(empty, 2 * shift);
+  gen |= empty & shift_bits(gen, 4 * shift);
+
+  return shift_bits(gen, shift) & mask;
+}
+
+unsigned long long slider_attacks(unsigned long long gen,
+                                  unsigned long long empty, int first,
+                                  int last) {
+  unsigned long long attacks = 0;
+
+  for (int d = first; d < last; ++d) {
+    attacks |= slide_attacks(gen, empty, d);
+  }
+
+  return attacks;
+}
+
+unsigned long long knight_spread(unsigned long long knights) {
+  unsigned long long one = (knights << 1 & NOT_FILE_A) |
+                           (knights >> 1 & NOT_FILE_H);
+  unsigned long long two = (knights << 2 & NOT_FILES_AB) |
+                           (knights >> 2 & NOT_FILES_GH);
+
+  return one << 16 | one >> 16 | two << 8 | two >> 8;
+}
+
+unsigned long long king_spread(unsigned long long kings) {
+  unsigned long long attacks =
+      (kings << 1 & NOT_FILE_A) | (kings >> 1 & NOT_FILE_H);
+  unsigned long long row = kings | attacks;
+
+  return attacks | row << 8 | row >> 8;
+}
+
+unsigned long long pawn_spread(unsigned long long pawns, piece_color_t color) {
+  return color == WHITE
+             ? (pawns << 9 & NOT_FILE_A) | (pawns << 7 & NOT_FILE_H)
+             : (pawns >> 7 & NOT_FILE_A) | (pawns >> 9 & NOT_FILE_H);
+}
+
+unsigned long long occupancy(const position_batch_t *batch, size_t i,
+                             int color) {
+  unsigned long long occupied = 0;
+
+  for (int type = 0; type < 6; ++type) {
+    occupied |= batch->pieces[color][type][i];
+  }
+
+  return occupied;
+}
+
+// Whether the king of color in position i is attacked, found by looking out
+// from the king for each kind of attacker.
+bool batch_king_attacked(const position_batch_t *batch, size_t i,
+                         piece_color_t color) {
+  unsigned long long *const *enemy = batch->pieces[!color];
+  unsigned long long king = batch->pieces[color][KING][i];
+  unsigned long long empty =
+      ~(occupancy(batch, i, WHITE) | occupancy(batch, i, BLACK));
+  unsigned long long queens = enemy[QUEEN][i];
+
+  return ((knight_spread(king) & enemy[KNIGHT][i]) |
+          (king_spread(king) & enemy[KING][i]) |
+          (pawn_spread(king, color) & enemy[PAWN][i]) |
+          (slider_attacks(king, empty, 0, 4) & (enemy[BISHOP][i] | queens)) |
+          (slider_attacks(king, empty, 4, 8) & (enemy[ROOK][i] | queens))) !=
+         0;
+}
+
+void batch_check_status_scalar(const position_batch_t *batch,
+                               unsigned char *status) {
+  for (size_t i = 0; i < batch->length; ++i) {
+    piece_color_t mover = batch->black_to_move[i] ? BLACK : WHITE;
+
+    status[i] = (batch_king_attacked(batch, i, mover) ? POSITION_IN_CHECK
+                                                      : 0) |
+                (batch_king_attacked(batch, i, !mover) ? POSITION_ILLEGAL : 0);
+  }
+}
+
+void batch_attack_maps_scalar(const position_batch_t *batch,
+                              piece_color_t color, unsigned long long *maps) {
+  unsigned long long *const *own = batch->pieces[color];
+
+  for (size_t i = 0; i < batch->length; ++i) {
+    unsigned long long occupied = occupancy(batch, i, color);
+    unsigned long long empty = ~(occupied | occupancy(batch, i, !color));
+    unsigned long long queens = own[QUEEN][i];
+    unsigned long long attacks =
+        knight_spread(own[KNIGHT][i]) | king_spread(own[KING][i]) |
+        slider_attacks(own[BISHOP][i] | queens, empty, 0, 4) |
+        slider_attacks(own[ROOK][i] | queens, empty, 4, 8);
+
+    maps[i] = pawn_spread(own[PAWN][i], color) | (attacks & ~occupied);
+  }
+}
+
+#if defined(POSITION_BATCH_AVX2)
+// The same kernels on POSITION_BATCH_LANES positions at once, one per
+// 64-bit lane. Shift counts are passed in a register so that the functions
+// need no immediate operands.
+__m256i lanes_shift(__m256i bits, int shift) {
+  return shift > 0 ? _mm256_sll_epi64(bits, _mm_cvtsi32_si128(shift))
+                   : _mm256_srl_epi64(bits, _mm_cvtsi32_si128(-shift));
+}
+
+__m256i lanes_mask(__m256i bits, int shift, unsigned long long mask) {
+  return _mm256_and_si256(lanes_shift(bits, shift),
+                          _mm256_set1_epi64x((long long)mask));
+}
+
+__m256i lanes_slide_attacks(__m256i gen, __m256i empty, int d) {
+  int shift = slide_shifts[d];
+  __m256i mask = _mm256_set1_epi64x((long long)slide_masks[d]);
+
+  empty = _mm256_and_si256(empty, mask);
+  gen = _mm256_or_si256(gen,
+                        _mm256_and_si256(empty, lanes_shift(gen, shift)));
+  empty = _mm256_and_si256(empty, lanes_shift(empty, shift));
+  gen = _mm256_or_si256(gen,
+                        _mm256_and_si256(empty, lanes_shift(gen, 2 * shift)));
+  empty = _mm256_and_si256(empty, lanes_shift(empty, 2 * shift));
+  gen = _mm256_or_si256(gen,
+                        _mm256_and_si256(empty, lanes_shift(gen, 4 * shift)));
+
+  return _mm256_and_si256(lanes_shift(gen, shift), mask);
+}
+
+__m256i lanes_slider_attacks(__m256i gen, __m256i empty, int first,
+                             int last) {
+  __m256i attacks = _mm256_setzero_si256();
+
+  for (int d = first; d < last; ++d) {
+    attacks = _mm256_or_si256(attacks, lanes_slide_attacks(gen, empty, d));
+  }
+
+  return attacks;
+}
+
+__m256i lanes_knight_spread(__m256i knights) {
+  __m256i one = _mm256_or_si256(lanes_mask(knights, 1, NOT_FILE_A),
+                                lanes_mask(knights, -1, NOT_FILE_H));
+  __m256i two = _mm256_or_si256(lanes_mask(knights, 2, NOT_FILES_AB),
+                                lanes_mask(knights, -2, NOT_FILES_GH));
+
+  return _mm256_or_si256(
+      _mm256_or_si256(lanes_shift(one, 16), lanes_shift(one, -16)),
+      _mm256_or_si256(lanes_shift(two, 8), lanes_shift(two, -8)));
+}
+
+__m256i lanes_king_spread(__m256i kings) {
+  __m256i attacks = _mm256_or_si256(lanes_mask(kings, 1, NOT_FILE_A),
+                                    lanes_mask(kings, -1, NOT_FILE_H));
+  __m256i row = _mm256_or_si256(kings, attacks);
+
+  return _mm256_or_si256(attacks, _mm256_or_si256(lanes_shift(row, 8),
+                                                  lanes_shift(row, -8)));
+}
+
+__m256i lanes_pawn_spread(__m256i pawns, piece_color_t color) {
+  return color == WHITE
+             ? _mm256_or_si256(lanes_mask(pawns, 9, NOT_FILE_A),
+                               lanes_mask(pawns, 7, NOT_FILE_H))
+             : _mm256_or_si256(lanes_mask(pawns, -7, NOT_FILE_A),
+                               lanes_mask(pawns, -9, NOT_FILE_H));
+}
+
+__m256i lanes_load(const unsigned long long *values, size_t i) {
+  return _mm256_load_si256((const __m256i *)(values + i));
+}
+
+__m256i lanes_occupancy(const position_batch_t *batch, size_t i, int color) {
+  __m256i occupied = _mm256_setzero_si256();
+
+  for (int type = 0; type < 6; ++type) {
+    occupied =
+        _mm256_or_si256(occupied, lanes_load(batch->pieces[color][type], i));
+  }
+
+  return occupied;
+}
+
+// All ones in the lanes whose king of color is attacked.
+__m256i lanes_king_attacked(const position_batch_t *batch, size_t i,
+                            piece_color_t color, __m256i empty) {
+  unsigned long long *const *enemy = batch->pieces[!color];
+  __m256i king = lanes_load(batch->pieces[color][KING], i);
+  __m256i queens = lanes_load(enemy[QUEEN], i);
+  __m256i diagonal = _mm256_or_si256(lanes_load(enemy[BISHOP], i), queens);
+  __m256i straight = _mm256_or_si256(lanes_load(enemy[ROOK], i), queens);
+  __m256i attackers = _mm256_or_si256(
+      _mm256_or_si256(
+          _mm256_and_si256(lanes_knight_spread(king),
+                           lanes_load(enemy[KNIGHT], i)),
+          _mm256_and_si256(lanes_king_spread(king),
+                           lanes_load(enemy[KING], i))),
+      _mm256_or_si256(
+          _mm256_and_si256(lanes_pawn_spread(king, color),
+                           lanes_load(enemy[PAWN], i)),
+          _mm256_or_si256(
+              _mm256_and_si256(lanes_slider_attacks(king, empty, 0, 4),
+                               diagonal),
+              _mm256_and_si256(lanes_slider_attacks(king, empty, 4, 8),
+                               straight))));
+
+  return _mm256_xor_si256(
+      _mm256_cmpeq_epi64(attackers, _mm256_setzero_si256()),
+      _mm256_set1_epi64x(-1));
+}
+#endif
+
+// Computes whether the side to move is in check and whether the position is
+// illegal, for every position in the batch.
+void batch_check_status(const position_batch_t *batch, unsigned char *status) {
+#if defined(POSITION_BATCH_AVX2)
+  for (size_t i = 0; i < batch->length; i += POSITION_BATCH_LANES) {
+    __m256i empty = _mm256_xor_si256(
+        _mm256_or_si256(lanes_occupancy(batch, i, WHITE),
+                        lanes_occupancy(batch, i, BLACK)),
+        _mm256_set1_epi64x(-1));
+    __m256i black = lanes_load(batch->black_to_move, i);
+    __m256i white_attacked = lanes_king_attacked(batch, i, WHITE, empty);
+    __m256i black_attacked = lanes_king_attacked(batch, i, BLACK, empty);
+    // The mover's king is the white one where black_to_move is clear.
+    __m256i check = _mm256_blendv_epi8(white_attacked, black_attacked, black);
+    __m256i illegal =
+        _mm256_blendv_epi8(black_attacked, white_attacked, black);
+    int checks = _mm256_movemask_pd(_mm256_castsi256_pd(check));
+    int illegals = _mm256_movemask_pd(_mm256_castsi256_pd(illegal));
+
+    for (size_t j = 0; j < POSITION_BATCH_LANES && i + j < batch->length;
+         ++j) {
+      status[i + j] = (checks >> j & 1 ? POSITION_IN_CHECK : 0) |
+                      (illegals >> j & 1 ? POSITION_ILLEGAL : 0);
+    }
+  }
+#else
+  batch_check_status_scalar(batch, status);
+#endif
+}
+
+void batch_attack_maps(const position_batch_t *batch, piece_color_t color,
+                       unsigned long long *maps) {
+#if defined(POSITION_BATCH_AVX2)
+  unsigned long long *const *own = batch->pieces[color];
+
+  for (size_t i = 0; i < batch->length; i += POSITION_BATCH_LANES) {
+    __m256i occupied = lanes_occupancy(batch, i, color);
+    __m256i empty = _mm256_xor_si256(
+        _mm256_or_si256(occupied, lanes_occupancy(batch, i, !color)),
+        _mm256_set1_epi64x(-1));
+    __m256i queens = lanes_load(own[QUEEN], i);
+    __m256i attacks = _mm256_or_si256(
+        _mm256_or_si256(lanes_knight_spread(lanes_load(own[KNIGHT], i)),
+                        lanes_king_spread(lanes_load(own[KING], i))),
+        _mm256_or_si256(
+            lanes_slider_attacks(
+                _mm256_or_si256(lanes_load(own[BISHOP], i), queens), empty, 0,
+                4),
+            lanes_slider_attacks(
+                _mm256_or_si256(lanes_load(own[ROOK], i), queens), empty, 4,
+                8)));
+    __m256i map = _mm256_or_si256(
+        lanes_pawn_spread(lanes_load(own[PAWN], i), color),
+        _mm256_andnot_si256(occupied, attacks));
+
+    if (i + POSITION_BATCH_LANES <= batch->length) {
+      _mm256_storeu_si256((__m256i *)(maps + i), map);
+    } else {
+      unsigned long long lanes[POSITION_BATCH_LANES];
+      _mm256_storeu_si256((__m256i *)lanes, map);
+      memcpy(maps + i, lanes,
+             (batch->length - i) * sizeof(unsigned long long));
+    }
+  }
+#else
+  batch_attack_maps_scalar(batch, color, maps);
+#endif
+}
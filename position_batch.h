@@ -0,0 +1,46 @@
+#include "types.h"
+#include <stddef.h>
+
+#pragma once
+#pragma GCC visibility push(default)
+
+// Positions per vector in the SIMD kernels. Batches are padded to a multiple
+// of it.
+#define POSITION_BATCH_LANES 4
+
+// Check status bits: the side to move is in check, or the side that just
+// moved left its king attacked.
+#define POSITION_IN_CHECK 1
+#define POSITION_ILLEGAL 2
+
+// Unrelated positions in struct-of-arrays form: pieces[color][type][i] is
+// the bitboard (bit rank * 8 + file) of those pieces in position i and
+// black_to_move[i] is all ones when black is to move. The arrays are
+// aligned for vector loads.
+typedef struct PositionBatch {
+  unsigned long long *pieces[2][6];
+  unsigned long long *black_to_move;
+  size_t length;
+  size_t capacity;
+} position_batch_t;
+
+position_batch_t *create_position_batch(size_t capacity);
+void free_position_batch(position_batch_t *batch);
+void clear_position_batch(position_batch_t *batch);
+bool add_batch_position(position_batch_t *batch, board_t *board);
+bool batch_simd_enabled(void);
+
+// status[i] and maps[i] describe position i. An attack map holds the squares
+// square_attacked reports as attacked by color: those its pawns attack, and
+// those its other pieces attack that are not its own.
+void batch_check_status(const position_batch_t *batch, unsigned char *status);
+void batch_attack_maps(const position_batch_t *batch, piece_color_t color,
+                       unsigned long long *maps);
+
+// The one-position-at-a-time versions, which the vector kernels must match.
+void batch_check_status_scalar(const position_batch_t *batch,
+                               unsigned char *status);
+void batch_attack_maps_scalar(const position_batch_t *batch,
+                              piece_color_t color, unsigned long long *maps);
+
+#pragma GCC visibility pop
@@ -0,0 +1,697 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "search.h"
+#include "board.h"
+#include "eval.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "telemetry.h"
+#include "types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Entries are written without locks, like the perft table: check holds
+// key ^ data so a torn entry fails to match. data packs the encoded move
+// (16 bits), score (16), depth (8) and bound (2).
+typedef struct SearchEntry {
+  _Atomic unsigned long long check;
+  _Atomic unsigned long long data;
+} search_entry_t;
+
+struct SearchTable {
+  search_entry_t *entries;
+  size_t mask;
+};
+
+typedef struct Searcher {
+  board_t *board;
+  search_table_t *table;
+  // Pawn structure evaluations; NULL if there was no memory for them.
+  pawn_table_t *pawns;
+  const search_limits_t *limits;
+  search_counters_t counters;
+  struct timespec start;
+  bool stopped;
+  bool can_stop;
+  move_t killers[MAX_PLY][2];
+  int history[2][64][64];
+  unsigned long long *hashes;
+  int hash_count;
+  move_t pv[MAX_PLY][MAX_PLY];
+  int pv_length[MAX_PLY];
+  // Root moves already reported in this iteration, which the search of the
+  // next line skips.
+  move_t excluded[MAX_MULTIPV];
+  int excluded_count;
+  // The counters when the current iteration started, for telemetry.
+  unsigned long search_id;
+  search_counters_t iteration_start;
+  unsigned long long previous_nodes;
+  double iteration_ms;
+} searcher_t;
+
+search_table_t *create_search_table(size_t megabytes) {
+  size_t count = 1;
+
+  while (count * 2 * sizeof(search_entry_t) <= megabytes * 1024 * 1024) {
+    count *= 2;
+  }
+
+  search_table_t *table = malloc(sizeof(search_table_t));
+
+  if (!table) {
+    return NULL;
+  }
+
+  table->entries = calloc(count, sizeof(search_entry_t));
+
+  if (!table->entries) {
+    free(table);
+    return NULL;
+  }
+
+  table->mask = count - 1;
+  return table;
+}
+
+void free_search_table(search_table_t *table) {
+  free(table->entries);
+  free(table);
+}
+
+void clear_search_table(search_table_t *table) {
+  memset(table->entries, 0, (table->mask + 1) * sizeof(search_entry_t));
+}
+
+// Mate scores are stored relative to the position rather than the root.
+int score_to_table(int score, int ply) {
+  return score > MATE_BOUND ? score + ply : score < -MATE_BOUND ? score - ply
+                                                                : score;
+}
+
+int score_from_table(int score, int ply) {
+  return score > MATE_BOUND ? score - ply : score < -MATE_BOUND ? score + ply
+                                                                : score;
+}
+
+bool probe_search_table(search_table_t *table, unsigned long long hash,
+                        unsigned short *move, int *score, int *depth,
+                        int *bound) {
+  search_entry_t *entry = &table->entries[hash & table->mask];
+  unsigned long long data =
+      atomic_load_explicit(&entry->data, memory_order_relaxed);
+  unsigned long long check =
+      atomic_load_explicit(&entry->check, memory_order_relaxed);
+
+  if ((check ^ data) != hash) {
+    return false;
+  }
+
+  *move = data & 0xffff;
+  *score = (short)(data >> 16);
+  *depth = (data >> 32) & 0xff;
+  *bound = (data >> 40) & 3;
+  return true;
+}
+
+void store_search_table(search_table_t *table, unsigned long long hash,
+                        move_t move, int score, int depth, int bound) {
+  search_entry_t *entry = &table->entries[hash & table->mask];
+  unsigned long long data = encode_move(move) |
+                            (unsigned long long)(unsigned short)score << 16 |
+                            (unsigned long long)depth << 32 |
+                            (unsigned long long)bound << 40;
+
+  atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+  atomic_store_explicit(&entry->check, hash ^ data, memory_order_relaxed);
+}
+
+double elapsed_ms(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 +
+         (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Checked every 1024 nodes once the first iteration is done.
+bool should_stop(searcher_t *searcher) {
+  if (searcher->stopped) {
+    return true;
+  }
+
+  if (!searcher->can_stop || (searcher->counters.nodes & 1023) != 0) {
+    return false;
+  }
+
+  const search_limits_t *limits = searcher->limits;
+
+  searcher->stopped =
+      (limits->stop != NULL && atomic_load(limits->stop)) ||
+      (limits->nodes > 0 && searcher->counters.nodes >= limits->nodes) ||
+      (limits->milliseconds > 0 &&
+       elapsed_ms(&searcher->start) >= limits->milliseconds);
+
+  return searcher->stopped;
+}
+
+bool is_capture(board_t *board, move_t move) {
+  piece_t *piece = board->squares[move.from_rank][move.from_file].piece;
+
+  return board->squares[move.to_rank][move.to_file].piece != NULL ||
+         (piece->type == PAWN && move.from_file != move.to_file);
+}
+
+bool same_move(move_t a, move_t b) {
+  return a.from_rank == b.from_rank && a.from_file == b.from_file &&
+         a.to_rank == b.to_rank && a.to_file == b.to_file &&
+         a.promotion == b.promotion;
+}
+
+// Writes a score as pawns, or as #N / #-N for a mate in N moves.
+void format_score(int score, char *text, size_t size) {
+  if (score > MATE_BOUND || score < -MATE_BOUND) {
+    int moves = (MATE_SCORE - abs(score) + 1) / 2;
+    snprintf(text, size, "#%s%d", score < 0 ? "-" : "", moves);
+  } else {
+    snprintf(text, size, "%+.2f", score / 100.0);
+  }
+}
+
+bool is_excluded(searcher_t *searcher, move_t move) {
+  for (int i = 0; i < searcher->excluded_count; ++i) {
+    if (same_move(move, searcher->excluded[i])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool is_repetition(searcher_t *searcher) {
+  int limit = searcher->board->fifty_move_rule_counter;
+
+  for (int i = searcher->hash_count - 3;
+       i >= 0 && i >= searcher->hash_count - 1 - limit; i -= 2) {
+    if (searcher->hashes[i] == searcher->board->hash) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Scores moves for ordering: the table move, then captures by most valuable
+// victim and least valuable attacker, promotions, killers and history.
+void score_moves(searcher_t *searcher, move_list_t *moves, int *scores,
+                 unsigned short table_move, int ply) {
+  board_t *board = searcher->board;
+
+  for (int i = 0; i < moves->length; ++i) {
+    move_t move = moves->moves[i];
+    piece_t *piece = board->squares[move.from_rank][move.from_file].piece;
+    piece_t *victim = board->squares[move.to_rank][move.to_file].piece;
+
+    if (encode_move(move) == table_move) {
+      scores[i] = 1000000;
+    } else if (is_capture(board, move)) {
+      scores[i] = 100000 + 10 * (victim != NULL ? victim->type : PAWN) -
+                  piece->type;
+    } else if (move.promotion != PAWN) {
+      scores[i] = 90000 + move.promotion;
+    } else if (same_move(move, searcher->killers[ply][0])) {
+      scores[i] = 80001;
+    } else if (same_move(move, searcher->killers[ply][1])) {
+      scores[i] = 80000;
+    } else {
+      scores[i] = searcher->history[piece->color]
+                                   [move.from_rank * 8 + move.from_file]
+                                   [move.to_rank * 8 + move.to_file];
+    }
+  }
+}
+
+// Moves the best remaining move to index i.
+void pick_move(move_list_t *moves, int *scores, int i) {
+  int best = i;
+
+  for (int j = i + 1; j < moves->length; ++j) {
+    if (scores[j] > scores[best]) {
+      best = j;
+    }
+  }
+
+  move_t move = moves->moves[i];
+  moves->moves[i] = moves->moves[best];
+  moves->moves[best] = move;
+
+  int score = scores[i];
+  scores[i] = scores[best];
+  scores[best] = score;
+}
+
+void push_move(searcher_t *searcher, move_t move, undo_t *undo) {
+  make_move(searcher->board, move, undo);
+  searcher->hashes[searcher->hash_count++] = searcher->board->hash;
+}
+
+void pop_move(searcher_t *searcher, move_t move, undo_t *undo) {
+  searcher->hash_count--;
+  unmake_move(searcher->board, move, undo);
+}
+
+int quiesce(searcher_t *searcher, int alpha, int beta, int ply) {
+  board_t *board = searcher->board;
+  bool in_check = board->checkers != 0;
+
+  searcher->counters.nodes++;
+  searcher->counters.qnodes++;
+
+  if (ply > searcher->counters.seldepth) {
+    searcher->counters.seldepth = ply;
+  }
+
+  if (ply >= MAX_PLY - 1) {
+    return evaluate(board, searcher->pawns);
+  }
+
+  if (!in_check) {
+    int stand_pat = evaluate(board, searcher->pawns);
+
+    if (stand_pat >= beta) {
+      return stand_pat;
+    }
+
+    if (stand_pat > alpha) {
+      alpha = stand_pat;
+    }
+  }
+
+  move_list_t moves;
+  generate_legal_moves(board, board->side_to_move, &moves);
+
+  if (in_check && moves.length == 0) {
+    return -MATE_SCORE + ply;
+  }
+
+  // Out of check every evasion is searched, otherwise only captures and
+  // promotions.
+  if (!in_check) {
+    int kept = 0;
+
+    for (int i = 0; i < moves.length; ++i) {
+      if (is_capture(board, moves.moves[i]) ||
+          moves.moves[i].promotion != PAWN) {
+        moves.moves[kept++] = moves.moves[i];
+      }
+    }
+
+    moves.length = kept;
+  }
+
+  int scores[256];
+  score_moves(searcher, &moves, scores, 0, ply);
+
+  for (int i = 0; i < moves.length; ++i) {
+    pick_move(&moves, scores, i);
+
+    undo_t undo;
+    push_move(searcher, moves.moves[i], &undo);
+    int score = -quiesce(searcher, -beta, -alpha, ply + 1);
+    pop_move(searcher, moves.moves[i], &undo);
+
+    if (should_stop(searcher)) {
+      return 0;
+    }
+
+    if (score >= beta) {
+      return score;
+    }
+
+    if (score > alpha) {
+      alpha = score;
+    }
+  }
+
+  return alpha;
+}
+
+int negamax(searcher_t *searcher, int depth, int alpha, int beta, int ply) {
+  board_t *board = searcher->board;
+  searcher->pv_length[ply] = 0;
+
+  if (ply > 0 && (board->fifty_move_rule_counter >= 100 ||
+                  insufficient_material(board) || is_repetition(searcher))) {
+    return 0;
+  }
+
+  bool in_check = board->checkers != 0;
+
+  if (in_check && ply < MAX_PLY / 2) {
+    depth++;
+  }
+
+  if (depth <= 0 || ply >= MAX_PLY - 1) {
+    return quiesce(searcher, alpha, beta, ply);
+  }
+
+  searcher->counters.nodes++;
+
+  if (ply > searcher->counters.seldepth) {
+    searcher->counters.seldepth = ply;
+  }
+
+  unsigned short table_move = 0;
+  int table_score, table_depth, bound;
+  searcher->counters.table_probes++;
+
+  if (probe_search_table(searcher->table, board->hash, &table_move,
+                         &table_score, &table_depth, &bound)) {
+    searcher->counters.table_hits++;
+
+    if (ply > 0 && table_depth >= depth) {
+      table_score = score_from_table(table_score, ply);
+
+      if (bound == BOUND_EXACT ||
+          (bound == BOUND_LOWER && table_score >= beta) ||
+          (bound == BOUND_UPPER && table_score <= alpha)) {
+        return table_score;
+      }
+    }
+  }
+
+  move_list_t moves;
+  generate_legal_moves(board, board->side_to_move, &moves);
+
+  if (moves.length == 0) {
+    return in_check ? -MATE_SCORE + ply : 0;
+  }
+
+  int scores[256];
+  score_moves(searcher, &moves, scores, table_move, ply);
+
+  int original_alpha = alpha;
+  int best_score = -MATE_SCORE;
+  move_t best_move = moves.moves[0];
+  int searched = 0;
+
+  for (int i = 0; i < moves.length; ++i) {
+    pick_move(&moves, scores, i);
+    move_t move = moves.moves[i];
+
+    if (ply == 0 && is_excluded(searcher, move)) {
+      continue;
+    }
+
+    bool quiet = !is_capture(board, move) && move.promotion == PAWN;
+
+    undo_t undo;
+    push_move(searcher, move, &undo);
+
+    // Later moves are first tried with a null window and only searched in
+    // full if they might raise alpha.
+    int score;
+
+    if (searched++ == 0) {
+      score = -negamax(searcher, depth - 1, -beta, -alpha, ply + 1);
+    } else {
+      score = -negamax(searcher, depth - 1, -alpha - 1, -alpha, ply + 1);
+
+      if (score > alpha && score < beta) {
+        score = -negamax(searcher, depth - 1, -beta, -alpha, ply + 1);
+      }
+    }
+
+    pop_move(searcher, move, &undo);
+
+    if (should_stop(searcher)) {
+      return 0;
+    }
+
+    if (score > best_score) {
+      best_score = score;
+      best_move = move;
+    }
+
+    if (score > alpha) {
+      alpha = score;
+      searcher->pv[ply][0] = move;
+      memcpy(&searcher->pv[ply][1], searcher->pv[ply + 1],
+             searcher->pv_length[ply + 1] * sizeof(move_t));
+      searcher->pv_length[ply] = searcher->pv_length[ply + 1] + 1;
+    }
+
+    if (score >= beta) {
+      searcher->counters.cutoffs++;
+      searcher->counters.first_move_cutoffs += searched == 1;
+
+      if (quiet) {
+        if (!same_move(move, searcher->killers[ply][0])) {
+          searcher->killers[ply][1] = searcher->killers[ply][0];
+          searcher->killers[ply][0] = move;
+        }
+
+        int *history =
+            &searcher->history[board->side_to_move]
+                              [move.from_rank * 8 + move.from_file]
+                              [move.to_rank * 8 + move.to_file];
+        *history += depth * depth;
+
+        if (*history > 50000) {
+          *history /= 2;
+        }
+      }
+
+      break;
+    }
+  }
+
+  // With root moves left out the score is not the position's.
+  if (ply == 0 && searcher->excluded_count > 0) {
+    return best_score;
+  }
+
+  bound = best_score >= beta            ? BOUND_LOWER
+          : best_score > original_alpha ? BOUND_EXACT
+                                        : BOUND_UPPER;
+  store_search_table(searcher->table, board->hash, best_move,
+                     score_to_table(best_score, ply), depth, bound);
+
+  return best_score;
+}
+
+// Sends the work of the iteration to depth that just ended, complete or not,
+// to the telemetry sink of the limits.
+void record_iteration(searcher_t *searcher, int depth, int lines, int score,
+                      bool complete) {
+  search_counters_t *now = &searcher->counters;
+  search_counters_t *start = &searcher->iteration_start;
+  double ms = elapsed_ms(&searcher->start);
+  telemetry_iteration_t iteration = {
+      .search = searcher->search_id,
+      .depth = depth,
+      .multipv = lines,
+      .score = score,
+      .complete = complete,
+      .counters = {.nodes = now->nodes - start->nodes,
+                   .qnodes = now->qnodes - start->qnodes,
+                   .table_probes = now->table_probes - start->table_probes,
+                   .table_hits = now->table_hits - start->table_hits,
+                   .cutoffs = now->cutoffs - start->cutoffs,
+                   .first_move_cutoffs =
+                       now->first_move_cutoffs - start->first_move_cutoffs,
+                   .seldepth = now->seldepth},
+      .previous_nodes = depth > 1 ? searcher->previous_nodes : 0,
+      .total_nodes = now->nodes,
+      .iteration_seconds = (ms - searcher->iteration_ms) / 1000,
+      .seconds = ms / 1000};
+
+  telemetry_record(searcher->limits->telemetry, &iteration);
+  searcher->previous_nodes = iteration.counters.nodes;
+  searcher->iteration_start = *now;
+  searcher->iteration_ms = ms;
+  now->seldepth = 0;
+}
+
+// The cache is keyed by the position alone, so it is only used when none of
+// the positions played before the root can recur in the search: there are
+// none, or a capture or pawn move has just been played.
+bool cacheable_position(const board_t *board,
+                        const search_limits_t *limits) {
+  return limits->history_length == 0 || board->fifty_move_rule_counter == 0;
+}
+
+// Fills result from the cache if it holds an exact result for board at least
+// as deep as the limits ask for: their depth or, without one, cache_depth.
+bool probe_cached_result(board_t *board, move_list_t *moves,
+                         const search_limits_t *limits,
+                         search_result_t *result) {
+  int wanted = limits->depth > 0 ? limits->depth : limits->cache_depth;
+  move_t move;
+  int score, depth, bound;
+
+  if (wanted <= 0 || !probe_search_cache(limits->cache, board->hash, &move,
+                                         &score, &depth, &bound) ||
+      bound != BOUND_EXACT || depth < wanted) {
+    return false;
+  }
+
+  for (int i = 0; i < moves->length; ++i) {
+    if (same_move(moves->moves[i], move)) {
+      memset(result, 0, sizeof(search_result_t));
+      result->best_move = move;
+      result->score = score;
+      result->depth = depth;
+      result->pv[0] = move;
+      result->pv_length = 1;
+      result->lines[0].score = score;
+      result->lines[0].pv[0] = move;
+      result->lines[0].pv_length = 1;
+      result->line_count = 1;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Searches board by iterative deepening until a limit is reached, leaving
+// the board as it was. The result is that of the last completed iteration;
+// the first iteration always completes. Returns false when there is no legal
+// move.
+bool search(board_t *board, const search_limits_t *limits,
+            search_table_t *table, search_result_t *result) {
+  move_list_t moves;
+  generate_legal_moves(board, board->side_to_move, &moves);
+
+  if (moves.length == 0) {
+    return false;
+  }
+
+  if (limits->cache != NULL && limits->multipv <= 1 &&
+      cacheable_position(board, limits) &&
+      probe_cached_result(board, &moves, limits, result)) {
+    return true;
+  }
+
+  searcher_t *searcher = calloc(1, sizeof(searcher_t));
+
+  if (searcher == NULL) {
+    return false;
+  }
+
+  searcher->hashes = malloc((limits->history_length + MAX_PLY + 1) *
+                            sizeof(unsigned long long));
+
+  if (searcher->hashes == NULL) {
+    free(searcher);
+    return false;
+  }
+
+  memcpy(searcher->hashes, limits->history,
+         limits->history_length * sizeof(unsigned long long));
+  searcher->hash_count = limits->history_length;
+  searcher->hashes[searcher->hash_count++] = board->hash;
+  searcher->board = board;
+  searcher->table = table;
+  searcher->pawns = create_pawn_table();
+  searcher->limits = limits;
+  clock_gettime(CLOCK_MONOTONIC, &searcher->start);
+  bool telemetry = limits->telemetry != NULL;
+
+  if (telemetry) {
+    searcher->search_id = telemetry_next_search(limits->telemetry);
+  }
+
+  int max_depth = limits->depth > 0 && limits->depth < MAX_DEPTH
+                      ? limits->depth
+                      : MAX_DEPTH;
+
+  int line_count = limits->multipv > 1 ? limits->multipv : 1;
+
+  if (line_count > MAX_MULTIPV) {
+    line_count = MAX_MULTIPV;
+  }
+
+  if (line_count > moves.length) {
+    line_count = moves.length;
+  }
+
+  memset(result, 0, sizeof(search_result_t));
+  result->best_move = moves.moves[0];
+  search_line_t lines[MAX_MULTIPV];
+
+  // Each line is searched with the root moves of the lines before it left
+  // out. The table, killers and history carry over from line to line and
+  // from iteration to iteration.
+  for (int depth = 1; depth <= max_depth; ++depth) {
+    searcher->excluded_count = 0;
+
+    for (int i = 0; i < line_count && !searcher->stopped; ++i) {
+      lines[i].score = negamax(searcher, depth, -MATE_SCORE, MATE_SCORE, 0);
+      lines[i].pv_length = searcher->pv_length[0];
+      memcpy(lines[i].pv, searcher->pv[0],
+             lines[i].pv_length * sizeof(move_t));
+
+      if (lines[i].pv_length > 0) {
+        searcher->excluded[searcher->excluded_count++] = lines[i].pv[0];
+      }
+    }
+
+    if (searcher->stopped) {
+      if (telemetry) {
+        record_iteration(searcher, depth, line_count, 0, false);
+      }
+
+      break;
+    }
+
+    int score = lines[0].score;
+    result->depth = depth;
+    result->score = score;
+    result->pv_length = lines[0].pv_length;
+    memcpy(result->pv, lines[0].pv, result->pv_length * sizeof(move_t));
+
+    if (result->pv_length > 0) {
+      result->best_move = result->pv[0];
+    }
+
+    result->line_count = line_count;
+    memcpy(result->lines, lines, line_count * sizeof(search_line_t));
+    result->nodes = searcher->counters.nodes;
+    result->seconds = elapsed_ms(&searcher->start) / 1000;
+
+    if (limits->progress != NULL) {
+      limits->progress(result, limits->progress_arg);
+    }
+
+    if (telemetry) {
+      record_iteration(searcher, depth, line_count, score, true);
+    }
+
+    searcher->can_stop = true;
+
+    // A forced mate found within the depth searched will not change, though
+    // the other lines might.
+    if ((line_count == 1 && (score > MATE_BOUND || score < -MATE_BOUND)) ||
+        should_stop(searcher)) {
+      break;
+    }
+  }
+
+  result->nodes = searcher->counters.nodes;
+  result->seconds = elapsed_ms(&searcher->start) / 1000;
+
+  if (limits->cache != NULL && cacheable_position(board, limits)) {
+    store_search_cache(limits->cache, board->hash, result->best_move,
+                       result->score, result->depth, BOUND_EXACT);
+  }
+
+  free_pawn_table(searcher->pawns);
+  free(searcher->hashes);
+  free(searcher);
+  return true;
+}
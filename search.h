@@ -0,0 +1,82 @@
+#include "search_cache.h"
+#include "telemetry.h"
+#include "types.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+#pragma once
+#pragma GCC visibility push(default)
+
+#define MATE_SCORE 32000
+#define MAX_PLY 128
+#define MAX_DEPTH 64
+#define MAX_MULTIPV 8
+
+// Scores beyond this are mates, MATE_SCORE - score plies away.
+#define MATE_BOUND (MATE_SCORE - MAX_PLY)
+
+// Whether a stored score is exact or only a lower or upper bound.
+#define BOUND_EXACT 0
+#define BOUND_LOWER 1
+#define BOUND_UPPER 2
+
+typedef struct SearchTable search_table_t;
+
+// One root move and the line the search expects after it.
+typedef struct SearchLine {
+  int score;
+  move_t pv[MAX_PLY];
+  int pv_length;
+} search_line_t;
+
+// lines holds the line_count best root moves, best first; the first is also
+// given as score and pv.
+typedef struct SearchResult {
+  move_t best_move;
+  int score;
+  int depth;
+  unsigned long long nodes;
+  double seconds;
+  move_t pv[MAX_PLY];
+  int pv_length;
+  search_line_t lines[MAX_MULTIPV];
+  int line_count;
+} search_result_t;
+
+typedef void (*search_progress_fn_t)(const search_result_t *result,
+                                     void *arg);
+
+// Zero for depth, nodes or milliseconds means no limit on it. history holds
+// the hashes of the positions played before this one, oldest first, so that
+// repetitions of them are scored as draws. multipv is how many of the best
+// root moves to report (at most MAX_MULTIPV); zero means one. With a cache,
+// a single-line search first looks its position up there, and a result at
+// least depth deep (or cache_depth deep when depth is zero) is returned
+// without searching. Every search stores its result in the cache. Searches
+// whose history could repeat (one was given and the last move was neither a
+// capture nor a pawn move) bypass the cache, since it ignores repetitions.
+// With telemetry, every iteration is recorded there.
+typedef struct SearchLimits {
+  int depth;
+  int multipv;
+  unsigned long long nodes;
+  long milliseconds;
+  atomic_bool *stop;
+  const unsigned long long *history;
+  int history_length;
+  search_progress_fn_t progress;
+  void *progress_arg;
+  search_cache_t *cache;
+  int cache_depth;
+  telemetry_t *telemetry;
+} search_limits_t;
+
+search_table_t *create_search_table(size_t megabytes);
+void free_search_table(search_table_t *table);
+void clear_search_table(search_table_t *table);
+bool search(board_t *board, const search_limits_t *limits,
+            search_table_t *table, search_result_t *result);
+bool is_capture(board_t *board, move_t move);
+void format_score(int score, char *text, size_t size);
+
+#pragma GCC visibility pop
@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "search_cache.h"
+#include "move_piece.h"
+#include "types.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The cache file is a 64-byte header ("TCSC", u32 version, u64 bucket count)
+// followed by the buckets, in native byte order, mapped shared by every
+// process using it. Entries are written without locks like the search
+// table's: check holds key ^ data, so an entry torn by a concurrent writer or
+// a crash fails to match and is simply overwritten later. The file therefore
+// never needs repairing. Only creating it takes a lock.
+#define SEARCH_CACHE_MAGIC "TCSC"
+#define SEARCH_CACHE_VERSION 1
+#define SEARCH_CACHE_WAYS 4
+
+typedef struct SearchCacheHeader {
+  char magic[4];
+  unsigned int version;
+  unsigned long long buckets;
+  char reserved[48];
+} search_cache_header_t;
+
+// data packs the encoded move (16 bits), score (16), depth (8) and bound (2).
+typedef struct SearchCacheEntry {
+  _Atomic unsigned long long check;
+  _Atomic unsigned long long data;
+} search_cache_entry_t;
+
+// One cache line of entries that a position may occupy.
+typedef struct SearchCacheBucket {
+  search_cache_entry_t entries[SEARCH_CACHE_WAYS];
+} search_cache_bucket_t;
+
+struct SearchCache {
+  search_cache_bucket_t *buckets;
+  size_t mask;
+  void *map;
+  size_t size;
+};
+
+// Holds an exclusive lock on the whole file while it is checked and, if new,
+// laid out, so that processes opening it at once agree on its size.
+bool lock_cache_file(int fd, short type) {
+  struct flock lock = {.l_type = type, .l_whence = SEEK_SET};
+  return fcntl(fd, F_SETLKW, &lock) == 0;
+}
+
+// Opens the cache at path, creating it with about megabytes of entries if it
+// does not exist, is empty or was never fully laid out. An existing cache
+// keeps its size, and a file that is not a cache is rejected untouched.
+search_cache_t *open_search_cache(const char *path, size_t megabytes) {
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  search_cache_header_t header = {0};
+  struct stat st;
+  bool ok = lock_cache_file(fd, F_WRLCK) && fstat(fd, &st) == 0;
+
+  if (ok && st.st_size != 0) {
+    ok = (size_t)st.st_size >= sizeof(header) &&
+         pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+         memcmp(header.magic, SEARCH_CACHE_MAGIC, 4) == 0;
+  }
+
+  // Only a new file, or one whose layout was cut short, is laid out; any
+  // other file is left alone. The header goes in first without a bucket
+  // count, so that a layout cut short can always be recognised.
+  if (ok && header.buckets == 0) {
+    size_t buckets = 1;
+
+    while (buckets * 2 * sizeof(search_cache_bucket_t) <=
+           megabytes * 1024 * 1024) {
+      buckets *= 2;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEARCH_CACHE_MAGIC, 4);
+    header.version = SEARCH_CACHE_VERSION;
+    ok = pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+         ftruncate(fd, sizeof(header)) == 0 &&
+         ftruncate(fd, sizeof(header) +
+                           buckets * sizeof(search_cache_bucket_t)) == 0;
+    header.buckets = buckets;
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+         fstat(fd, &st) == 0;
+  }
+
+  size_t buckets = header.buckets;
+  ok = ok && memcmp(header.magic, SEARCH_CACHE_MAGIC, 4) == 0 &&
+       header.version == SEARCH_CACHE_VERSION &&
+       (buckets & (buckets - 1)) == 0 &&
+       sizeof(header) + buckets * sizeof(search_cache_bucket_t) ==
+           (size_t)st.st_size;
+
+  void *map = ok ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0)
+                 : MAP_FAILED;
+  lock_cache_file(fd, F_UNLCK);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  search_cache_t *cache = malloc(sizeof(search_cache_t));
+
+  if (cache == NULL) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  // Probes land on scattered buckets.
+  posix_madvise(map, st.st_size, POSIX_MADV_RANDOM);
+
+  cache->map = map;
+  cache->size = st.st_size;
+  cache->buckets =
+      (search_cache_bucket_t *)((char *)map + sizeof(search_cache_header_t));
+  cache->mask = buckets - 1;
+  return cache;
+}
+
+// Entries reach the file as the kernel writes the pages back, whether or not
+// the process exits cleanly.
+void close_search_cache(search_cache_t *cache) {
+  munmap(cache->map, cache->size);
+  free(cache);
+}
+
+// Reads entry into data, returning false if it does not hold hash.
+bool read_cache_entry(search_cache_entry_t *entry, unsigned long long hash,
+                      unsigned long long *data) {
+  *data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+  unsigned long long check =
+      atomic_load_explicit(&entry->check, memory_order_relaxed);
+
+  return (check ^ *data) == hash && *data != 0;
+}
+
+bool probe_search_cache(search_cache_t *cache, unsigned long long hash,
+                        move_t *move, int *score, int *depth, int *bound) {
+  search_cache_bucket_t *bucket = &cache->buckets[hash & cache->mask];
+  unsigned long long data;
+
+  for (int i = 0; i < SEARCH_CACHE_WAYS; ++i) {
+    if (read_cache_entry(&bucket->entries[i], hash, &data)) {
+      *move = decode_move(data & 0xffff);
+      *score = (short)(data >> 16);
+      *depth = (data >> 32) & 0xff;
+      *bound = (data >> 40) & 3;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Deeper results take priority: a position's entry is only replaced by one
+// at least as deep, and otherwise the bucket's empty or shallowest entry is,
+// again only by a result at least as deep.
+void store_search_cache(search_cache_t *cache, unsigned long long hash,
+                        move_t move, int score, int depth, int bound) {
+  search_cache_bucket_t *bucket = &cache->buckets[hash & cache->mask];
+  search_cache_entry_t *victim = NULL;
+  int victim_depth = 256;
+  unsigned long long data;
+
+  for (int i = 0; i < SEARCH_CACHE_WAYS; ++i) {
+    search_cache_entry_t *entry = &bucket->entries[i];
+
+    if (read_cache_entry(entry, hash, &data)) {
+      victim = entry;
+      victim_depth = (data >> 32) & 0xff;
+      break;
+    }
+
+    int entry_depth = data == 0 ? -1 : (int)((data >> 32) & 0xff);
+
+    if (entry_depth < victim_depth) {
+      victim = entry;
+      victim_depth = entry_depth;
+    }
+  }
+
+  if (depth < victim_depth) {
+    return;
+  }
+
+  data = encode_move(move) | (unsigned long long)(unsigned short)score << 16 |
+         (unsigned long long)depth << 32 | (unsigned long long)bound << 40;
+  atomic_store_explicit(&victim->data, data, memory_order_relaxed);
+  atomic_store_explicit(&victim->check, hash ^ data, memory_order_relaxed);
+}
@@ -0,0 +1,16 @@
+#include "types.h"
+#include <stddef.h>
+
+#pragma once
+#pragma GCC visibility push(default)
+
+typedef struct SearchCache search_cache_t;
+
+search_cache_t *open_search_cache(const char *path, size_t megabytes);
+void close_search_cache(search_cache_t *cache);
+bool probe_search_cache(search_cache_t *cache, unsigned long long hash,
+                        move_t *move, int *score, int *depth, int *bound);
+void store_search_cache(search_cache_t *cache, unsigned long long hash,
+                        move_t move, int score, int depth, int bound);
+
+#pragma GCC visibility pop
@@ -0,0 +1,614 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "game.h"
+#include "move_piece.h"
+#include "pgn.h"
+#include "types.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_LINE_SIZE 256
+#define SERVER_EVENTS 256
+// A client that stops reading its replies is dropped once this much output
+// is queued for it.
+#define SERVER_MAX_OUTPUT (1 << 20)
+
+typedef struct ServerClient server_client_t;
+
+// A game hosted by the server. Games are numbered by their slot; when one
+// ends its arena goes on a free list for the next new game.
+typedef struct ServerGame {
+  game_arena_t arena;
+  int id;
+  server_client_t *owner;
+  struct ServerGame *owner_prev;
+  struct ServerGame *owner_next;
+  struct ServerGame *next_free;
+} server_game_t;
+
+struct ServerClient {
+  int fd;
+  char input[SERVER_LINE_SIZE];
+  size_t input_length;
+  bool discarding;
+  char *output;
+  size_t output_length;
+  size_t output_capacity;
+  bool waiting_to_write;
+  bool closed;
+  server_game_t *games;
+  server_client_t *prev;
+  server_client_t *next;
+};
+
+typedef struct Server {
+  int listen_fd;
+  int epoll_fd;
+  server_game_t **games;
+  int max_games;
+  int game_count;
+  int *free_ids;
+  int free_id_count;
+  server_game_t *free_games;
+  int arena_count;
+  server_client_t *clients;
+} server_t;
+
+volatile sig_atomic_t server_stopping = 0;
+
+void server_stop(int signal) {
+  (void)signal;
+  server_stopping = 1;
+}
+
+int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void server_reply(server_client_t *client, const char *format, ...) {
+  char line[SERVER_LINE_SIZE];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line) - 1, format, args);
+  va_end(args);
+
+  if (length < 0) {
+    return;
+  }
+
+  if ((size_t)length > sizeof(line) - 2) {
+    length = sizeof(line) - 2;
+  }
+
+  line[length++] = '\n';
+
+  if (client->output_length + length > client->output_capacity) {
+    size_t capacity =
+        client->output_capacity == 0 ? 4096 : client->output_capacity * 2;
+
+    while (capacity < client->output_length + length) {
+      capacity *= 2;
+    }
+
+    char *output = capacity > SERVER_MAX_OUTPUT
+                       ? NULL
+                       : realloc(client->output, capacity);
+
+    if (output == NULL) {
+      client->closed = true;
+      return;
+    }
+
+    client->output = output;
+    client->output_capacity = capacity;
+  }
+
+  memcpy(client->output + client->output_length, line, length);
+  client->output_length += length;
+}
+
+// Writes as much queued output as the socket takes, and asks epoll to report
+// when it can take the rest.
+void server_flush(server_t *server, server_client_t *client) {
+  size_t written = 0;
+
+  while (written < client->output_length) {
+    ssize_t n = send(client->fd, client->output + written,
+                     client->output_length - written, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+
+    if (n < 0) {
+      client->closed = true;
+      return;
+    }
+
+    written += n;
+  }
+
+  memmove(client->output, client->output + written,
+          client->output_length - written);
+  client->output_length -= written;
+
+  bool waiting = client->output_length > 0;
+
+  if (waiting != client->waiting_to_write) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | (waiting ? EPOLLOUT : 0);
+    event.data.ptr = client;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    client->waiting_to_write = waiting;
+  }
+}
+
+server_game_t *server_new_game(server_t *server, server_client_t *client,
+                               const char *fen) {
+  if (server->free_id_count == 0) {
+    return NULL;
+  }
+
+  server_game_t *game = server->free_games;
+
+  if (game != NULL) {
+    server->free_games = game->next_free;
+  } else if ((game = malloc(sizeof(server_game_t))) != NULL) {
+    server->arena_count++;
+  } else {
+    return NULL;
+  }
+
+  if (start_arena_game(&game->arena, fen) == NULL) {
+    game->next_free = server->free_games;
+    server->free_games = game;
+    return NULL;
+  }
+
+  game->id = server->free_ids[--server->free_id_count];
+  game->owner = client;
+  game->owner_prev = NULL;
+  game->owner_next = client->games;
+
+  if (client->games != NULL) {
+    client->games->owner_prev = game;
+  }
+
+  client->games = game;
+  server->games[game->id] = game;
+  server->game_count++;
+  return game;
+}
+
+// Returns a finished game's arena to the free list and its number to the
+// pool.
+void server_end_game(server_t *server, server_game_t *game) {
+  finish_arena_game(&game->arena);
+
+  if (game->owner_prev != NULL) {
+    game->owner_prev->owner_next = game->owner_next;
+  } else {
+    game->owner->games = game->owner_next;
+  }
+
+  if (game->owner_next != NULL) {
+    game->owner_next->owner_prev = game->owner_prev;
+  }
+
+  server->games[game->id] = NULL;
+  server->free_ids[server->free_id_count++] = game->id;
+  server->game_count--;
+  game->next_free = server->free_games;
+  server->free_games = game;
+}
+
+server_game_t *server_find_game(server_t *server, server_client_t *client,
+                                const char *id) {
+  char *end;
+  long number = id != NULL ? strtol(id, &end, 10) : -1;
+
+  if (id == NULL || *id == '\0' || *end != '\0' || number < 0 ||
+      number >= server->max_games) {
+    return NULL;
+  }
+
+  server_game_t *game = server->games[number];
+  return game != NULL && game->owner == client ? game : NULL;
+}
+
+const char *server_status(game_t *game) {
+  if (!game->over) {
+    return "playing";
+  }
+
+  switch (game->reason) {
+  case CHECKMATE:
+    return "checkmate";
+  case RESIGNATION:
+    return "resignation";
+  case STALEMATE:
+    return "stalemate";
+  case DRAW_OFFER:
+    return "agreement";
+  case THREEFOLD:
+    return "threefold";
+  case FIFTY_MOVE_RULE:
+    return "fifty-moves";
+  case INSUFFICIENT_MATERIAL:
+    return "insufficient-material";
+  }
+
+  return "playing";
+}
+
+// Reports where a game stands, and recycles it if it has ended.
+void server_report(server_t *server, server_client_t *client,
+                   server_game_t *game, const char *played) {
+  game_t *state = &game->arena.game;
+  server_reply(client, "ok %d %s %s %s", game->id, played,
+               server_status(state), result_string(state->result));
+
+  if (state->over) {
+    server_end_game(server, game);
+  }
+}
+
+void server_command(server_t *server, server_client_t *client, char *line) {
+  char *save;
+  char *command = strtok_r(line, " \t\r", &save);
+
+  if (command == NULL) {
+    return;
+  }
+
+  if (strcmp(command, "new") == 0) {
+    char *fen = strtok_r(NULL, "\r", &save);
+    server_game_t *game = server_new_game(server, client, fen);
+
+    if (game == NULL) {
+      server_reply(client, "error %s",
+                   server->free_id_count == 0 ? "too many games"
+                                              : "invalid position");
+      return;
+    }
+
+    server_report(server, client, game, "-");
+    return;
+  }
+
+  if (strcmp(command, "stats") == 0) {
+    server_reply(client, "ok games %d arenas %d bytes %zu", server->game_count,
+                 server->arena_count,
+                 server->arena_count * sizeof(server_game_t));
+    return;
+  }
+
+  server_game_t *game =
+      server_find_game(server, client, strtok_r(NULL, " \t\r", &save));
+
+  if (game == NULL) {
+    server_reply(client, "error unknown game");
+    return;
+  }
+
+  game_t *state = &game->arena.game;
+
+  if (strcmp(command, "move") == 0) {
+    char *san = strtok_r(NULL, " \t\r", &save);
+    move_t move;
+    char played[16];
+
+    if (san == NULL || strlen(san) > 9 ||
+        !san_to_move(state->board, san, state->board->side_to_move, &move)) {
+      server_reply(client, "error illegal move");
+      return;
+    }
+
+    move_to_san(state->board, move, played);
+
+    if (!game_play_move(state, move)) {
+      server_reply(client, "error illegal move");
+      return;
+    }
+
+    server_report(server, client, game, played);
+  } else if (strcmp(command, "fen") == 0) {
+    char *fen = game_fen(state);
+
+    if (fen == NULL) {
+      server_reply(client, "error out of memory");
+      return;
+    }
+
+    server_reply(client, "ok %d %s", game->id, fen);
+    free(fen);
+  } else if (strcmp(command, "resign") == 0) {
+    game_resign(state);
+    server_report(server, client, game, "-");
+  } else if (strcmp(command, "draw") == 0) {
+    game_offer_draw(state);
+    server_report(server, client, game,
+                  state->draw_offer == NO_OFFER ? "-" : "offered");
+  } else if (strcmp(command, "close") == 0) {
+    server_reply(client, "ok %d closed", game->id);
+    server_end_game(server, game);
+  } else {
+    server_reply(client, "error unknown command");
+  }
+}
+
+// Runs every complete line received so far. A line too long for the buffer
+// is answered with an error and skipped.
+void server_read(server_t *server, server_client_t *client) {
+  while (!client->closed) {
+    ssize_t n = read(client->fd, client->input + client->input_length,
+                     sizeof(client->input) - client->input_length);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+
+    if (n <= 0) {
+      client->closed = true;
+      break;
+    }
+
+    size_t length = client->input_length + n;
+    size_t start = 0;
+
+    for (size_t i = client->input_length; i < length; ++i) {
+      if (client->input[i] != '\n') {
+        continue;
+      }
+
+      client->input[i] = '\0';
+
+      if (!client->discarding) {
+        server_command(server, client, client->input + start);
+      }
+
+      client->discarding = false;
+      start = i + 1;
+    }
+
+    memmove(client->input, client->input + start, length - start);
+    client->input_length = length - start;
+
+    if (client->input_length == sizeof(client->input)) {
+      if (!client->discarding) {
+        server_reply(client, "error line too long");
+      }
+
+      client->discarding = true;
+      client->input_length = 0;
+    }
+  }
+
+  server_flush(server, client);
+}
+
+void server_close_client(server_t *server, server_client_t *client) {
+  while (client->games != NULL) {
+    server_end_game(server, client->games);
+  }
+
+  if (client->prev != NULL) {
+    client->prev->next = client->next;
+  } else {
+    server->clients = client->next;
+  }
+
+  if (client->next != NULL) {
+    client->next->prev = client->prev;
+  }
+
+  epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  free(client->output);
+  free(client);
+}
+
+void server_accept(server_t *server) {
+  while (true) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return;
+    }
+
+    server_client_t *client = calloc(1, sizeof(server_client_t));
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = client;
+
+    if (client == NULL || set_nonblocking(fd) < 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      free(client);
+      close(fd);
+      continue;
+    }
+
+    client->fd = fd;
+    client->next = server->clients;
+
+    if (server->clients != NULL) {
+      server->clients->prev = client;
+    }
+
+    server->clients = client;
+  }
+}
+
+int open_server_socket(const char *path) {
+  struct sockaddr_un address = {0};
+  address.sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "socket path too long: %s\n", path);
+    return -1;
+  }
+
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  // Only a socket left behind by an earlier server is replaced; any other
+  // file at path is left alone.
+  struct stat status;
+
+  if (lstat(path, &status) == 0) {
+    if (!S_ISSOCK(status.st_mode)) {
+      fprintf(stderr, "%s: exists and is not a socket\n", path);
+      close(fd);
+      return -1;
+    }
+
+    unlink(path);
+  } else if (errno != ENOENT) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0 || set_nonblocking(fd) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Serves games on the Unix socket at path until interrupted. Each line a
+// client sends is one command:
+//
+//   new [FEN]        start a game          ok ID - STATUS RESULT
+//   move ID SAN      play a move           ok ID SAN STATUS RESULT
+//   fen ID           current position      ok ID FEN
+//   resign ID        side to move resigns  ok ID - STATUS RESULT
+//   draw ID          offer/accept a draw   ok ID offered|- STATUS RESULT
+//   close ID         abandon the game      ok ID closed
+//   stats            server totals         ok games N arenas N bytes N
+//
+// Failures reply "error REASON". Games belong to the connection that started
+// them and end when they are decided, closed or the connection drops.
+int run_server(const char *path, int max_games) {
+  server_t server = {0};
+  server.max_games = max_games > 0 ? max_games : 10000;
+  server.games = calloc(server.max_games, sizeof(server_game_t *));
+  server.free_ids = malloc(server.max_games * sizeof(int));
+
+  if (server.games == NULL || server.free_ids == NULL) {
+    free(server.games);
+    free(server.free_ids);
+    return 1;
+  }
+
+  // Lowest numbers are handed out first.
+  for (int i = 0; i < server.max_games; ++i) {
+    server.free_ids[i] = server.max_games - 1 - i;
+  }
+
+  server.free_id_count = server.max_games;
+  server.listen_fd = open_server_socket(path);
+  server.epoll_fd = epoll_create1(0);
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+
+  if (server.listen_fd < 0 || server.epoll_fd < 0 ||
+      epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event) <
+          0) {
+    if (server.listen_fd >= 0) {
+      close(server.listen_fd);
+      unlink(path);
+    }
+
+    free(server.games);
+    free(server.free_ids);
+    return 1;
+  }
+
+  struct sigaction action = {0};
+  action.sa_handler = server_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  struct epoll_event events[SERVER_EVENTS];
+
+  while (!server_stopping) {
+    int count = epoll_wait(server.epoll_fd, events, SERVER_EVENTS, -1);
+
+    if (count < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      server_client_t *client = events[i].data.ptr;
+
+      if (client == NULL) {
+        server_accept(&server);
+        continue;
+      }
+
+      if (events[i].events & EPOLLOUT) {
+        server_flush(&server, client);
+      }
+
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        server_read(&server, client);
+      }
+
+      if (client->closed) {
+        server_close_client(&server, client);
+      }
+    }
+  }
+
+  while (server.clients != NULL) {
+    server_close_client(&server, server.clients);
+  }
+
+  while (server.free_games != NULL) {
+    server_game_t *next = server.free_games->next_free;
+    free(server.free_games);
+    server.free_games = next;
+  }
+
+  close(server.epoll_fd);
+  close(server.listen_fd);
+  unlink(path);
+  free(server.games);
+  free(server.free_ids);
+  return 0;
+}
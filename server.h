@@ -0,0 +1,5 @@
+#include "types.h"
+
+#pragma once
+
+int run_server(const char *path, int max_games);
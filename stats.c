@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include "types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STATS_CLOCK_UNIT "cycles"
+#else
+#define STATS_CLOCK_UNIT "ns"
+#endif
+
+const char *const stat_names[STAT_COUNT] = {
+    "can_move",
+    "square_attacked",
+    "is_in_check",
+    "is_legal_move",
+    "has_legal_move",
+    "generate_legal_moves",
+    "insufficient_material",
+    "move_from_san",
+};
+
+bool stats_enabled(void) {
+#ifdef CHESS_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+unsigned long long stats_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+void stats_record(stats_t *stats, stat_id_t id, unsigned long long start) {
+  if (stats == NULL) {
+    return;
+  }
+
+  atomic_fetch_add_explicit(&stats->calls[id], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats->cycles[id], stats_clock() - start,
+                            memory_order_relaxed);
+}
+
+void stats_count(stats_t *stats, counter_id_t id) {
+  if (stats != NULL) {
+    atomic_fetch_add_explicit(&stats->counters[id], 1, memory_order_relaxed);
+  }
+}
+
+bool stats_leave(stats_t *stats, stat_id_t id, unsigned long long start,
+                 bool value) {
+  stats_record(stats, id, start);
+  return value;
+}
+
+void stats_print(FILE *out, stats_t *stats) {
+  if (!stats_enabled()) {
+    fprintf(out, "Statistics were not compiled in (build with make STATS=1)\n");
+    return;
+  }
+
+  unsigned long long moves = stats->calls[STAT_MOVE_FROM_SAN];
+
+  fprintf(out, "%-22s %12s %10s %14s %12s\n", "function", "calls", "per move",
+          STATS_CLOCK_UNIT, "per call");
+
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    unsigned long long calls = stats->calls[i];
+    unsigned long long cycles = stats->cycles[i];
+
+    fprintf(out, "%-22s %12llu %10.1f %14llu %12.1f\n", stat_names[i], calls,
+            moves > 0 ? (double)calls / moves : 0.0, cycles,
+            calls > 0 ? (double)cycles / calls : 0.0);
+  }
+
+  unsigned long long probes = stats->counters[COUNTER_PAWN_PROBES];
+
+  if (probes > 0) {
+    unsigned long long hits = stats->counters[COUNTER_PAWN_HITS];
+    fprintf(out, "pawn hash: %llu probes, %llu hits (%.1f%%)\n", probes, hits,
+            100.0 * hits / probes);
+  }
+}
@@ -0,0 +1,60 @@
+#include "types.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+#pragma once
+
+typedef enum StatId {
+  STAT_CAN_MOVE,
+  STAT_SQUARE_ATTACKED,
+  STAT_IS_IN_CHECK,
+  STAT_IS_LEGAL_MOVE,
+  STAT_HAS_LEGAL_MOVE,
+  STAT_GENERATE_LEGAL_MOVES,
+  STAT_INSUFFICIENT_MATERIAL,
+  STAT_MOVE_FROM_SAN,
+  STAT_COUNT,
+} stat_id_t;
+
+// Event counts that are not tied to a timed function.
+typedef enum CounterId {
+  COUNTER_PAWN_PROBES,
+  COUNTER_PAWN_HITS,
+  COUNTER_COUNT,
+} counter_id_t;
+
+// Counts for the boards a caller attaches it to (board->stats). Copies of a
+// board count into the same stats from whichever thread uses them, so the
+// counts are atomic.
+typedef struct Stats {
+  _Atomic unsigned long long calls[STAT_COUNT];
+  _Atomic unsigned long long cycles[STAT_COUNT];
+  _Atomic unsigned long long counters[COUNTER_COUNT];
+} stats_t;
+
+bool stats_enabled(void);
+unsigned long long stats_clock(void);
+void stats_record(stats_t *stats, stat_id_t id, unsigned long long start);
+void stats_count(stats_t *stats, counter_id_t id);
+bool stats_leave(stats_t *stats, stat_id_t id, unsigned long long start,
+                 bool value);
+void stats_print(FILE *out, stats_t *stats);
+
+// Instrumented functions call STATS_ENTER() on entry and wrap every returned
+// value in STATS_RETURN; STATS_COUNT bumps an event counter. They count into
+// the stats of the function's board argument, which must be named board, and
+// do nothing for boards without stats. Unless the build defines CHESS_STATS
+// (make STATS=1) they all expand to nothing.
+#ifdef CHESS_STATS
+#define STATS_ENTER()                                                          \
+  unsigned long long stats_start = board->stats != NULL ? stats_clock() : 0
+#define STATS_RETURN(id, value)                                                \
+  stats_leave(board->stats, (id), stats_start, (value))
+#define STATS_LEAVE(id) stats_record(board->stats, (id), stats_start)
+#define STATS_COUNT(id) stats_count(board->stats, (id))
+#else
+#define STATS_ENTER() ((void)0)
+#define STATS_RETURN(id, value) (value)
+#define STATS_LEAVE(id) ((void)0)
+#define STATS_COUNT(id) ((void)0)
+#endif
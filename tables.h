@@ -0,0 +1,33 @@
+#pragma once
+
+// Constant lookup tables written by gen_tables at build time. Squares are
+// numbered rank * 8 + file and bitboards have bit square set for each square.
+//
+// Directions 0-3 are diagonal and 4-7 straight, each followed by its
+// opposite: NE, SW, NW, SE, E, W, N, S.
+
+// Squares a knight or king on a square can move to, in generation order.
+extern const unsigned char knight_targets[64][8];
+extern const unsigned char knight_target_counts[64];
+extern const unsigned long long knight_attacks[64];
+extern const unsigned char king_targets[64][8];
+extern const unsigned char king_target_counts[64];
+extern const unsigned long long king_attacks[64];
+
+// Squares a pawn of each colour attacks.
+extern const unsigned long long pawn_attacks[2][64];
+
+// The squares from a square to the edge in each direction, nearest first.
+extern const unsigned char ray_squares[64][8][7];
+extern const unsigned char ray_lengths[64][8];
+extern const unsigned long long ray_masks[64][8];
+
+// For two squares on a common rank, file or diagonal: the squares strictly
+// between them, and the whole line through both. Zero otherwise.
+extern const unsigned long long between_masks[64][64];
+extern const unsigned long long line_masks[64][64];
+
+// King-move distance between two squares, and the direction from the first
+// to the second (-1 when they share no line).
+extern const unsigned char square_distances[64][64];
+extern const signed char square_directions[64][64];
@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "telemetry.h"
+#include "types.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Searches count into their own searcher and hand over one record per
+// iteration, so the only shared state is the sink, taken once per line.
+struct Telemetry {
+  FILE *file;
+  pthread_mutex_t lock;
+  atomic_ulong searches;
+};
+
+// Sends one JSON object per line to path, appending, or to stderr for "-".
+telemetry_t *open_telemetry(const char *path) {
+  telemetry_t *telemetry = malloc(sizeof(telemetry_t));
+
+  if (telemetry == NULL) {
+    return NULL;
+  }
+
+  telemetry->file = strcmp(path, "-") == 0 ? stderr : fopen(path, "a");
+
+  if (telemetry->file == NULL) {
+    free(telemetry);
+    return NULL;
+  }
+
+  pthread_mutex_init(&telemetry->lock, NULL);
+  atomic_init(&telemetry->searches, 0);
+  return telemetry;
+}
+
+// Call once no search using telemetry is running.
+void close_telemetry(telemetry_t *telemetry) {
+  if (telemetry->file != stderr) {
+    fclose(telemetry->file);
+  }
+
+  pthread_mutex_destroy(&telemetry->lock);
+  free(telemetry);
+}
+
+// Numbers the searches sent to telemetry, so that records of searches
+// running at once can be told apart.
+unsigned long telemetry_next_search(telemetry_t *telemetry) {
+  return atomic_fetch_add(&telemetry->searches, 1) + 1;
+}
+
+double telemetry_ratio(unsigned long long part, unsigned long long whole) {
+  return whole > 0 ? (double)part / whole : 0;
+}
+
+void telemetry_record(telemetry_t *telemetry,
+                      const telemetry_iteration_t *iteration) {
+  const search_counters_t *counters = &iteration->counters;
+  struct timespec now;
+  char score[16], branching[32];
+  char line[640];
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  if (iteration->complete) {
+    snprintf(score, sizeof(score), "%d", iteration->score);
+  } else {
+    snprintf(score, sizeof(score), "null");
+  }
+
+  // The effective branching factor compares this iteration with the last.
+  if (iteration->previous_nodes > 0) {
+    snprintf(branching, sizeof(branching), "%.3f",
+             telemetry_ratio(counters->nodes, iteration->previous_nodes));
+  } else {
+    snprintf(branching, sizeof(branching), "null");
+  }
+
+  int length = snprintf(
+      line, sizeof(line),
+      "{\"time\":%lld,\"search\":%lu,\"depth\":%d,\"seldepth\":%d,"
+      "\"complete\":%s,\"multipv\":%d,\"score\":%s,\"nodes\":%llu,"
+      "\"qnodes\":%llu,\"total_nodes\":%llu,\"tt_probes\":%llu,"
+      "\"tt_hit_rate\":%.4f,\"cutoffs\":%llu,"
+      "\"first_move_cutoff_rate\":%.4f,\"ebf\":%s,\"iteration_ms\":%.3f,"
+      "\"ms\":%.3f,\"nps\":%.0f}\n",
+      (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000, iteration->search,
+      iteration->depth, counters->seldepth,
+      iteration->complete ? "true" : "false", iteration->multipv, score,
+      counters->nodes, counters->qnodes, iteration->total_nodes,
+      counters->table_probes,
+      telemetry_ratio(counters->table_hits, counters->table_probes),
+      counters->cutoffs,
+      telemetry_ratio(counters->first_move_cutoffs, counters->cutoffs),
+      branching, iteration->iteration_seconds * 1000,
+      iteration->seconds * 1000,
+      iteration->seconds > 0 ? iteration->total_nodes / iteration->seconds
+                             : 0);
+
+  pthread_mutex_lock(&telemetry->lock);
+  fwrite(line, 1, length, telemetry->file);
+  fflush(telemetry->file);
+  pthread_mutex_unlock(&telemetry->lock);
+}
@@ -0,0 +1,44 @@
+#include "types.h"
+
+#pragma once
+#pragma GCC visibility push(default)
+
+// Search counters, kept by each search on its own thread. nodes counts every
+// position visited, qnodes those visited in quiescence.
+typedef struct SearchCounters {
+  unsigned long long nodes;
+  unsigned long long qnodes;
+  unsigned long long table_probes;
+  unsigned long long table_hits;
+  unsigned long long cutoffs;
+  unsigned long long first_move_cutoffs;
+  int seldepth;
+} search_counters_t;
+
+// What one iteration of iterative deepening did. counters hold the work of
+// that iteration alone; previous_nodes is the node count of the iteration
+// before it (zero for the first) and total_nodes that of the whole search.
+// An iteration cut short by a limit is not complete and has no score.
+typedef struct TelemetryIteration {
+  unsigned long search;
+  int depth;
+  int multipv;
+  int score;
+  bool complete;
+  search_counters_t counters;
+  unsigned long long previous_nodes;
+  unsigned long long total_nodes;
+  double iteration_seconds;
+  double seconds;
+} telemetry_iteration_t;
+
+// A sink that searches given it in their limits send their records to.
+typedef struct Telemetry telemetry_t;
+
+telemetry_t *open_telemetry(const char *path);
+void close_telemetry(telemetry_t *telemetry);
+unsigned long telemetry_next_search(telemetry_t *telemetry);
+void telemetry_record(telemetry_t *telemetry,
+                      const telemetry_iteration_t *iteration);
+
+#pragma GCC visibility pop
@@ -0,0 +1,12 @@
+#include "board.h"
+#include "eval.h"
+#include "game.h"
+#include "legal_moves.h"
+#include "move_piece.h"
+#include "position_batch.h"
+#include "search.h"
+#include "search_cache.h"
+#include "telemetry.h"
+#include "types.h"
+
+#pragma once
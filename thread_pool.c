@@ -0,0 +1,253 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "thread_pool.h"
+#include "types.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct PoolTask {
+  task_fn_t run;
+  void *arg;
+} pool_task_t;
+
+// A worker pushes and pops at the tail of its own queue and other workers
+// steal from the head, so thieves take the oldest (usually largest) tasks.
+typedef struct WorkerQueue {
+  pool_task_t *tasks;
+  size_t head;
+  size_t tail;
+  size_t capacity;
+  pthread_mutex_t lock;
+} worker_queue_t;
+
+typedef struct PoolWorker {
+  thread_pool_t *pool;
+  int index;
+} pool_worker_t;
+
+struct ThreadPool {
+  pthread_t *threads;
+  pool_worker_t *workers;
+  worker_queue_t *queues;
+  int thread_count;
+  int next_queue;
+  size_t queued;
+  size_t pending;
+  bool stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t work_available;
+  pthread_cond_t all_done;
+};
+
+int default_thread_count(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (int)cpus : 1;
+}
+
+bool queue_push(worker_queue_t *queue, pool_task_t task) {
+  pthread_mutex_lock(&queue->lock);
+
+  if (queue->tail - queue->head == queue->capacity) {
+    size_t capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+    pool_task_t *tasks = malloc(capacity * sizeof(pool_task_t));
+
+    if (!tasks) {
+      pthread_mutex_unlock(&queue->lock);
+      return false;
+    }
+
+    for (size_t i = queue->head; i < queue->tail; ++i) {
+      tasks[i - queue->head] = queue->tasks[i % queue->capacity];
+    }
+
+    free(queue->tasks);
+    queue->tasks = tasks;
+    queue->tail -= queue->head;
+    queue->head = 0;
+    queue->capacity = capacity;
+  }
+
+  queue->tasks[queue->tail++ % queue->capacity] = task;
+  pthread_mutex_unlock(&queue->lock);
+  return true;
+}
+
+bool queue_pop(worker_queue_t *queue, pool_task_t *task, bool steal) {
+  pthread_mutex_lock(&queue->lock);
+
+  if (queue->head == queue->tail) {
+    pthread_mutex_unlock(&queue->lock);
+    return false;
+  }
+
+  if (steal) {
+    *task = queue->tasks[queue->head++ % queue->capacity];
+  } else {
+    *task = queue->tasks[--queue->tail % queue->capacity];
+  }
+
+  pthread_mutex_unlock(&queue->lock);
+  return true;
+}
+
+bool take_task(thread_pool_t *pool, int worker, pool_task_t *task) {
+  if (queue_pop(&pool->queues[worker], task, false)) {
+    return true;
+  }
+
+  for (int i = 1; i < pool->thread_count; ++i) {
+    int victim = (worker + i) % pool->thread_count;
+
+    if (queue_pop(&pool->queues[victim], task, true)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void *pool_worker(void *arg) {
+  pool_worker_t *worker = arg;
+  thread_pool_t *pool = worker->pool;
+
+  while (true) {
+    pool_task_t task;
+
+    if (take_task(pool, worker->index, &task)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->queued--;
+      pthread_mutex_unlock(&pool->lock);
+
+      task.run(pool, worker->index, task.arg);
+
+      pthread_mutex_lock(&pool->lock);
+      if (--pool->pending == 0) {
+        pthread_cond_broadcast(&pool->all_done);
+      }
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->queued == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->work_available, &pool->lock);
+    }
+
+    bool stop = pool->stopping && pool->queued == 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (stop) {
+      return NULL;
+    }
+  }
+}
+
+thread_pool_t *create_thread_pool(int threads) {
+  if (threads <= 0) {
+    threads = default_thread_count();
+  }
+
+  thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+
+  if (!pool) {
+    return NULL;
+  }
+
+  pool->threads = malloc(threads * sizeof(pthread_t));
+  pool->workers = malloc(threads * sizeof(pool_worker_t));
+  pool->queues = calloc(threads, sizeof(worker_queue_t));
+
+  if (!pool->threads || !pool->workers || !pool->queues) {
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->queues);
+    free(pool);
+    return NULL;
+  }
+
+  pool->thread_count = threads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_available, NULL);
+  pthread_cond_init(&pool->all_done, NULL);
+
+  for (int i = 0; i < threads; ++i) {
+    pthread_mutex_init(&pool->queues[i].lock, NULL);
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    pthread_create(&pool->threads[i], NULL, pool_worker, &pool->workers[i]);
+  }
+
+  return pool;
+}
+
+int thread_pool_size(thread_pool_t *pool) { return pool->thread_count; }
+
+// worker is the index passed to the calling task, or -1 when submitting from
+// outside the pool.
+void thread_pool_submit(thread_pool_t *pool, int worker, task_fn_t run,
+                        void *arg) {
+  pthread_mutex_lock(&pool->lock);
+  pool->pending++;
+
+  if (worker < 0) {
+    worker = pool->next_queue;
+    pool->next_queue = (pool->next_queue + 1) % pool->thread_count;
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  pool_task_t task = {run, arg};
+
+  if (!queue_push(&pool->queues[worker], task)) {
+    // Out of memory: run it here rather than lose it.
+    run(pool, worker, arg);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_broadcast(&pool->all_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->queued++;
+  pthread_cond_signal(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Blocks until every submitted task, including tasks submitted by tasks, has
+// finished.
+void thread_pool_wait(thread_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->all_done, &pool->lock);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void free_thread_pool(thread_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->thread_count; ++i) {
+    pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->queues[i].lock);
+    free(pool->queues[i].tasks);
+  }
+
+  pthread_cond_destroy(&pool->all_done);
+  pthread_cond_destroy(&pool->work_available);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->queues);
+  free(pool);
+}
@@ -0,0 +1,17 @@
+#include "types.h"
+
+#pragma once
+
+typedef struct ThreadPool thread_pool_t;
+
+// Tasks receive the index of the worker running them, which they pass back
+// to thread_pool_submit so that subtasks go onto that worker's own queue.
+typedef void (*task_fn_t)(thread_pool_t *pool, int worker, void *arg);
+
+thread_pool_t *create_thread_pool(int threads);
+void free_thread_pool(thread_pool_t *pool);
+int thread_pool_size(thread_pool_t *pool);
+void thread_pool_submit(thread_pool_t *pool, int worker, task_fn_t run,
+                        void *arg);
+void thread_pool_wait(thread_pool_t *pool);
+int default_thread_count(void);
@@ -21,6 +21,13 @@ typedef enum GameOver {
   INSUFFICIENT_MATERIAL,
 } gameover_t;
 
+typedef enum GameResult {
+  RESULT_UNKNOWN,
+  WHITE_WINS,
+  BLACK_WINS,
+  DRAWN,
+} game_result_t;
+
 typedef struct Square square_t;
 
 typedef struct Piece {
@@ -36,16 +43,86 @@ typedef struct Square {
   unsigned int file : 3;
 } square_t;
 
+#define NNUE_HIDDEN 256
+
+typedef struct NnueNetwork nnue_network_t;
+typedef struct Stats stats_t;
+
+// First layer of the evaluation network for the current position, from
+// white's and from black's point of view.
+typedef struct Accumulator {
+  short values[2][NNUE_HIDDEN];
+} accumulator_t;
+
 typedef struct Board {
   square_t squares[8][8];
+  piece_t pieces[32];
+  int piece_count;
   piece_t *white_king;
   piece_t *black_king;
   piece_t *enpassantable_pawn;
   int fifty_move_rule_counter;
+  unsigned long long hash;
+  piece_color_t side_to_move;
+  // Kept up to date by make_move: pieces per colour and type, a key
+  // identifying that material balance, a Zobrist key of the pawns alone, and
+  // the squares (bit rank * 8 + file) of the pieces giving check to
+  // side_to_move.
+  int piece_counts[2][6];
+  unsigned long long material_key;
+  unsigned long long pawn_key;
+  unsigned long long checkers;
+  // When network is set, make_move and unmake_move also keep accumulator in
+  // step with the pieces on the board.
+  const nnue_network_t *network;
+  accumulator_t accumulator;
+  // When stats is set, instrumented functions count their calls into it
+  // (make STATS=1 builds only).
+  stats_t *stats;
 } board_t;
 
-typedef struct FenArray {
-  char **fens;
+typedef struct Move {
+  unsigned char from_rank;
+  unsigned char from_file;
+  unsigned char to_rank;
+  unsigned char to_file;
+  piece_type_t promotion;
+} move_t;
+
+// Everything make_move overwrites that unmake_move cannot recompute.
+typedef struct Undo {
+  piece_t *captured;
+  square_t *captured_square;
+  piece_t *enpassantable_pawn;
+  int fifty_move_rule_counter;
+  unsigned long long hash;
+  unsigned long long material_key;
+  unsigned long long pawn_key;
+  unsigned long long checkers;
+  bool had_moved;
+  piece_type_t type;
+} undo_t;
+
+typedef struct MoveList {
+  move_t moves[256];
+  int length;
+} move_list_t;
+
+typedef enum CellStyle { STYLE_PLAIN, STYLE_BLACK, STYLE_CHECK } cell_style_t;
+
+typedef struct Renderer {
+  char glyphs[8][8];
+  cell_style_t styles[8][8];
+  bool drawn;
+} renderer_t;
+
+// Moves of the current game in the archive encoding, with the hash of the
+// position before the first move and after each move. borrowed marks arrays
+// owned by someone else, which are copied to the heap when they fill up.
+typedef struct GameHistory {
+  unsigned short *moves;
+  unsigned long long *hashes;
   size_t length;
   size_t capacity;
-} fen_array_t;
+  bool borrowed;
+} game_history_t;
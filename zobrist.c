@@ -0,0 +1,92 @@
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PIECE_KEYS 0
+#define CASTLING_KEYS (PIECE_KEYS + 2 * 6 * 64)
+#define ENPASSANT_KEYS (CASTLING_KEYS + 4)
+#define SIDE_KEY (ENPASSANT_KEYS + 8)
+#define MATERIAL_KEYS (SIDE_KEY + 1)
+
+// Keys are derived from their index with splitmix64 rather than read from a
+// table filled in at startup, so hashing needs no initialisation and keeps no
+// mutable state.
+unsigned long long zobrist_key(int index) {
+  unsigned long long z = (index + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+unsigned long long piece_key(piece_type_t type, piece_color_t color, int rank,
+                             int file) {
+  return zobrist_key(PIECE_KEYS + (color * 6 + type) * 64 + rank * 8 + file);
+}
+
+unsigned long long castling_key(int rights) {
+  unsigned long long key = 0;
+
+  for (int i = 0; i < 4; ++i) {
+    if (rights & (1 << i)) {
+      key ^= zobrist_key(CASTLING_KEYS + i);
+    }
+  }
+
+  return key;
+}
+
+unsigned long long enpassant_key(int file) {
+  return zobrist_key(ENPASSANT_KEYS + file);
+}
+
+unsigned long long side_key(void) { return zobrist_key(SIDE_KEY); }
+
+// The material key holds the key for every count from 0 up to (but not
+// including) the number of pieces of each kind, so adding or removing a piece
+// toggles a single key.
+unsigned long long material_count_key(piece_type_t type, piece_color_t color,
+                                      int count) {
+  return zobrist_key(MATERIAL_KEYS + (color * 6 + type) * 16 + count);
+}
+
+bool can_still_castle(board_t *board, int rank, int rook_file) {
+  piece_t *king = board->squares[rank][4].piece;
+  piece_t *rook = board->squares[rank][rook_file].piece;
+
+  return king != NULL && king->type == KING && !king->has_moved &&
+         rook != NULL && rook->type == ROOK && !rook->has_moved &&
+         rook->color == king->color;
+}
+
+// Bit 0/1: white short/long, bit 2/3: black short/long.
+int castling_rights(board_t *board) {
+  return can_still_castle(board, 0, 7) | can_still_castle(board, 0, 0) << 1 |
+         can_still_castle(board, 7, 7) << 2 |
+         can_still_castle(board, 7, 0) << 3;
+}
+
+unsigned long long compute_hash(board_t *board, piece_color_t color_to_move) {
+  unsigned long long hash = 0;
+
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      piece_t *piece = board->squares[i][j].piece;
+
+      if (piece != NULL) {
+        hash ^= piece_key(piece->type, piece->color, i, j);
+      }
+    }
+  }
+
+  hash ^= castling_key(castling_rights(board));
+
+  if (board->enpassantable_pawn != NULL) {
+    hash ^= enpassant_key(board->enpassantable_pawn->square->file);
+  }
+
+  if (color_to_move == BLACK) {
+    hash ^= side_key();
+  }
+
+  return hash;
+}
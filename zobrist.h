@@ -0,0 +1,13 @@
+#include "types.h"
+
+#pragma once
+
+unsigned long long piece_key(piece_type_t type, piece_color_t color, int rank,
+                             int file);
+unsigned long long castling_key(int rights);
+unsigned long long enpassant_key(int file);
+unsigned long long side_key(void);
+unsigned long long material_count_key(piece_type_t type, piece_color_t color,
+                                      int count);
+int castling_rights(board_t *board);
+unsigned long long compute_hash(board_t *board, piece_color_t color_to_move);